@@ -26,14 +26,38 @@
 #define PICOL_EVAL_BUF_SIZE    (PICOL_MAX_STR*2)
 #define PICOL_SOURCE_BUF_SIZE  (PICOL_MAX_STR*64)
 
+/* The number of parsed scripts (loop and proc bodies) and, separately,
+   parsed expressions each interpreter keeps around for reuse.  A cache is
+   flushed when it fills up. */
+#define PICOL_SCRIPT_CACHE_SIZE     512
+#define PICOL_SCRIPT_CACHE_BUCKETS  64
+
+/* Set to 1 to allocate variables, commands, call frames and short names from
+   per-interpreter free lists instead of PICOL_MALLOC() every time. */
+#ifndef PICOL_POOLS
+#    define PICOL_POOLS  1
+#endif
+
 #ifndef PICOL_SMALL_STACK
 #    define PICOL_SMALL_STACK  1
 #endif
 
+/* PICOL_MAX_LEVEL is the default limit on the nesting of proc calls, which is
+   tcl_platform(maxLevel).  Proc calls made by compiled scripts, the bodies of
+   [catch], [for], [foreach], [if], [lmap], [switch] and [while], the scripts
+   of [eval] and [uplevel] and the command substitutions of [expr] and of
+   conditions don't use the C stack, so it can be raised at run time with
+   [interp recursionlimit].  PICOL_MAX_DEPTH limits how deeply the evaluator
+   may call itself through the commands that still nest in C: [lsort
+   -command], [source], [subst], [time], [try], [interp eval], math functions
+   and procs without a compiled body.  The deepest level, through [lsort
+   -command], takes up to 1.6 KB of C stack in an unoptimized build, so 100
+   levels fit in a 256 KB stack. */
+#define PICOL_MAX_LEVEL    1000
 #ifdef _MSC_VER
-#    define PICOL_MAX_LEVEL    10
+#    define PICOL_MAX_DEPTH    30
 #else
-#    define PICOL_MAX_LEVEL    30
+#    define PICOL_MAX_DEPTH    100
 #endif
 
 #ifdef __MINGW32__
@@ -42,6 +66,11 @@
 
 /* Optional features. Define as zero to disable. */
 #define PICOL_FEATURE_ARRAYS    1
+/* Add [coroutine] and [yield].  These need <ucontext.h>, which Windows,
+   musl and some BSDs lack and macOS deprecates. */
+#ifndef PICOL_FEATURE_COROUTINES
+#    define PICOL_FEATURE_COROUTINES  0
+#endif
 #if defined(_MSC_VER) || defined(__MINGW64_VERSION_MAJOR)
 /*                       ^^^ MinGW-w64 lacks glob.h. */
 #    define PICOL_FEATURE_GLOB  0
@@ -51,9 +80,61 @@
 #define PICOL_FEATURE_INTERP    1
 #define PICOL_FEATURE_IO        1
 #define PICOL_FEATURE_PUTS      1
+/* Sort long lists in [lsort] on several threads.  This needs POSIX threads
+   (build with -pthread) and a thread-safe PICOL_MALLOC(). */
+#ifndef PICOL_FEATURE_THREADS
+#    define PICOL_FEATURE_THREADS  0
+#endif
+
+/* [lsort] splits a list this long or longer among all the processors unless
+   told otherwise with -parallel.  Lists sorted with -command never are. */
+#define PICOL_SORT_PARALLEL_MIN  100000
+
+/* The size of the C stack each coroutine runs on.  Only the part a coroutine
+   uses is touched, so most of it usually stays unallocated by the OS.  How
+   much a nested evaluation takes depends on the compiler and its options, so
+   the stack use is measured as the coroutine runs.  It may nest evaluations
+   until less than PICOL_COROUTINE_STACK_RESERVE bytes are left for the
+   commands at the deepest level. */
+#if PICOL_SMALL_STACK
+#    define PICOL_COROUTINE_STACK_SIZE  (256 * 1024)
+#else
+#    define PICOL_COROUTINE_STACK_SIZE  (1024 * 1024)
+#endif
+#define PICOL_COROUTINE_STACK_RESERVE   (32 * 1024)
 
 #endif /* PICOL_CONFIGURATION */
 
+/* Defaults for the options that a configuration section copied from an older
+   version of this file lacks. */
+#ifndef PICOL_SCRIPT_CACHE_SIZE
+#    define PICOL_SCRIPT_CACHE_SIZE     512
+#endif
+#ifndef PICOL_SCRIPT_CACHE_BUCKETS
+#    define PICOL_SCRIPT_CACHE_BUCKETS  64
+#endif
+#ifndef PICOL_POOLS
+#    define PICOL_POOLS                 0
+#endif
+#ifndef PICOL_MAX_DEPTH
+/* The old PICOL_MAX_LEVEL, which the stack of such a configuration is sized
+   for. */
+#    ifdef _MSC_VER
+#        define PICOL_MAX_DEPTH         10
+#    else
+#        define PICOL_MAX_DEPTH         30
+#    endif
+#endif
+#ifndef PICOL_FEATURE_COROUTINES
+#    define PICOL_FEATURE_COROUTINES    0
+#endif
+#ifndef PICOL_FEATURE_THREADS
+#    define PICOL_FEATURE_THREADS       0
+#endif
+#ifndef PICOL_SORT_PARALLEL_MIN
+#    define PICOL_SORT_PARALLEL_MIN     100000
+#endif
+
 #ifndef PICOL_MEMORY_MANAGEMENT
 #    define PICOL_MEMORY_MANAGEMENT
 
@@ -75,9 +156,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#if PICOL_FEATURE_COROUTINES
+#include <ucontext.h>
+#endif
 #if PICOL_FEATURE_IO
 #include <sys/stat.h>
 #endif
+#if PICOL_FEATURE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #define PICOL_PATCHLEVEL "0.6.1"
 
@@ -211,6 +299,10 @@
         _p; \
         _p = picolListHead(_p, _v, _size))
 
+/* The size of a buffer that holds any element of the list _s.  The extra
+   character keeps picolListHead() from stopping at a full buffer. */
+#define PICOL_ELEMENT_SIZE(_s) (strlen(_s) + 2)
+
 #define PICOL_LAPPEND(dst, src) \
     do { \
         int needbraces = picolNeedsBraces(src); \
@@ -253,10 +345,9 @@
 
 #define PICOL_SCAN_INT(v,x) \
     do { \
-        int base = picolIsInt(x); \
-        if (base > 0) {v = picolScanInt(x, base);} \
-        else { return picolErrFmt(interp, "expected integer " \
-                                  "but got \"%s\"", x); } \
+        int _n; \
+        if (picolGetInt(interp, x, &_n) != PICOL_OK) {return PICOL_ERR;} \
+        v = _n; \
     } while (0)
 
 #define PICOL_SCAN_PTR(v,x) \
@@ -270,16 +361,28 @@
 #define PICOL_SUBCMD(x) \
     (PICOL_EQ(argv[1], x))
 
+#if PICOL_FEATURE_COROUTINES
+#    define PICOL_TOO_DEEP(i) \
+        ((i)->depth >= PICOL_MAX_DEPTH || \
+         ((i)->coroutine != NULL && picolCoroutineStackFull((i)->coroutine)))
+#else
+#    define PICOL_TOO_DEEP(i) ((i)->depth >= PICOL_MAX_DEPTH)
+#endif
+
 #define PICOL_UNUSED(x) (void)(x)
 
 typedef enum picolResult {
-    PICOL_OK, PICOL_ERR, PICOL_RETURN, PICOL_BREAK, PICOL_CONTINUE
+    PICOL_OK, PICOL_ERR, PICOL_RETURN, PICOL_BREAK, PICOL_CONTINUE,
+    /* Not seen by scripts.  A command returns it through picolTailEval() to
+       have its caller evaluate interp->tail in its place. */
+    PICOL_EVAL_TAIL
 } picolResult;
 typedef enum picolBool {PICOL_FALSE = 0, PICOL_TRUE = 1} picolBool;
 
 enum {PICOL_PT_ESC, PICOL_PT_STR, PICOL_PT_CMD, PICOL_PT_VAR, PICOL_PT_SEP,
       PICOL_PT_EOL, PICOL_PT_EOF, PICOL_PT_XPND};
 enum {PICOL_PTR_NONE, PICOL_PTR_CHAN, PICOL_PTR_ARRAY, PICOL_PTR_INTERP};
+enum {PICOL_CO_RUNNING, PICOL_CO_SUSPENDED, PICOL_CO_DONE};
 
 /* -------------------------------------------------------------------- types */
 typedef struct picolParser {
@@ -293,10 +396,103 @@ typedef struct picolParser {
     int    expand;      /* true after {*} */
 } picolParser;
 
+/* A reference-counted value.  Besides the string form, it caches the last
+   internal form (an integer, a list or a script) computed from the string.
+   The string must not change while the value is shared (rc > 1). */
+enum {PICOL_OBJ_STRING, PICOL_OBJ_INT, PICOL_OBJ_LIST, PICOL_OBJ_SCRIPT,
+      PICOL_OBJ_EXPR};
+
+typedef struct picolObj {
+    int               rc;   /* reference count */
+    int               type; /* the internal form, PICOL_OBJ_... */
+    char*             str;
+    size_t            len;  /* the length of str, valid if cap is not 0 */
+    size_t            cap;  /* the allocated size of str or 0 if unknown */
+    union {
+        int                 i;
+        struct {
+            int               count;
+            struct picolObj** elems;
+        }                   list;
+        struct picolScript* script;
+        struct picolExpr*   expr;
+    }                 rep;
+} picolObj;
+
+#define PICOL_INCR_REF(o) ((o)->rc++)
+
+/* A string that grows as it is appended to.  The capacity doubles, so
+   building a string of length n takes O(n) time however it is split.  buf is
+   always NUL-terminated. */
+typedef struct picolStr {
+    char*  buf;
+    size_t len;
+    size_t cap; /* the allocated size of buf */
+} picolStr;
+
+#define PICOL_STR_INIT_SIZE 64
+
+/* Argument vectors with room for the words of a typical command inside the
+   struct itself.  They only allocate memory for longer commands.  argv points
+   either to space or to the heap, so the struct must not be copied. */
+#define PICOL_INLINE_ARGS 8
+
+typedef struct picolArgv {
+    int          argc;
+    int          cap;
+    const char** argv;
+    const char*  space[PICOL_INLINE_ARGS];
+} picolArgv;
+
+typedef struct picolObjv {
+    int               objc;
+    int               cap;
+    struct picolObj** objv;
+    struct picolObj*  space[PICOL_INLINE_ARGS];
+} picolObjv;
+
+/* A bump allocator for strings that die together, like the words of a
+   command.  picolArenaReset() releases all of them at once.
+   picolArenaRelease() releases everything allocated since a given allocation,
+   which makes an arena work as a stack. */
+typedef struct picolArenaBlock {
+    struct picolArenaBlock* prev;
+    size_t                  size; /* the size of the data after the header */
+    size_t                  used;
+} picolArenaBlock;
+
+typedef struct picolArena {
+    picolArenaBlock* top;
+    picolArenaBlock* spare; /* the largest released block, kept for reuse */
+} picolArena;
+
+#define PICOL_ARENA_BLOCK_SIZE 1024
+
+/* Free lists of small blocks by size class.  Blocks are carved out of chunks
+   that are only returned to the system when the pool is destroyed.  The
+   chunks double in size, so there are few of them to release.  Freeing a
+   block takes its size, so the pool needs no headers. */
+#define PICOL_POOL_GRAIN          16
+#define PICOL_POOL_CLASSES        8  /* up to 128 bytes */
+#define PICOL_POOL_MAX            (PICOL_POOL_GRAIN * PICOL_POOL_CLASSES)
+#define PICOL_POOL_CHUNK_SIZE     4096
+#define PICOL_POOL_MAX_CHUNK_SIZE (PICOL_POOL_CHUNK_SIZE * 64)
+
+typedef struct picolPool {
+    void*  free[PICOL_POOL_CLASSES];
+    char*  chunks;    /* linked through their first word */
+    char*  next;      /* the unused part of the newest chunk */
+    size_t left;
+    size_t chunksize; /* the size of the next chunk */
+} picolPool;
+/* The smallest buffer allocated for a result.  It fits any integer. */
+#define PICOL_RESULT_MIN_SIZE 32
+
 typedef struct picolVar {
     struct picolVar* next;
     char*  name;
-    char*  val;
+    char*  val; /* obj->str or NULL for a link to a global variable */
+    picolObj* obj;
 } picolVar;
 
 struct picolInterp; /* forward declaration */
@@ -308,8 +504,20 @@ typedef picolResult (*picolFunc)(
     void *pd
 );
 
+/* A function a command passes to picolTailEvalCont() along with a script.  It
+   is called with data and the result code of the script when the script is
+   done and returns what the command does, which may be another script to
+   evaluate through picolTailEvalCont(). */
+typedef picolResult (*picolCont)(
+    struct picolInterp *interp,
+    void *data,
+    picolResult rc
+);
+
 typedef struct picolCmd {
-    struct picolCmd*      next;
+    struct picolCmd*      next; /* commands in the order of definition */
+    struct picolCmd*      prev;
+    unsigned int          hash;
     char*                 name;
     picolFunc             func;
     unsigned char         isproc; /* is this command a procedure? */
@@ -320,16 +528,295 @@ typedef struct picolCmd {
 
 typedef struct picolCallFrame {
     picolVar*              vars;
+    /* The words of the proc call that made the frame.  command is built from
+       them by picolFrameCommand when first asked for. */
+    int                    argc;
+    const char**           argv;
     char*                  command;
     struct picolCallFrame* parent; /* parent is NULL at top level */
+    struct picolProc*      proc;   /* the proc that owns slots */
+    picolVar**             slots;  /* the proc's locals by slot number */
+    int                    nslots;
+    /* A frame with many variables keeps them in hash buckets instead of the
+       list vars. */
+    picolVar**             table;
+    int                    tablesize; /* a power of two */
+    int                    nvars;
+    /* The command [tailcall] left to run in place of the proc, see
+       picolWordsNew. */
+    int                    tailcallc;
+    picolObj**             tailcallv;
 } picolCallFrame;
 
+#define PICOL_FRAME_BUCKETS(cf) ((cf)->table == NULL ? 1 : (cf)->tablesize)
+#define PICOL_FRAME_BUCKET(cf, i) \
+    ((cf)->table == NULL ? (cf)->vars : (cf)->table[i])
+
+/* Bytecode.  Every op but PICOL_OP_CALL produces a piece of a word, which
+   either starts a new word or is appended to the last one. */
+enum {PICOL_OP_PUSH, PICOL_OP_LOAD, PICOL_OP_EVAL, PICOL_OP_CALL};
+#define PICOL_OPF_WORD    1 /* the piece starts a new word */
+#define PICOL_OPF_EXPAND  2 /* the parser saw {*} while reading the piece */
+#define PICOL_OPF_STATIC  4 /* the command name of PICOL_OP_CALL is literal */
+
+typedef struct picolOp {
+    unsigned char       code;   /* PICOL_OP_... */
+    unsigned char       flags;  /* PICOL_OPF_... */
+    char*               text;   /* a literal, a variable name, or a script */
+    struct picolScript* script; /* the compiled text of PICOL_OP_EVAL */
+    picolObj*           obj;    /* the value of PICOL_OP_PUSH */
+    picolCmd*           cmd;    /* the command PICOL_OP_CALL resolved... */
+    unsigned long       owner;  /* ...in the interpreter with this id, and... */
+    unsigned long       epoch;  /* ...valid while its epoch doesn't change */
+    int                 slot;   /* the local of PICOL_OP_LOAD or -1 */
+} picolOp;
+
+typedef struct picolScript {
+    struct picolScript* next; /* the next script in the same cache bucket */
+    int                 rc;   /* reference count */
+    unsigned int        hash;
+    char*               text;
+    int                 count;
+    picolOp*            ops;
+    struct picolProc*   owner; /* the proc whose slots the ops refer to */
+} picolScript;
+
+/* Parsed expressions.  A node refers to its operands by their index in the
+   nodes of the expression. */
+enum {
+    PICOL_EX_NUM, PICOL_EX_STR, PICOL_EX_VAR, PICOL_EX_CMD, PICOL_EX_SUBST,
+    PICOL_EX_FUNC,
+    /* Unary operators. */
+    PICOL_EX_NEG, PICOL_EX_POS, PICOL_EX_NOT, PICOL_EX_BITNOT,
+    /* Binary operators. */
+    PICOL_EX_POW, PICOL_EX_MUL, PICOL_EX_DIV, PICOL_EX_MOD, PICOL_EX_ADD,
+    PICOL_EX_SUB, PICOL_EX_SHL, PICOL_EX_SHR, PICOL_EX_LT, PICOL_EX_GT,
+    PICOL_EX_LE, PICOL_EX_GE, PICOL_EX_EQ, PICOL_EX_NE, PICOL_EX_STREQ,
+    PICOL_EX_STRNE, PICOL_EX_IN, PICOL_EX_NI, PICOL_EX_BITAND,
+    PICOL_EX_BITXOR, PICOL_EX_BITOR, PICOL_EX_AND, PICOL_EX_OR,
+    PICOL_EX_TERNARY
+};
+
+typedef struct picolExprNode {
+    int               op;      /* PICOL_EX_... */
+    int               a, b, c; /* the operands or -1 */
+    int               next;    /* the next argument of a function or -1 */
+    int               depth;   /* the height of the subtree */
+    int               i;       /* the value of PICOL_EX_NUM */
+    char*             text;    /* a variable, a script or a function name */
+    picolObj*         obj;     /* a literal, the function name or the script */
+    picolScript*      script;  /* the compiled text of PICOL_EX_CMD */
+} picolExprNode;
+
+typedef struct picolExpr {
+    struct picolExpr* next; /* the next expression in the same cache bucket */
+    int               rc;   /* reference count */
+    unsigned int      hash;
+    char*             text;
+    int               count;
+    int               size;
+    picolExprNode*    nodes;
+    int               root;
+    int               subst; /* has a compiled command substitution */
+} picolExpr;
+
+/* The value of a subexpression: obj, or the integer i if obj is NULL. */
+typedef struct picolExprValue {
+    picolObj*         obj; /* holds a reference */
+    int               i;
+} picolExprValue;
+
+/* What picolExprTail() calls with the value of the expression.  v is only set
+   if rc is PICOL_OK, and the function must release it then. */
+typedef picolResult (*picolExprDone)(
+    struct picolInterp *interp,
+    void *data,
+    picolResult rc,
+    picolExprValue *v
+);
+
+/* An expression picolExprTail() is evaluating.  Its command substitutions are
+   left to the caller of the command, and the expression is evaluated again
+   from the start once each is done.  The values of the variables, command
+   substitutions and functions already evaluated are logged and replayed, so
+   every evaluation sees the same values and takes the same path. */
+typedef struct picolExprRun {
+    picolExpr*        e;       /* holds a reference */
+    picolExprValue*   log;
+    int               count;   /* the number of values logged */
+    int               size;
+    int               pos;     /* the next value to replay */
+    picolObj*         pending; /* the command substitution to evaluate */
+    picolExprDone     done;
+    void*             data;
+} picolExprRun;
+
+/* The deepest expression the parser accepts.  Evaluation recurses on the C
+   stack once per level, except along a chain of left-associative operators
+   like 1 + 2 + 3.  The c of a binary operator that is the left operand of
+   the next one in a chain is that operator. */
+#define PICOL_EXPR_MAX_DEPTH 256
+#define PICOL_EX_CHAINED(e, n) \
+    ((e)->nodes[n].op >= PICOL_EX_POW && (e)->nodes[n].op <= PICOL_EX_OR && \
+     (e)->nodes[n].c >= 0)
+
+/* The state of [for], [foreach], [lmap] and [while] between the runs of the
+   body, which they leave to the caller with picolTailEvalCont(). */
+typedef struct picolLoop {
+    picolObj*         test;  /* the condition of [for] and [while] */
+    picolObj*         next;  /* the step of [for] */
+    picolObj*         body;
+    picolObj**        vars;  /* the variables of [foreach] and [lmap] */
+    int               varc;
+    picolObj**        elems; /* the list they go over */
+    int               elemc;
+    int               pos;   /* the next element to set a variable to */
+    int               accumulate; /* [lmap] */
+    int               stepping;   /* the step or the init of [for] runs */
+    picolStr          result;
+} picolLoop;
+
+/* The clauses of [if] once a condition has to wait for a command
+   substitution. */
+typedef struct picolIf {
+    int               argc;
+    picolObj**        objv;  /* the arguments, which hold references */
+    const char**      argv;
+    int               i;     /* the condition being evaluated */
+} picolIf;
+
+/* lsort computes the key of every element once before it sorts them. */
+enum {PICOL_SORT_ASCII, PICOL_SORT_INTEGER, PICOL_SORT_REAL,
+      PICOL_SORT_COMMAND};
+
+typedef struct picolSortKey {
+    picolObj*         elem;  /* the element, which holds a reference */
+    picolObj*         key;   /* the element or its part at -index, ditto */
+    char*             lower; /* the lowercase key for -nocase or NULL */
+    const char*       str;   /* the string to compare, key or lower */
+    int               i;
+    double            d;
+    int               dup;   /* 1 if equal to the next key once sorted */
+} picolSortKey;
+
+typedef struct picolSort {
+    struct picolInterp* interp;
+    int               mode;  /* PICOL_SORT_... */
+    int               decreasing;
+    int               nocase;
+    int               cmdc;  /* the words of the -command prefix */
+    picolObj**        cmdv;
+    int               unique;
+    picolResult       rc;    /* the first error of the -command */
+} picolSort;
+
+/* A piece of a parallel sort: sort a in place if out is NULL, otherwise
+   write elements start to end - 1 of the merge of a and b to out. */
+typedef struct picolSortTask {
+    picolSort*        sort;
+    picolSortKey**    a;
+    int               na;
+    picolSortKey**    b;
+    int               nb;
+    picolSortKey**    out;
+    int               start;
+    int               end;
+} picolSortTask;
+
+/* The most threads [lsort] uses. */
+#define PICOL_SORT_MAX_THREADS 64
+
+typedef struct picolParam {
+    char*             name;
+    char*             def;  /* the default value or NULL */
+} picolParam;
+
 typedef struct picolProc {
     int               rc; /* reference count */
     char*             args;
     char*             body;
+    picolScript*      code; /* body compiled; NULL if it doesn't parse */
+    int               nparams;
+    picolParam*       params; /* args parsed */
+    int               variadic; /* true if the last parameter is "args" */
+    int               nslots;
+    char**            slotnames; /* the locals the body reads by name */
 } picolProc;
 
+/* A command between picolCallBegin() and picolCallEnd() and the state of the
+   interpreter to restore when it returns. */
+typedef struct picolCall {
+    struct picolCmd*  cmd;
+    int               argc;
+    const char**      argv;
+    const char**      uargv; /* argv with "unknown" prepended or NULL */
+    int               objc;
+    picolObj**        objv;
+    int               curargc;
+    const char**      curargv;
+    char*             current;
+    /* The words of a [tailcall] that replaced the command or NULL. */
+    int               tailcallc;
+    picolObj**        tailcallv;
+} picolCall;
+
+/* A script being run by picolEvalScript().  The records form a stack on the
+   heap instead of the C stack. */
+enum {
+    PICOL_EXEC_SCRIPT, /* the script picolEvalScript() was called with */
+    PICOL_EXEC_SUBST,  /* a command substitution */
+    PICOL_EXEC_PROC,   /* the body of a proc */
+    PICOL_EXEC_TAIL    /* a script a command left in interp->tail */
+};
+
+typedef struct picolExec {
+    struct picolExec* parent;
+    picolScript*      script; /* holds a reference */
+    int               pc;
+    int               kind;   /* PICOL_EXEC_... */
+    int               expand;
+    picolObjv         words;  /* the words of the command being built */
+    picolArgv         args;   /* their strings */
+    picolCall         call;   /* the command being run */
+    /* What to do when a PICOL_EXEC_TAIL is done: the frame to return to and
+       the function to call, or NULL. */
+    picolCallFrame*   frame;
+    picolCont         cont;
+    void*             contdata;
+} picolExec;
+
+/* The number of unused picolExec records an interpreter keeps. */
+#define PICOL_EXEC_CACHE_SIZE 64
+
+#if PICOL_FEATURE_COROUTINES
+/* A coroutine runs on a C stack of its own.  The interpreter state that
+   belongs to whichever side isn't running is kept here and exchanged on every
+   switch, so nothing is copied. */
+typedef struct picolCoroutine {
+    struct picolInterp*    interp;
+    int                    state;   /* PICOL_CO_... */
+    int                    killed;  /* set to make [yield] fail */
+    picolResult            rc;      /* the result once state is done */
+    ucontext_t             ctx;     /* where the coroutine goes on */
+    ucontext_t             caller;  /* where the resumer goes on */
+    char*                  stack;
+    char*                  top;     /* where its use of the stack starts */
+    struct picolCoroutine* resumer; /* the coroutine that resumed it */
+    picolCallFrame*        base;    /* the global frame */
+    int                    wordc;   /* the command the coroutine runs, see */
+    picolObj**             wordv;   /* picolWordsNew */
+    picolCallFrame*        callframe;
+    int                    level;
+    int                    depth;
+    int                    curargc;
+    const char**           curargv;
+    char*                  current;
+    int                    objc;
+    picolObj**             objv;
+    picolArena             scratch;
+} picolCoroutine;
+#endif
+
 typedef struct picolPtr {
     struct picolPtr*  next;
     void*             ptr;
@@ -339,15 +826,52 @@ typedef struct picolPtr {
 typedef struct picolInterp {
     int             level;      /* level of scope nesting */
     int             maxlevel;
+    int             depth;      /* the nesting of evaluations on the C stack */
     picolCallFrame* callframe;
-    picolCmd*       commands;
-    char*           current;    /* currently executed command */
-    char*           result;
+    picolCmd*       commands;   /* the most recently defined command first */
+    picolCmd**      cmdtable;   /* commands hashed by name */
+    int             cmdcap;     /* the size of cmdtable, a power of two */
+    int             cmdcount;
+    unsigned long   id;         /* unique among all interpreters ever created */
+    unsigned long   cmdepoch;   /* changes whenever a command is (re)defined */
+    picolArena      scratch;    /* for temporary buffers */
+    picolPool       pool;       /* for variables, commands and frames */
+    int             curargc;    /* the words of the command being... */
+    const char**    curargv;    /* ...executed, or NULL at top level */
+    char*           current;    /* curargv as a list, see picolCurrentCommand */
+    char*           result;     /* resultobj->str */
+    picolObj*       resultobj;
+    size_t          resultcap;  /* the allocated size of result or 0 */
+    int             objc;       /* the values of the arguments of the... */
+    picolObj**      objv;       /* ...innermost command, if it has them */
     int             debug;      /* 1 to display each command, 0 not to */
+    picolObj*       tail;       /* see PICOL_EVAL_TAIL */
+    picolCallFrame* tailframe;  /* the frame to return to after tail */
+    picolCont       tailcont;   /* what to call after tail... */
+    void*           taildata;   /* ...and its data */
+    struct picolExprRun* exprrun; /* see picolExprTail */
+    int             tailcallc;  /* the [tailcall] of the proc that has... */
+    picolObj**      tailcallv;  /* ...just returned, see picolProcLeave */
+    picolExec*      execfree;   /* unused picolExec records */
+#if PICOL_FEATURE_COROUTINES
+    picolCoroutine* coroutine;  /* the running coroutine or NULL */
+#endif
+    int             execfreecount;
     picolPtr*       validptrs;
+    picolScript*    scripts[PICOL_SCRIPT_CACHE_BUCKETS];
+    int             scriptcount;
+    /* The hashes of scripts seen once but not cached yet. */
+    unsigned int    scriptseen[PICOL_SCRIPT_CACHE_BUCKETS];
+    picolExpr*      exprs[PICOL_SCRIPT_CACHE_BUCKETS];
+    int             exprcount;
+    unsigned int    exprseen[PICOL_SCRIPT_CACHE_BUCKETS];
 } picolInterp;
 
 #define PICOL_ARR_BUCKETS 32
+#define PICOL_CMD_TABLE_SIZE 64 /* the initial size of the command table */
+#define PICOL_VAR_TABLE_SIZE 64 /* the initial size of a frame's var table */
+/* The number of variables at which a call frame switches to a table. */
+#define PICOL_VAR_TABLE_THRESHOLD 16
 
 typedef struct picolArray {
     picolVar* table[PICOL_ARR_BUCKETS];
@@ -359,15 +883,16 @@ typedef struct picolArray {
 #define picolEval(_i, _t)              picolEval2(_i, _t, 1)
 #define picolGetGlobalVar(_i, _n)      picolGetVar2(_i, _n, 1)
 #define picolGetVar(_i, _n)            picolGetVar2(_i, _n, 0)
-#define picolSetBoolResult(_i, x)      picolSetFmtResult(_i, "%d", !!x)
+#define picolSetBoolResult(_i, x)      picolSetIntResult(_i, !!(x))
 #define picolSetGlobalVar(_i, _n, _v)  picolSetVar2(_i, _n, _v, 1)
-#define picolSetIntResult(_i, x)       picolSetFmtResult(_i, "%d", x)
 #define picolSetVar(_i, _n, _v)        picolSetVar2(_i, _n, _v, 0)
 #define picolSubst(_i, _t)             picolEval2(_i, _t, 0)
 
 /* prototypes */
 
+picolResult picolCopyNew(char* buf, size_t buf_size, char* str);
 picolResult picolList(char* buf, size_t buf_size, int argc, const char** argv);
+char* picolListNew(int argc, const char** argv);
 int   picolNeedsBraces(const char* str);
 const char* picolListHead(const char* start, char* target, size_t target_size);
 const char* picolStrFirstTrailing(const char* str, char chr);
@@ -430,6 +955,7 @@ PICOL_COMMAND(split);
 PICOL_COMMAND(string);
 PICOL_COMMAND(subst);
 PICOL_COMMAND(switch);
+PICOL_COMMAND(tailcall);
 PICOL_COMMAND(time);
 PICOL_COMMAND(trace);
 PICOL_COMMAND(try);
@@ -443,8 +969,8 @@ PICOL_COMMAND(while);
     picolArray* picolArrCreate(picolInterp *interp, const char *name);
     picolResult picolArrDestroy(picolArray* ap);
     picolResult picolArrDestroyByName(picolInterp* interp, const char* name);
-    picolResult picolArrGetAll(picolArray *ap, const char* pat, char* buf,
-                               size_t buf_size, int mode);
+    void        picolArrGetAll(picolArray *ap, const char* pat, picolStr *s,
+                               int mode);
     picolVar*   picolArrGetKey(picolArray* ap, const char* key);
     picolArray* picolArrFindByName(picolInterp* interp, const char* name,
                                    int create, char* key_dest,
@@ -457,6 +983,17 @@ PICOL_COMMAND(while);
     char*       picolArrStat(picolArray *ap, char* buf, size_t buf_size);
     int         picolHash(const char* key, int modulo);
 #endif
+#if PICOL_FEATURE_COROUTINES
+    PICOL_COMMAND(coroutine);
+    PICOL_COMMAND(Coroutine);
+    PICOL_COMMAND(yield);
+    void picolCoroutineMain(unsigned int hi, unsigned int lo);
+    int picolCoroutineStackFull(picolCoroutine *co);
+    void picolCoroutineSwap(picolInterp *interp, picolCoroutine *co);
+    picolResult picolCoroutineResume(picolInterp *interp, picolCoroutine *co);
+    picolResult picolCoroutineRun(picolInterp *interp, picolCoroutine *co);
+    void picolCoroutineDelete(picolInterp *interp, picolCoroutine *co);
+#endif
 #if PICOL_FEATURE_GLOB
     PICOL_COMMAND(glob);
 #endif
@@ -483,23 +1020,63 @@ PICOL_COMMAND(while);
 picolBool   picolValidPtr(picolInterp *interp, int type, void* ptr);
 picolResult picolValidPtrAdd(picolInterp *interp, int type, void* ptr);
 picolResult picolValidPtrRemove(picolInterp *interp, void* ptr);
+picolResult picolProcEnter(picolInterp *interp, picolProc *x, int argc,
+                           const char **argv);
+picolResult picolProcLeave(picolInterp *interp, picolResult rc);
+picolResult picolProcRun(picolInterp *interp, picolProc *x, int argc,
+                         const char **argv);
+picolResult picolTailcallBegin(picolInterp *interp, picolCall *call,
+                               picolCmd **cp);
+picolObj** picolWordsNew(picolInterp *interp, int count, const char **argv);
+void picolWordsFree(picolInterp *interp, int count, picolObj **words);
 picolResult picolCallProc(picolInterp *interp, int argc, const char **argv,
                           void *pd);
+picolProc* picolCreateProc(picolInterp *interp, const char *args,
+                           const char *body);
+void picolFreeProc(picolProc *proc);
+void picolAssignSlots(picolProc *proc, picolScript *script);
 picolBool picolAppend(char *dst, int dstSize, const char *src);
 picolBool picolLappend(char *dst, int dstSize, const char *src);
 picolResult picolConcat(char* buf, size_t buf_size, int argc,
                         const char** argv);
+char* picolConcatNew(int argc, const char** argv);
 picolResult picolCondition(picolInterp *interp, const char* str);
+const char* picolCurrentCommand(picolInterp *interp);
 picolResult picolErr(picolInterp *interp, const char* str);
 /* Backwards compatibility. */
 #define picolErr1 picolErrFmt
 picolResult picolErrFmt(picolInterp *interp, const char* format,
                         const char* arg);
 picolResult picolEval2(picolInterp *interp, const char *script, int mode);
+picolResult picolEvalText(picolInterp *interp, const char *script, int mode);
+picolResult picolEvalArg(picolInterp *interp, const char *script);
+picolResult picolEvalCommand(picolInterp *interp, picolCmd *c, int argc,
+                             const char **argv, picolObj **objv, int *halt);
+picolResult picolCallBegin(picolInterp *interp, picolCall *call,
+                           picolCmd **cp, int argc, const char **argv,
+                           picolObj **objv, int *halt);
+picolResult picolCallEnd(picolInterp *interp, picolCall *call,
+                         picolResult rc);
+picolResult picolTailEval(picolInterp *interp, picolObj *obj);
+picolResult picolTailEvalCont(picolInterp *interp, picolObj *obj,
+                              picolCont cont, void *data);
+picolResult picolRunTail(picolInterp *interp);
+picolScript* picolTailScript(picolInterp *interp, picolObj *obj);
+picolScript* picolGetScriptFromObj(picolObj *obj);
+picolExec* picolExecPush(picolInterp *interp, picolExec *parent,
+                         picolScript *script, int kind);
+void picolExecPop(picolInterp *interp, picolExec *x);
+void picolExecWord(picolExec *x, picolObj *obj);
+void picolExecNext(picolExec *x);
+picolResult picolExecCall(picolInterp *interp, picolExec **xp, picolCmd *c);
+picolResult picolExecTail(picolInterp *interp, picolExec **xp);
+picolResult picolEvalObj(picolInterp *interp, picolObj *obj);
+picolResult picolEvalScript(picolInterp *interp, picolScript *script);
 size_t picolExpandLC(char* dest, size_t num, const char* source);
 picolResult picol_EqNe(picolInterp* interp, int argc, const char** argv,
                        void* pd);
 picolResult picolGetToken(picolInterp *interp, picolParser *p);
+unsigned int picolHashString(const char* key);
 picolResult picol_InNi(picolInterp *interp, int argc, const char **argv,
                        void *pd);
 #if PICOL_FEATURE_IO
@@ -508,9 +1085,25 @@ picolBool picolIsDirectory(const char* path);
 int picolIsInt(const char* str);
 picolResult picolLmap(picolInterp* interp, const char* vars, const char* list,
                       const char* body, int accumulate);
-picolResult picol_Lsort(picolInterp *interp, int argc, const char **argv,
-                        void *pd);
+picolLoop* picolLoopNew(void);
+void picolLoopFree(picolLoop *loop);
+picolResult picolLoopFinish(picolInterp *interp, picolLoop *loop);
+picolResult picolLoopNext(picolInterp *interp, picolLoop *loop);
+picolResult picolLoopTested(picolInterp *interp, void *data, picolResult rc,
+                            picolExprValue *v);
+picolResult picolLoopDone(picolInterp *interp, void *data, picolResult rc);
+picolResult picolIfClauses(picolInterp *interp, int argc, const char **argv,
+                           int i, picolIf *st);
+picolResult picolIfTested(picolInterp *interp, void *data, picolResult rc,
+                          picolExprValue *v);
+void picolIfFree(picolIf *st);
+picolResult picolCatchDone(picolInterp *interp, void *data, picolResult rc);
+picolResult picolExprSetResult(picolInterp *interp, void *data,
+                               picolResult rc, picolExprValue *v);
 int picolMatch(const char* pat, const char* str);
+picolResult picolSearchCompare(picolInterp *interp, picolObj *elem,
+                               const char *pattern, int n, int integer,
+                               int *diff);
 picolResult picol_Math(picolInterp *interp, int argc, const char** argv,
                        void *pd);
 picolResult picolParseBrace(picolParser *p);
@@ -520,17 +1113,25 @@ picolResult picolParseEOL(picolParser *p);
 picolResult picolParseSep(picolParser *p);
 picolResult picolParseString(picolParser *p);
 picolResult picolParseVar(picolParser *p);
-int picolQsortCompInt(const void* a, const void *b);
-int picolQsortCompStr(const void* a, const void *b);
-int picolQsortCompStrDecr(const void* a, const void *b);
-picolResult picolQuoteForShell(char* dest, size_t dest_size, int argc,
-                               const char** argv);
+int picolSortCommand(picolSort *sort, picolSortKey *a, picolSortKey *b);
+int picolSortCompare(picolSort *sort, picolSortKey *a, picolSortKey *b);
+picolResult picolSortKeys(picolSort *sort, picolSortKey **keys, int n);
+#if PICOL_FEATURE_THREADS
+int picolSortSplit(picolSortTask *task, int i);
+void picolSortMerge(picolSortTask *task);
+void* picolSortThread(void *arg);
+void picolSortRun(picolSortTask *tasks, int count);
+void picolSortParallel(picolSort *sort, picolSortKey **keys, int n,
+                       int threads);
+#endif
+void picolQuoteForShell(picolStr *dest, int argc, const char **argv);
 picolResult picolRegisterCmd(picolInterp *interp, const char *name,
                              picolFunc f, void *pd);
 picolResult picolReplace(char* str, size_t str_size, char* from, char* to,
                          int nocase);
 int picolScanInt(const char* str, int base);
 picolResult picolSetFmtResult(picolInterp* interp, const char* fmt, int result);
+picolResult picolSetIntResult(picolInterp *interp, int n);
 picolResult picolSetIntVar(picolInterp *interp, const char *name, int value);
 picolResult picolSetResult(picolInterp *interp, const char *s);
 picolResult picolSetVar2(picolInterp *interp, const char *name, const char *val,
@@ -540,19 +1141,140 @@ int picolStrCompare(const char* a, const char* b, size_t len, int nocase);
 picolResult picolUnsetVar(picolInterp* interp, const char* name);
 picolBool picolWildEq(const char* pat, const char* str, int n);
 picolCmd *picolGetCmd(picolInterp *interp, const char *name);
+picolCmd **picolCmdSlot(picolInterp *interp, const char *name,
+                        unsigned int hash);
+void picolCmdTableGrow(picolInterp *interp);
+void picolCmdTableRemove(picolInterp *interp, picolCmd *cmd);
 picolInterp* picolCreateInterp(void);
 picolInterp* picolCreateInterp2(int register_core_cmds, int randomize);
 picolVar *picolGetVar2(picolInterp *interp, const char *name, int global);
 void picolDropCallFrame(picolInterp *interp);
+void picolFrameAdd(picolCallFrame *cf, picolVar *v);
+picolVar **picolFrameBucket(picolCallFrame *cf, const char *name);
+picolVar *picolFrameGet(picolCallFrame *cf, const char *name);
+const char* picolFrameCommand(picolCallFrame *cf);
+void picolFrameInit(picolCallFrame *cf, picolCallFrame *parent);
+void picolFrameRehash(picolCallFrame *cf, int size);
+picolVar *picolFrameRemove(picolCallFrame *cf, const char *name);
 void picolEscape(char *str, size_t str_size);
-void picolFreeCmd(picolCmd *cmd);
+void picolFreeCmd(picolPool *pool, picolCmd *cmd);
 void picolFreeInterp(picolInterp *interp);
 void picolInitInterp(picolInterp *interp);
+unsigned long picolNewInterpId(void);
 void picolInitParser(picolParser *p, const char *text);
 void* picolScanPtr(const char* str);
 void picolRegisterCoreCmds(picolInterp *interp);
+picolScript* picolCompileScript(const char *text);
+void picolFreeScript(picolScript *script);
+void picolReleaseScript(picolScript *script);
+picolScript* picolScriptCacheGet(picolInterp *interp, const char *text);
+void picolScriptCacheFlush(picolInterp *interp);
+picolExpr* picolParseExpr(picolInterp *interp, const char *text);
+void picolFreeExpr(picolExpr *e);
+void picolReleaseExpr(picolExpr *e);
+picolExpr* picolExprCacheGet(picolInterp *interp, const char *text);
+void picolExprCacheFlush(picolInterp *interp);
+picolResult picolExprEval(picolInterp *interp, picolExpr *e, int n,
+                          picolExprValue *v);
+int picolExprAddNode(picolInterp *interp, picolExpr *e, int op, int a, int b,
+                     int c);
+int picolExprSyntaxError(picolInterp *interp, picolExpr *e);
+char* picolExprCopy(const char *start, const char *end);
+int picolExprOperator(const char *s, int *len, int *prec);
+int picolExprParseCall(picolInterp *interp, picolExpr *e, const char **pos,
+                       char *name, int depth);
+int picolExprAddWord(picolInterp *interp, picolExpr *e, picolParser *p);
+int picolExprParseQuoted(picolInterp *interp, picolExpr *e,
+                         const char **pos);
+int picolExprParseOperand(picolInterp *interp, picolExpr *e,
+                          const char **pos, int depth);
+int picolExprParseUnary(picolInterp *interp, picolExpr *e, const char **pos,
+                        int depth);
+int picolExprParseBinary(picolInterp *interp, picolExpr *e, const char **pos,
+                         int minprec, int depth);
+int picolExprParseTernary(picolInterp *interp, picolExpr *e,
+                          const char **pos, int depth);
+void picolExprValueFree(picolExprValue *v);
+int picolExprIsInt(picolInterp *interp, picolExprValue *v, int *n);
+picolResult picolExprGetInt(picolInterp *interp, picolExprValue *v, int *n);
+const char* picolExprString(picolExprValue *v, char *buf, size_t size);
+picolResult picolExprEvalInt(picolInterp *interp, picolExpr *e, int n,
+                             int *i);
+int picolExprCompare(picolInterp *interp, int op, picolExprValue *l,
+                     picolExprValue *r);
+picolResult picolExprArith(picolInterp *interp, int op, int a, int b, int *c);
+picolResult picolExprCall(picolInterp *interp, picolExpr *e, int n,
+                          picolExprValue *v);
+picolResult picolExprBinary(picolInterp *interp, picolExpr *e, int n,
+                            picolExprValue *l, picolExprValue *v);
+picolExpr* picolGetExprFromObj(picolInterp *interp, picolObj *obj);
+picolExpr* picolArgExpr(picolInterp *interp, const char *arg);
+picolResult picolEvalExpr(picolInterp *interp, const char *text);
+picolResult picolEvalCondition(picolInterp *interp, const char *str,
+                               int *truth);
+picolResult picolExprEvalRoot(picolInterp *interp, picolExpr *e,
+                              picolExprValue *v);
+int picolExprReplay(picolInterp *interp, picolExprValue *v);
+void picolExprLog(picolExprRun *run, picolExprValue *v);
+void picolExprRunFree(picolExprRun *run);
+picolResult picolExprTail(picolInterp *interp, picolExpr *e,
+                          picolExprDone done, void *data);
+picolResult picolExprRunStep(picolInterp *interp, picolExprRun *run);
+picolResult picolExprResume(picolInterp *interp, void *data, picolResult rc);
+void picolAddWord(picolArena *arena, picolArgv *args, char *t, int newword,
+                  int *expand);
+void picolAddWordObj(picolObjv *words, picolObj *obj, int newword,
+                     int *expand);
+picolObj* picolArgObj(picolInterp *interp, const char *arg);
+picolObj* picolFindArgObj(picolInterp *interp, const char *arg);
+void picolDecrRef(picolObj *obj);
+void picolFreeVar(picolPool *pool, picolVar *v);
+picolResult picolGetInt(picolInterp *interp, const char *str, int *n);
+picolResult picolGetIntFromObj(picolInterp *interp, picolObj *obj, int *n);
+picolResult picolGetListFromObj(picolInterp *interp, picolObj *obj,
+                                int *count, picolObj ***elems);
+void picolInvalidateObj(picolObj *obj);
+picolObj* picolNewIntObj(int n);
+picolObj* picolNewListObj(int count, picolObj **elems);
+picolObj* picolNewObj(const char *str);
+picolObj* picolWrapObj(char *str);
+picolResult picolSetResultObj(picolInterp *interp, picolObj *obj);
+picolResult picolSetResultBuf(picolInterp *interp, char *buf, size_t size);
+char* picolResultBuffer(picolInterp *interp, size_t size);
+picolResult picolSetVarObj(picolInterp *interp, const char *name,
+                           picolObj *obj, int global);
+void picolVarSetObj(picolVar *v, picolObj *obj);
 picolResult picolRenameCmd(picolInterp *interp, const char *from,
                            const char *to);
+void picolStrInit(picolStr *s);
+void picolStrReserve(picolStr *s, size_t extra);
+void picolStrAppend(picolStr *s, const char *src);
+void picolStrAppendN(picolStr *s, const char *src, size_t n);
+void picolStrAppendElement(picolStr *s, const char *src);
+void picolStrFree(picolStr *s);
+picolObj* picolStrObj(picolStr *s);
+picolResult picolStrResult(picolInterp *interp, picolStr *s);
+void picolArgvInit(picolArgv *args);
+void picolArgvReserve(picolArgv *args, int n);
+void picolArgvPush(picolArgv *args, const char *arg);
+void picolArgvFree(picolArgv *args);
+void picolObjAppend(picolObj *obj, const char *src, int element);
+picolObj* picolVarOwnObj(picolInterp *interp, picolVar *v);
+void picolObjvInit(picolObjv *words);
+void picolObjvReserve(picolObjv *words, int n);
+void picolObjvFree(picolObjv *words);
+void picolArenaInit(picolArena *arena);
+void* picolArenaAlloc(picolArena *arena, size_t size);
+char* picolArenaStrdup(picolArena *arena, const char *str);
+void picolArenaRelease(picolArena *arena, void *mark);
+void picolArenaReset(picolArena *arena);
+void picolArenaFree(picolArena *arena);
+void picolPoolInit(picolPool *pool);
+void* picolPoolAlloc(picolPool *pool, size_t size);
+void picolPoolFree(picolPool *pool, void *p, size_t size);
+char* picolPoolStrdup(picolPool *pool, const char *str);
+void picolPoolFreeStr(picolPool *pool, char *str);
+void picolPoolDestroy(picolPool *pool);
 
 #endif /* PICOL_H */
 
@@ -560,6 +1282,16 @@ picolResult picolRenameCmd(picolInterp *interp, const char *from,
 
 #ifdef PICOL_IMPLEMENTATION
 
+/* The source of interpreter ids.  Bytecode shared through [interp alias]
+   caches commands by interpreter id rather than by address, so a new
+   interpreter allocated where a freed one was never finds its commands.  Only
+   picolNewInterpId() touches it, atomically where the compiler allows, so
+   interpreters can be created on several threads. */
+unsigned long picolInterpIds = 0;
+#if PICOL_FEATURE_THREADS && !defined(__GNUC__)
+pthread_mutex_t picolInterpIdsLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 /* --------------------------------------------------------- parser functions */
 void picolInitParser(picolParser* p, const char* text) {
     p->text  = p->pos = text;
@@ -781,157 +1513,144 @@ picolBool picolLappend(char *dst, int dstSize, const char *src) {
     return PICOL_TRUE;
 }
 picolResult picolSetResult(picolInterp* interp, const char* s) {
-    PICOL_FREE(interp->result);
-    interp->result = strdup(s);
-    return PICOL_OK;
+    size_t len, size;
+    char* buf;
+    if (s[0] == '\0' && interp->result != NULL && interp->result[0] == '\0') {
+        return PICOL_OK; /* already empty, as at the start of every script */
+    }
+    len = strlen(s);
+    if (interp->resultobj != NULL && interp->resultobj->rc == 1 &&
+            len < interp->resultcap) {
+        /* Overwrite the old result, which s may point into. */
+        memmove(interp->result, s, len + 1);
+        picolInvalidateObj(interp->resultobj);
+        interp->resultobj->cap = 0;
+        return PICOL_OK;
+    }
+    size = len + 1 < PICOL_RESULT_MIN_SIZE ? PICOL_RESULT_MIN_SIZE : len + 1;
+    buf = PICOL_MALLOC(size);
+    memcpy(buf, s, len + 1);
+    return picolSetResultBuf(interp, buf, size);
 }
 picolResult picolSetFmtResult(
     picolInterp* interp,
     const char* fmt,
     int result
 ) {
-    char buf[32];
-    PICOL_SNPRINTF(buf, sizeof(buf), fmt, result);
-    return picolSetResult(interp, buf);
+    PICOL_SNPRINTF(
+        picolResultBuffer(interp, PICOL_RESULT_MIN_SIZE),
+        PICOL_RESULT_MIN_SIZE,
+        fmt,
+        result
+    );
+    return PICOL_OK;
 }
-#define PICOL_APPEND_BREAK_PICOLERR(src) \
-    { \
-        size_t src_len = strlen(src); \
-        if ((len + added_len + src_len) >= sizeof(buf)) { \
-            too_long = 1; break; \
-        } \
-        strcat(buf, src); \
-        added_len += src_len; \
+picolResult picolSetIntResult(picolInterp* interp, int n) {
+    picolSetFmtResult(interp, "%d", n);
+    interp->resultobj->type = PICOL_OBJ_INT;
+    interp->resultobj->rep.i = n;
+    return PICOL_OK;
+}
+const char* picolCurrentCommand(picolInterp* interp) {
+    /* Quote the command being executed only when an error or the debug output
+       needs it. */
+    if (interp->current == NULL && interp->curargv != NULL) {
+        interp->current = picolListNew(interp->curargc, interp->curargv);
     }
+    return interp->current;
+}
 picolResult picolErr(picolInterp* interp, const char* str) {
-    char buf[PICOL_MAX_STR] = "";
-    int too_long = 0;
-    size_t len = 0, added_len = 0;
-
-    do {
-        picolCallFrame* cf;
-        PICOL_APPEND_BREAK_PICOLERR(str);
-        len += added_len; added_len = 0;
-        if (interp->current != NULL) {
-            PICOL_APPEND_BREAK_PICOLERR("\n    while executing\n\"");
-            PICOL_APPEND_BREAK_PICOLERR(interp->current);
-            PICOL_APPEND_BREAK_PICOLERR("\"");
-        }
-        for (cf = interp->callframe;
-             cf->command != NULL && cf->parent != NULL;
-             cf = cf->parent) {
-            len += added_len; added_len = 0;
-            PICOL_APPEND_BREAK_PICOLERR("\n    invoked from within\n\"");
-            PICOL_APPEND_BREAK_PICOLERR(cf->command);
-            PICOL_APPEND_BREAK_PICOLERR("\"");
-        }
-    } while (0);
-    if (too_long) {
-        /* Truncate the error message at the last complete chunk. */
-        buf[len] = '\0';
-        do {
-            PICOL_APPEND_BREAK_PICOLERR(len > 0 ? "\n..." : "...");
-        } while (0);
+    picolStr info;
+    picolCallFrame* cf;
+
+    picolStrInit(&info);
+    picolStrAppend(&info, str);
+    if (picolCurrentCommand(interp) != NULL) {
+        picolStrAppend(&info, "\n    while executing\n\"");
+        picolStrAppend(&info, interp->current);
+        picolStrAppend(&info, "\"");
+    }
+    for (cf = interp->callframe;
+         cf->argv != NULL && cf->parent != NULL;
+         cf = cf->parent) {
+        picolStrAppend(&info, "\n    invoked from within\n\"");
+        picolStrAppend(&info, picolFrameCommand(cf));
+        picolStrAppend(&info, "\"");
     }
     /* Not exactly the same as in Tcl. */
-    picolSetVar2(interp, "::errorInfo", buf, 1);
+    picolSetVar2(interp, "::errorInfo", info.buf, 1);
+    picolStrFree(&info);
     picolSetResult(interp, str);
     return PICOL_ERR;
 }
-#undef PICOL_APPEND_BREAK_PICOLERR
 picolResult picolErrFmt(
     picolInterp* interp,
     const char* format,
     const char* arg
 ) {
     /* The format line must contain exactly one "%s" specifier. */
-    char buf[PICOL_MAX_STR], truncated[PICOL_MAX_STR];
-    size_t max_len;
-    strncpy(truncated, arg, PICOL_MAX_STR);
-
-    /* The two chars are for the "%s". */
-    max_len = PICOL_MAX_STR - 1 - strlen(format) + 2;
-    if (strlen(truncated) > max_len) {
-        truncated[max_len - 3] = '.';
-        truncated[max_len - 2] = '.';
-        truncated[max_len - 1] = '.';
-        truncated[max_len] = '\0';
-    }
+    size_t size = strlen(format) + strlen(arg) + 1;
+    char* buf = PICOL_MALLOC(size);
+    picolResult rc;
 
-    PICOL_SNPRINTF(buf, sizeof(buf), format, truncated);
-
-    return picolErr(interp, buf);
+    PICOL_SNPRINTF(buf, size, format, arg);
+    rc = picolErr(interp, buf);
+    PICOL_FREE(buf);
+    return rc;
 }
 picolVar* picolGetVar2(picolInterp* interp, const char* name, int global) {
-    picolVar* v = interp->callframe->vars;
+    picolCallFrame* c = interp->callframe;
     int coloned = PICOL_COLONED(name);
     if (coloned || global) {
-        picolCallFrame* c = interp->callframe;
         while (c->parent) {
             c = c->parent;
         }
-        v = c->vars;
         if (coloned) {
             name += 2; /* skip the "::" */
         }
     }
 #if PICOL_FEATURE_ARRAYS
     {
-        char buf[PICOL_MAX_STR], buf2[PICOL_MAX_STR], *cp, *cp2;
+        picolVar* v;
+        char *buf, *key, *cp, *cp2;
         /* Array element syntax? */
         if ((cp = strchr(name, '('))) {
             picolArray* ap;
-            int found = 0;
-            strncpy(buf, name, cp - name);
+            /* Split a scratch copy of the name into the array name and the
+               key that starts after the opening paren. */
+            buf = picolArenaStrdup(&interp->scratch, name);
             buf[cp - name] = '\0';
-            for (; v != NULL; v = v->next) {
-                if (PICOL_EQ(v->name, buf)) {
-                    found = 1;
-                    break;
-                }
-            }
-            if (!found) {
-                return NULL;
-            }
-            ap = picolScanPtr(v->val);
+            key = buf + (cp - name) + 1;
+            v = picolFrameGet(c, buf);
+            ap = v == NULL ? NULL : picolScanPtr(v->val);
+            cp = strchr(key, ')');
             if (ap == NULL ||
-                !picolValidPtr(interp, PICOL_PTR_ARRAY, (void*)ap)) {
-                return NULL;
-            }
-            /* Copy the key that starts after the opening paren. */
-            strncpy(buf2, cp + 1, sizeof(buf2));
-            cp = strchr(buf2, ')');
-            if (cp == NULL) {
+                !picolValidPtr(interp, PICOL_PTR_ARRAY, (void*)ap) ||
+                cp == NULL) {
+                picolArenaRelease(&interp->scratch, buf);
                 return NULL;
             }
             /* Overwrite the closing paren. */
             *cp = '\0';
-            v = picolArrGetKey(ap, buf2);
-            if (v == NULL) {
-                if ((coloned || interp->callframe->parent == NULL)
-                        && PICOL_EQ(buf, "env")) {
-                    cp2 = getenv(buf2);
-                    if (cp2 == NULL) {
-                        return NULL;
-                    }
-                    strcpy(buf, "::env(");
-                    strncat(buf, buf2, sizeof(buf) - strlen(buf2));
-                    strncat(buf, ")", sizeof(buf) - 1);
-                    return picolArrSetByName(interp, buf, cp2);
-                } else {
-                    return NULL;
-                }
+            v = picolArrGetKey(ap, key);
+            if (v == NULL &&
+                (coloned || interp->callframe->parent == NULL) &&
+                PICOL_EQ(buf, "env") &&
+                (cp2 = getenv(key)) != NULL) {
+                picolStr env;
+                picolStrInit(&env);
+                picolStrAppend(&env, "::env(");
+                picolStrAppend(&env, key);
+                picolStrAppend(&env, ")");
+                v = picolArrSetByName(interp, env.buf, cp2);
+                picolStrFree(&env);
             }
+            picolArenaRelease(&interp->scratch, buf);
             return v;
         }
     }
 #endif /* PICOL_FEATURE_ARRAYS */
-    for (; v != NULL; v = v->next) {
-        if (PICOL_EQ(v->name, name)) {
-            return v;
-        }
-    }
-    return NULL;
+    return picolFrameGet(c, name);
 }
 picolResult picolSetVar2(
     picolInterp* interp,
@@ -939,32 +1658,52 @@ picolResult picolSetVar2(
     const char* val,
     int global
 ) {
+    return picolSetVarObj(
+        interp,
+        name,
+        val == NULL ? NULL : picolNewObj(val),
+        global
+    );
+}
+picolResult picolSetVarObj(
+    picolInterp* interp,
+    const char* name,
+    picolObj* obj,
+    int global
+) {
+    /* Set the variable name to obj.  A NULL obj makes a link to the global
+       variable of the same name. */
     picolVar*       v = picolGetVar(interp, name);
     picolCallFrame* c = interp->callframe, *localc = c;
     int coloned = PICOL_COLONED(name);
+    picolResult rc = PICOL_OK;
     if (global || coloned) v = picolGetGlobalVar(interp, name);
 
+    if (obj != NULL) {
+        PICOL_INCR_REF(obj);
+    }
     if (v != NULL) {
         /* existing variable case */
-        if (v->val != NULL) {
-            /* local value */
-            PICOL_FREE(v->val);
-        } else {
-            return picolSetGlobalVar(interp, name, val);
+        if (v->val == NULL) {
+            rc = picolSetVarObj(interp, name, obj, 1);
+            goto done;
         }
     } else {
         /* nonexistent variable */
 #if PICOL_FEATURE_ARRAYS
         if (strchr(name, '(')) {
-            if (picolArrSetByName(interp, name, val) == NULL) {
-                return picolErrFmt(
+            if (picolArrSetByName(
+                interp,
+                name,
+                obj == NULL ? NULL : obj->str
+            ) == NULL) {
+                rc = picolErrFmt(
                     interp,
                     "can't set \"%s\": variable isn't array",
                     name
                 );
-            } else {
-                return PICOL_OK;
             }
+            goto done;
         }
 #endif
         if (global || coloned) {
@@ -973,19 +1712,22 @@ picolResult picolSetVar2(
                 c = c->parent;
             }
         }
-        v       = PICOL_MALLOC(sizeof(*v));
-        v->name = strdup(name);
-        v->next = c->vars;
-        c->vars = v;
+        v       = picolPoolAlloc(&interp->pool, sizeof(*v));
+        v->name = picolPoolStrdup(&interp->pool, name);
+        v->val  = NULL;
+        v->obj  = NULL;
+        picolFrameAdd(c, v);
         interp->callframe = localc;
     }
-    v->val = (val == NULL ? NULL : strdup(val));
-    return PICOL_OK;
+    picolVarSetObj(v, obj);
+done:
+    if (obj != NULL) {
+        picolDecrRef(obj);
+    }
+    return rc;
 }
 picolResult picolSetIntVar(picolInterp* interp, const char* name, int value) {
-    char buf[32];
-    PICOL_SNPRINTF(buf, sizeof(buf), "%d", value);
-    return picolSetVar(interp, name, buf);
+    return picolSetVarObj(interp, name, picolNewIntObj(value), 0);
 }
 picolResult picolGetToken(picolInterp* interp, picolParser* p) {
     int rc;
@@ -1016,7 +1758,8 @@ picolResult picolGetToken(picolInterp* interp, picolParser* p) {
             }
         case '[':
             rc = picolParseCmd(p);
-            if (rc == PICOL_ERR) {
+            /* Without an interpreter only report the failure. */
+            if (rc == PICOL_ERR && interp != NULL) {
                 return picolErr(interp, "missing close-bracket");
             }
             return rc;
@@ -1033,21 +1776,66 @@ picolResult picolGetToken(picolInterp* interp, picolParser* p) {
         }
     }
 }
+unsigned long picolNewInterpId(void) {
+#if defined(__GNUC__)
+    return __sync_add_and_fetch(&picolInterpIds, 1);
+#elif PICOL_FEATURE_THREADS
+    unsigned long id;
+    pthread_mutex_lock(&picolInterpIdsLock);
+    id = ++picolInterpIds;
+    pthread_mutex_unlock(&picolInterpIdsLock);
+    return id;
+#else
+    return ++picolInterpIds;
+#endif
+}
 void picolInitInterp(picolInterp* interp) {
     interp->level     = 0;
     interp->maxlevel  = PICOL_MAX_LEVEL;
-    interp->callframe = PICOL_MALLOC(sizeof(picolCallFrame));
+    picolPoolInit(&interp->pool);
+    interp->callframe = picolPoolAlloc(&interp->pool, sizeof(picolCallFrame));
     interp->commands  = NULL;
+    interp->cmdtable  = PICOL_CALLOC(PICOL_CMD_TABLE_SIZE, sizeof(picolCmd*));
+    interp->cmdcap    = PICOL_CMD_TABLE_SIZE;
+    interp->cmdcount  = 0;
+    interp->id        = picolNewInterpId();
+    interp->cmdepoch  = 1;
+    interp->curargc   = 0;
+    interp->curargv   = NULL;
+    interp->depth     = 0;
+    interp->tail      = NULL;
+    interp->tailframe = NULL;
+    interp->tailcont  = NULL;
+    interp->taildata  = NULL;
+    interp->exprrun   = NULL;
+    interp->tailcallc = 0;
+    interp->tailcallv = NULL;
+    interp->execfree  = NULL;
+#if PICOL_FEATURE_COROUTINES
+    interp->coroutine = NULL;
+#endif
+    interp->execfreecount = 0;
+    picolArenaInit(&interp->scratch);
     interp->current   = NULL;
-    interp->result    = strdup("");
+    interp->result    = NULL;
+    interp->resultobj = NULL;
+    interp->resultcap = 0;
+    interp->objc      = 0;
+    interp->objv      = NULL;
     interp->debug     = 0;
     interp->validptrs = NULL;
+    interp->scriptcount = 0;
+    memset(interp->scripts, 0, sizeof(interp->scripts));
+    memset(interp->scriptseen, 0, sizeof(interp->scriptseen));
+    interp->exprcount = 0;
+    memset(interp->exprs, 0, sizeof(interp->exprs));
+    memset(interp->exprseen, 0, sizeof(interp->exprseen));
+    picolSetResult(interp, "");
 
-    interp->callframe->vars = NULL;
-    interp->callframe->command = NULL;
-    interp->callframe->parent = NULL;
+    picolFrameInit(interp->callframe, NULL);
+    picolFrameRehash(interp->callframe, PICOL_VAR_TABLE_SIZE);
 }
-void picolFreeCmd(picolCmd* cmd) {
+void picolFreeCmd(picolPool* pool, picolCmd* cmd) {
     if (cmd == NULL) return;
 
     if (cmd->isproc) {
@@ -1055,21 +1843,69 @@ void picolFreeCmd(picolCmd* cmd) {
         procdata->rc--;
 
         if (procdata->rc == 0) {
-            PICOL_FREE(procdata->args);
-            PICOL_FREE(procdata->body);
-            PICOL_FREE(procdata);
+            picolFreeProc(procdata);
         }
     }
 
-    PICOL_FREE(cmd->name);
-    PICOL_FREE(cmd);
+    picolPoolFreeStr(pool, cmd->name);
+    picolPoolFree(pool, cmd, sizeof(picolCmd));
 }
-picolCmd* picolGetCmd(picolInterp* interp, const char* name) {
+picolCmd** picolCmdSlot(
+    picolInterp* interp,
+    const char* name,
+    unsigned int hash
+) {
+    /* Linear probing.  Return the slot that holds the command or the empty
+       slot where it would go. */
+    unsigned int mask = (unsigned int)interp->cmdcap - 1;
+    unsigned int i = hash & mask;
     picolCmd* c;
-    for (c = interp->commands; c; c = c->next) {
-        if (PICOL_EQ(c->name, name)) return c;
+    while ((c = interp->cmdtable[i]) != NULL) {
+        if (c->hash == hash && PICOL_EQ(c->name, name)) {
+            break;
+        }
+        i = (i + 1) & mask;
     }
-    return NULL;
+    return &interp->cmdtable[i];
+}
+void picolCmdTableGrow(picolInterp* interp) {
+    picolCmd** old = interp->cmdtable;
+    int i, oldcap = interp->cmdcap;
+    interp->cmdcap *= 2;
+    interp->cmdtable = PICOL_CALLOC(interp->cmdcap, sizeof(picolCmd*));
+    for (i = 0; i < oldcap; i++) {
+        if (old[i] != NULL) {
+            *picolCmdSlot(interp, old[i]->name, old[i]->hash) = old[i];
+        }
+    }
+    PICOL_FREE(old);
+}
+void picolCmdTableRemove(picolInterp* interp, picolCmd* cmd) {
+    /* Shift the entries that follow back so that no probe sequence is broken
+       and no tombstones are needed. */
+    unsigned int mask = (unsigned int)interp->cmdcap - 1;
+    unsigned int i, j, k;
+    picolCmd** slot = picolCmdSlot(interp, cmd->name, cmd->hash);
+    i = j = (unsigned int)(slot - interp->cmdtable);
+    interp->cmdtable[i] = NULL;
+    while (1) {
+        j = (j + 1) & mask;
+        if (interp->cmdtable[j] == NULL) {
+            break;
+        }
+        k = interp->cmdtable[j]->hash & mask;
+        /* Move the entry unless its home slot lies cyclically in (i, j]. */
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+        interp->cmdtable[i] = interp->cmdtable[j];
+        interp->cmdtable[j] = NULL;
+        i = j;
+    }
+    interp->cmdcount--;
+}
+picolCmd* picolGetCmd(picolInterp* interp, const char* name) {
+    return *picolCmdSlot(interp, name, picolHashString(name));
 }
 picolResult picolRegisterCmd(
     picolInterp* interp,
@@ -1077,17 +1913,29 @@ picolResult picolRegisterCmd(
     picolFunc f,
     void* pd
 ) {
-    picolCmd* c = picolGetCmd(interp, name);
+    unsigned int hash = picolHashString(name);
+    picolCmd* c = *picolCmdSlot(interp, name, hash);
     if (c != NULL) {
         return picolErrFmt(interp, "command \"%s\" already defined", name);
     }
-    c = PICOL_MALLOC(sizeof(picolCmd));
+    if (2 * (interp->cmdcount + 1) > interp->cmdcap) {
+        picolCmdTableGrow(interp);
+    }
+    c = picolPoolAlloc(&interp->pool, sizeof(picolCmd));
     c->next     = interp->commands;
-    c->name     = strdup(name);
+    c->prev     = NULL;
+    c->hash     = hash;
+    c->name     = picolPoolStrdup(&interp->pool, name);
     c->func     = f;
     c->isproc   = f == &picolCallProc;
     c->privdata = pd;
+    if (interp->commands != NULL) {
+        interp->commands->prev = c;
+    }
     interp->commands = c;
+    *picolCmdSlot(interp, name, hash) = c;
+    interp->cmdcount++;
+    interp->cmdepoch++;
     return PICOL_OK;
 }
 picolResult picolRenameCmd(
@@ -1095,52 +1943,80 @@ picolResult picolRenameCmd(
     const char* from,
     const char* to
 ) {
-    int found = 0, deleting = 0;
-    picolCmd* c, *last = NULL, *toFree = NULL;
-
-    deleting = PICOL_EQ(to, "");
-
-    for (c = interp->commands; c; last = c, c=c->next) {
-        if (PICOL_EQ(c->name, from)) {
-            if (last == NULL && deleting) {
-                /* Delete the first command. */
-                interp->commands = c->next;
-                toFree = c;
-            } else if (deleting) {
-                 /* Delete an nth command. */
-                last->next = c->next;
-                toFree = c;
-            } else {
-                /* Rename a command.  We only free() the name. */
-                PICOL_FREE(c->name);
-                c->name = strdup(to);
-            }
-            found = 1;
-            break;
+    picolCmd* c = picolGetCmd(interp, from), *old;
+
+    if (c == NULL) {
+        return PICOL_ERR;
+    }
+    picolCmdTableRemove(interp, c);
+    interp->cmdepoch++;
+
+    if (PICOL_EQ(to, "")) {
+        if (c->prev == NULL) {
+            interp->commands = c->next;
+        } else {
+            c->prev->next = c->next;
+        }
+        if (c->next != NULL) {
+            c->next->prev = c->prev;
+        }
+#if PICOL_FEATURE_COROUTINES
+        if (c->func == picol_Coroutine) {
+            picolCoroutineDelete(interp, c->privdata);
         }
+#endif
+        picolFreeCmd(&interp->pool, c);
+        return PICOL_OK;
     }
 
-    picolFreeCmd(toFree);
+    /* Rename a command.  We only free() the name.  A command that already
+       has the new name is replaced. */
+    old = picolGetCmd(interp, to);
+    if (old != NULL) {
+        picolRenameCmd(interp, to, "");
+    }
+    picolPoolFreeStr(&interp->pool, c->name);
+    c->name = picolPoolStrdup(&interp->pool, to);
+    c->hash = picolHashString(to);
+    *picolCmdSlot(interp, c->name, c->hash) = c;
+    interp->cmdcount++;
 
-    return found ? PICOL_OK : PICOL_ERR;
+    return PICOL_OK;
+}
+picolResult picolCopyNew(char* buf, size_t buf_size, char* str) {
+    /* Copy str, which picolListNew() or picolConcatNew() returned, to buf and
+       free it.  Fail if it doesn't fit. */
+    size_t len = strlen(str);
+    picolResult rc = PICOL_ERR;
+    if (len < buf_size) {
+        memcpy(buf, str, len + 1);
+        rc = PICOL_OK;
+    } else if (buf_size > 0) {
+        buf[0] = '\0';
+    }
+    PICOL_FREE(str);
+    return rc;
 }
 picolResult picolList(char* buf, size_t buf_size, int argc, const char** argv) {
-    int a; size_t len = 0;
-    buf[0] = '\0';
+    return picolCopyNew(buf, buf_size, picolListNew(argc, argv));
+}
+char* picolListNew(int argc, const char** argv) {
+    /* Return argv as a list in a new string allocated with PICOL_MALLOC(). */
+    picolStr s;
+    int a;
+    picolStrInit(&s);
     for (a = 0; a < argc; a++) {
-        size_t part_len = strlen(argv[a]);
-        if (part_len + len > buf_size) { return PICOL_ERR; }
-        PICOL_LAPPEND_X(buf, argv[a]);
-        len += part_len;
+        picolStrAppendElement(&s, argv[a]);
     }
-    return PICOL_OK;
+    return s.buf;
 }
 /* Returns the next character after the end of the first element in the
    list. */
-#define PICOL_LIST_NESTING 32
 const char* picolListHead(const char* start, char* target, size_t target_size) {
+    /* q is how the element is quoted, '{' or '"', and qi how many braces and
+       quotes are open.  Only the outermost can be a quote. */
     const char* cp = start;
-    char q[PICOL_LIST_NESTING];
+    char q = ' ';
     size_t qi = 0, ti = 0;
     int esc = 0;
 
@@ -1157,7 +2033,7 @@ const char* picolListHead(const char* start, char* target, size_t target_size) {
     }
     start = cp;
 
-    for (q[0] = ' '; *cp && ti < target_size; cp++) {
+    for (; *cp && ti < target_size; cp++) {
         if (esc) {
             target[ti] = *cp;
             ti++;
@@ -1167,7 +2043,7 @@ const char* picolListHead(const char* start, char* target, size_t target_size) {
             continue;
         }
 
-        if (q[0] != '{' && *cp == '\\') {
+        if (q != '{' && *cp == '\\') {
             esc = 1;
 
             continue;
@@ -1183,27 +2059,23 @@ const char* picolListHead(const char* start, char* target, size_t target_size) {
                 ti++;
                 if (ti == target_size - 1) break;
             }
-            q[qi] = '{';
+            if (qi == 0) {
+                q = '{';
+            }
             qi++;
-            if (qi == PICOL_LIST_NESTING) break;
 
             continue;
         }
 
-        if (*cp == '}') {
-            if (qi > 0 && q[qi - 1] == '{') {
-                qi--;
-                if (qi > 0) {;
-                    target[ti] = *cp;
-                    ti++;
-                    if (ti == target_size - 1) break;
-                } else { /* qi == 0 */
-                    cp++;
-                    break;
-                }
+        /* A brace that closes none is an ordinary character like in Tcl. */
+        if (*cp == '}' && (qi > 1 || (qi == 1 && q == '{'))) {
+            qi--;
+            if (qi > 0) {
+                target[ti] = *cp;
+                ti++;
+                if (ti == target_size - 1) break;
             } else {
-                /* We break rather than return an error when a list is
-                   invalid. */
+                cp++;
                 break;
             }
 
@@ -1211,13 +2083,12 @@ const char* picolListHead(const char* start, char* target, size_t target_size) {
         }
 
         if (*cp == '"') {
-            if (qi == 1 && q[0] == '"') {
+            if (qi == 1 && q == '"') {
                 qi--;
                 if (qi == 0) { cp++; break; }
             } else if (qi == 0 && (cp == start || isspace(*(cp - 1)))) {
-                q[0] = '"';
+                q = '"';
                 qi++;
-                if (qi == PICOL_LIST_NESTING) break;
             } else {
                 target[ti] = '"';
                 ti++;
@@ -1237,11 +2108,13 @@ const char* picolListHead(const char* start, char* target, size_t target_size) {
 
     return cp;
 }
-#undef PICOL_LIST_NESTING
 void picolEscape(char* str, size_t str_size) {
-    char buf[PICOL_MAX_STR], *cp, *cp2;
+    /* Unescape str in place.  The result is never longer than str, so
+       str_size is only kept for compatibility. */
+    char *cp, *cp2;
     int ichar;
-    for (cp = str, cp2 = buf; *cp; cp++) {
+    PICOL_UNUSED(str_size);
+    for (cp = cp2 = str; *cp; cp++) {
         if (*cp == '\\') {
             switch(*(cp+1)) {
             case 'n':
@@ -1278,7 +2151,6 @@ void picolEscape(char* str, size_t str_size) {
         } else *cp2++ = *cp;
     }
     *cp2 = '\0';
-    strncpy(str, buf, str_size);
 }
 size_t picolExpandLC(char* dest, size_t num, const char* source) {
     /* Copy the string source to destination while substituting a single space
@@ -1308,17 +2180,251 @@ size_t picolExpandLC(char* dest, size_t num, const char* source) {
     }
     return cp - dest;
 }
+void picolAddWord(
+    picolArena* arena,
+    picolArgv* args,
+    char* t,
+    int newword,
+    int* expand
+) {
+    /* Append the token t to the previous word or use it as a new word.  t and
+       the words must be allocated from arena. */
+    if (newword && !*expand) {
+        picolArgvPush(args, t);
+    } else if (*expand && (!newword || strlen(t))) {
+        /* Slice in the words separately. */
+        size_t size = PICOL_ELEMENT_SIZE(t);
+        char* buf2 = picolArenaAlloc(arena, size);
+        const char* cp;
+        PICOL_FOREACH(buf2, size, cp, t) {
+            picolArgvPush(args, picolArenaStrdup(arena, buf2));
+        }
+        *expand = 0;
+    } else if (!newword) {
+        /* Interpolation. */
+        const char* prev = args->argv[args->argc-1];
+        size_t oldlen = strlen(prev), tlen2 = strlen(t);
+        char* word = picolArenaAlloc(arena, oldlen + tlen2 + 1);
+        memcpy(word, prev, oldlen);
+        memcpy(word + oldlen, t, tlen2 + 1);
+        args->argv[args->argc-1] = word;
+    }
+}
+picolResult picolCallBegin(
+    picolInterp* interp,
+    picolCall* call,
+    picolCmd** cp,
+    int argc,
+    const char** argv,
+    picolObj** objv,
+    int* halt
+) {
+    /* Start the command argv[0], which is *cp if the caller has already looked
+       it up, by making it the current command.  Unless *halt is set, the
+       caller must run call->cmd with call->argc and call->argv if this
+       returns PICOL_OK and then pass the result to picolCallEnd().  objv holds
+       the values of argv or is NULL. */
+    picolCmd* c = *cp;
+
+    *halt = 0;
+    call->uargv = NULL;
+    call->tailcallv = NULL;
+    if (c == NULL && (c = picolGetCmd(interp, argv[0])) == NULL) {
+        if (PICOL_EQ(argv[0], "") || *argv[0]=='#') {
+            *halt = 1;
+            return PICOL_OK;
+        }
+        if ((c = picolGetCmd(interp, "unknown"))) {
+            call->uargv = PICOL_MALLOC(sizeof(char*)*(argc+1));
+            call->uargv[0] = "unknown";
+            memcpy(call->uargv + 1, argv, sizeof(char*)*argc);
+            argv = call->uargv;
+            argc++;
+            objv = NULL;
+        }
+    }
+    *cp = c;
+    call->cmd     = c;
+    call->argc    = argc;
+    call->argv    = argv;
+    call->objc    = interp->objc;
+    call->objv    = interp->objv;
+    call->curargc = interp->curargc;
+    call->curargv = interp->curargv;
+    call->current = interp->current;
+    /* Remember the words of the command rather than its string form.
+       picolCurrentCommand quotes them if an error traceback needs them. */
+    interp->curargc = argc;
+    interp->curargv = argv;
+    interp->current = NULL;
+    if (c == NULL) {
+        return picolErrFmt(interp, "invalid command name \"%s\"", argv[0]);
+    }
+
+#if PICOL_FEATURE_PUTS
+    if (interp->debug) {
+        fprintf(stderr, "< %d: %s\n", interp->level,
+                picolCurrentCommand(interp));
+        fflush(stderr);
+    }
+#endif
+    interp->objc = objv != NULL ? argc : 0;
+    interp->objv = objv;
+    return PICOL_OK;
+}
+picolResult picolCallEnd(
+    picolInterp* interp,
+    picolCall* call,
+    picolResult rc
+) {
+    interp->objc = call->objc;
+    interp->objv = call->objv;
+#if PICOL_FEATURE_PUTS
+    if (interp->debug && call->cmd != NULL) {
+        fprintf(
+            stderr, "> %d: {%s} -> {%s}\n",
+            interp->level,
+            picolCurrentCommand(interp),
+            interp->result
+        );
+        fflush(stderr);
+    }
+#endif
+    PICOL_FREE(interp->current);
+    interp->curargc = call->curargc;
+    interp->curargv = call->curargv;
+    interp->current = call->current;
+    PICOL_FREE(call->uargv);
+    picolWordsFree(interp, call->tailcallc, call->tailcallv);
+    return rc;
+}
+picolResult picolEvalCommand(
+    picolInterp* interp,
+    picolCmd* c,
+    int argc,
+    const char** argv,
+    picolObj** objv,
+    int* halt
+) {
+    /* Call the command argv[0], which is c if the caller has already looked it
+       up.  objv holds the values of argv or is NULL.  *halt is set when the
+       rest of the script should be skipped. */
+    picolCall call;
+    picolResult rc = picolCallBegin(interp, &call, &c, argc, argv, objv, halt);
+
+    if (*halt) {
+        return PICOL_OK;
+    }
+    if (rc == PICOL_OK) {
+        rc = c->func(interp, call.argc, call.argv, c->privdata);
+        if (rc == PICOL_EVAL_TAIL) {
+            rc = picolRunTail(interp);
+        }
+    }
+    return picolCallEnd(interp, &call, rc);
+}
+picolResult picolTailEval(picolInterp* interp, picolObj* obj) {
+    /* Have the caller of the current command evaluate obj as a script once
+       the command returns, with the result of the script as the result of the
+       command.  The command must return what this function does.  The
+       bytecode interpreter does this without nesting on the C stack. */
+    return picolTailEvalCont(interp, obj, NULL, NULL);
+}
+picolResult picolTailEvalCont(
+    picolInterp* interp,
+    picolObj* obj,
+    picolCont cont,
+    void* data
+) {
+    /* Like picolTailEval(), but call cont with data and the result code of
+       the script when it is done; what cont returns is what the command
+       returns.  This is how a loop runs its body without nesting.  cont is
+       called whatever happens to the script, so it can free data. */
+    PICOL_INCR_REF(obj);
+    if (interp->tail != NULL) {
+        picolDecrRef(interp->tail);
+    }
+    interp->tail = obj;
+    interp->tailcont = cont;
+    interp->taildata = data;
+    return PICOL_EVAL_TAIL;
+}
+picolResult picolRunTail(picolInterp* interp) {
+    /* Evaluate the script a command left with picolTailEval() and whatever
+       its continuations leave after it, nesting on the C stack.  Return what
+       the command finally returns. */
+    picolResult rc = PICOL_EVAL_TAIL;
+    while (rc == PICOL_EVAL_TAIL) {
+        picolObj* tail = interp->tail;
+        picolCallFrame* frame = interp->tailframe;
+        picolCont cont = interp->tailcont;
+        void* data = interp->taildata;
+        picolScript* script = picolTailScript(interp, tail);
+        interp->tail = NULL;
+        interp->tailframe = NULL;
+        interp->tailcont = NULL;
+        if (script != NULL) {
+            script->rc++;
+            rc = picolEvalScript(interp, script);
+            picolReleaseScript(script);
+        } else {
+            rc = picolEvalText(interp, tail->str, 1);
+        }
+        if (frame != NULL) {
+            interp->callframe = frame;
+        }
+        picolDecrRef(tail);
+        if (cont != NULL) {
+            rc = cont(interp, data, rc);
+        }
+    }
+    return rc;
+}
+picolScript* picolTailScript(picolInterp* interp, picolObj* obj) {
+    /* Return the compiled form of obj or NULL if it doesn't compile.  A value
+       nobody else holds goes through the script cache instead of keeping its
+       compiled form. */
+    if (obj->rc > 1 || obj->type == PICOL_OBJ_SCRIPT) {
+        return picolGetScriptFromObj(obj);
+    }
+    return picolScriptCacheGet(interp, obj->str);
+}
 picolResult picolEval2(
     picolInterp* interp,
     const char* script,
     int mode /* mode==0: subst only, mode==1: full eval */
 ) { /* EVAL! */
+    if (mode == 1) {
+        picolScript* s = picolScriptCacheGet(interp, script);
+        if (s != NULL) {
+            picolResult rc;
+            s->rc++;
+            rc = picolEvalScript(interp, s);
+            picolReleaseScript(s);
+            return rc;
+        }
+    }
+    return picolEvalText(interp, script, mode);
+}
+picolResult picolEvalText(
+    picolInterp* interp,
+    const char* script,
+    int mode
+) {
+    /* Evaluate or substitute script straight from the text.  This is how
+       [subst] works and how scripts that don't compile fail. */
     picolParser p;
-    int argc = 0, j;
-    char** argv = NULL;
-    PICOL_BUFFER_CREATE(buf, PICOL_EVAL_BUF_SIZE);
+    picolArgv args;
+    picolArena tokens; /* the words of the current command */
+    int halt;
     int rc = PICOL_OK;
+    if (PICOL_TOO_DEEP(interp)) {
+        return picolErr(interp, "too many nested evaluations (infinite loop?)");
+    }
+    interp->depth++;
     picolSetResult(interp, "");
+    picolArgvInit(&args);
+    picolArenaInit(&tokens);
     picolInitParser(&p, script);
     while (1) {
         char* t;
@@ -1326,8 +2432,40 @@ picolResult picolEval2(
         int prevtype = p.type;
         if (picolGetToken(interp, &p) != PICOL_OK) break;
         if (p.type == PICOL_PT_EOF) { break; }
+        if (p.type == PICOL_PT_SEP) {
+            continue;
+        }
+        /* We have a complete command + args.  Call it! */
+        if (p.type == PICOL_PT_EOL) {
+            if (mode == 0) {
+                /* Do a quasi-subst only. */
+                picolSetResultObj(
+                    interp,
+                    picolWrapObj(picolListNew(args.argc, args.argv))
+                );
+                /* Not an error if rc == PICOL_OK. */
+                goto err;
+            }
+            if (args.argc) {
+                rc = picolEvalCommand(
+                    interp,
+                    NULL,
+                    args.argc,
+                    args.argv,
+                    NULL,
+                    &halt
+                );
+                if (rc != PICOL_OK || halt) {
+                    goto err;
+                }
+            }
+            /* Prepare for the next command. */
+            args.argc = 0;
+            picolArenaReset(&tokens);
+            continue;
+        }
         tlen = p.end < p.start ? 0 : p.end - p.start + 1;
-        t = PICOL_MALLOC(tlen + 1);
+        t = picolArenaAlloc(&tokens, tlen + 1);
         if (p.type == PICOL_PT_STR || p.type == PICOL_PT_VAR) {
             tlen = picolExpandLC(t, tlen, p.start);
         } else {
@@ -1345,860 +2483,3091 @@ picolResult picolEval2(
                     "can't read \"%s\": no such variable",
                     t
                 );
-            }
-            PICOL_FREE(t);
-            t = NULL;
-            if (v == NULL) {
                 goto err;
             }
-            t = strdup(v->val);
+            t = picolArenaStrdup(&tokens, v->val);
         } else if (p.type == PICOL_PT_CMD) {
             rc = picolEval(interp, t);
-            PICOL_FREE(t);
-            t = NULL;
             if (rc != PICOL_OK) {
                 goto err;
             }
-            t = strdup(interp->result);
+            t = picolArenaStrdup(&tokens, interp->result);
         } else if (p.type == PICOL_PT_ESC) {
             if (strchr(t, '\\')) {
                 picolEscape(t, tlen);
             }
-        } else if (p.type == PICOL_PT_SEP) {
-            prevtype = p.type;
-            PICOL_FREE(t);
-            t = NULL;
-            continue;
         }
 
-        /* We have a complete command + args.  Call it! */
-        if (p.type == PICOL_PT_EOL) {
-            picolCmd* c;
-            PICOL_FREE(t);
-            t = NULL;
-            if (mode == 0) {
-                /* Do a quasi-subst only. */
-                rc = picolList(
-                    buf,
-                    PICOL_BUFFER_SIZE(buf),
-                    argc,
-                    (const char**)argv
-                );
-                if (rc == PICOL_OK) {
-                    rc = picolSetResult(interp, buf);
-                }
-                /* Not an error if rc == PICOL_OK. */
-                goto err;
-            }
-            prevtype = p.type;
-            if (argc) {
-                int i;
-                size_t total_len;
-
-                if ((c = picolGetCmd(interp, argv[0])) == NULL) {
-                    if (PICOL_EQ(argv[0], "") || *argv[0]=='#') {
-                        goto err;
-                    }
-                    if ((c = picolGetCmd(interp, "unknown"))) {
-                        /* TODO: Use realloc() safely in this function.
-                           Check for failure. */
-                        argv = PICOL_REALLOC(argv, sizeof(char*)*(argc+1));
-                        for (j = argc; j > 0; j--) {
-                            /* copy up */
-                            argv[j] = argv[j - 1];
-                        }
-                        argv[0] = strdup("unknown");
-                        argc++;
-                    } else {
-                        rc = picolErrFmt(
-                            interp,
-                            "invalid command name \"%s\"",
-                            argv[0]
-                        );
-                        goto err;
-                    }
-                }
-                if (interp->current != NULL) {
-                    PICOL_FREE(interp->current);
-                    interp->current = NULL;
-                }
-
-                total_len = 0;
-                for (i = 0; i < argc; i++) {
-                    int arg_len = strlen(argv[i]);
-                    if (c->isproc && arg_len >= PICOL_MAX_STR - 1) {
-                        rc = picolErrFmt(
-                            interp,
-                            "proc argument too long: \"%s\"",
-                            argv[i]
-                        );
-                        goto err;
-                    }
-                    total_len += arg_len;
+        /* We have a new token.  Append it to the previous or use it as a
+           new arg. */
+        picolAddWord(
+            &tokens,
+            &args,
+            t,
+            prevtype == PICOL_PT_SEP || prevtype == PICOL_PT_EOL,
+            &p.expand
+        );
+    }
+err:
+    picolArgvFree(&args);
+    picolArenaFree(&tokens);
+    interp->depth--;
+    return rc;
+}
+/* ------------------------------------------------------------------ Strings */
+void picolStrInit(picolStr* s) {
+    s->buf = PICOL_MALLOC(PICOL_STR_INIT_SIZE);
+    s->buf[0] = '\0';
+    s->len = 0;
+    s->cap = PICOL_STR_INIT_SIZE;
+}
+void picolStrReserve(picolStr* s, size_t extra) {
+    /* Make room for extra more characters and the terminating NUL. */
+    size_t need = s->len + extra + 1;
+    if (need > s->cap) {
+        while (s->cap < need) {
+            s->cap *= 2;
+        }
+        s->buf = PICOL_REALLOC(s->buf, s->cap);
+    }
+}
+void picolStrAppendN(picolStr* s, const char* src, size_t n) {
+    picolStrReserve(s, n);
+    memcpy(s->buf + s->len, src, n);
+    s->len += n;
+    s->buf[s->len] = '\0';
+}
+void picolStrAppend(picolStr* s, const char* src) {
+    picolStrAppendN(s, src, strlen(src));
+}
+void picolStrAppendElement(picolStr* s, const char* src) {
+    /* Append src as a list element, like PICOL_LAPPEND(). */
+    int needbraces = picolNeedsBraces(src);
+    size_t len = strlen(src);
+    picolStrReserve(s, len + 3);
+    if (s->len > 0) {
+        s->buf[s->len++] = ' ';
+    }
+    if (needbraces) {
+        s->buf[s->len++] = '{';
+    }
+    memcpy(s->buf + s->len, src, len);
+    s->len += len;
+    if (needbraces) {
+        s->buf[s->len++] = '}';
+    }
+    s->buf[s->len] = '\0';
+}
+void picolStrFree(picolStr* s) {
+    PICOL_FREE(s->buf);
+    s->buf = NULL;
+    s->len = s->cap = 0;
+}
+picolObj* picolStrObj(picolStr* s) {
+    /* Turn the string into a value without copying it.  s is left empty and
+       needs no picolStrFree(). */
+    picolObj* obj = picolWrapObj(s->buf);
+    obj->len = s->len;
+    obj->cap = s->cap;
+    s->buf = NULL;
+    s->len = s->cap = 0;
+    return obj;
+}
+picolResult picolStrResult(picolInterp* interp, picolStr* s) {
+    size_t cap = s->cap;
+    char* buf = s->buf;
+    s->buf = NULL;
+    s->len = s->cap = 0;
+    return picolSetResultBuf(interp, buf, cap);
+}
+void picolObjAppend(picolObj* obj, const char* src, int element) {
+    /* Append src to the string of obj in place, as a list element if element
+       is set.  obj must have no other holder.  The string keeps its capacity
+       between calls and grows like a picolStr, so appending to a value over
+       and over takes amortized O(1) time per character. */
+    picolStr s;
+    if (obj->cap == 0) {
+        obj->len = strlen(obj->str);
+        obj->cap = obj->len + 1;
+    }
+    s.buf = obj->str;
+    s.len = obj->len;
+    s.cap = obj->cap;
+    if (element) {
+        picolStrAppendElement(&s, src);
+    } else {
+        picolStrAppend(&s, src);
+    }
+    picolInvalidateObj(obj);
+    obj->str = s.buf;
+    obj->len = s.len;
+    obj->cap = s.cap;
+}
+picolObj* picolVarOwnObj(picolInterp* interp, picolVar* v) {
+    /* Return the value of v if v is its only holder and it can be changed in
+       place, or NULL.  The result is let go of the value first, since the
+       caller is about to set a new result anyway. */
+    if (v == NULL || v->val == NULL) {
+        return NULL;
+    }
+    if (interp->resultobj == v->obj) {
+        picolSetResult(interp, "");
+    }
+    return v->obj->rc == 1 ? v->obj : NULL;
+}
+/* --------------------------------------------------------- Argument vectors */
+void picolArgvInit(picolArgv* args) {
+    args->argc = 0;
+    args->cap  = PICOL_INLINE_ARGS;
+    args->argv = args->space;
+}
+void picolArgvReserve(picolArgv* args, int n) {
+    /* Make room for n words. */
+    int cap = args->cap;
+    if (n <= cap) {
+        return;
+    }
+    while (cap < n) {
+        cap *= 2;
+    }
+    if (args->argv == args->space) {
+        args->argv = PICOL_MALLOC(sizeof(char*) * cap);
+        memcpy(args->argv, args->space, sizeof(args->space));
+    } else {
+        args->argv = PICOL_REALLOC(args->argv, sizeof(char*) * cap);
+    }
+    args->cap = cap;
+}
+void picolArgvPush(picolArgv* args, const char* arg) {
+    picolArgvReserve(args, args->argc + 1);
+    args->argv[args->argc++] = arg;
+}
+void picolArgvFree(picolArgv* args) {
+    if (args->argv != args->space) {
+        PICOL_FREE(args->argv);
+    }
+    picolArgvInit(args);
+}
+void picolObjvInit(picolObjv* words) {
+    words->objc = 0;
+    words->cap  = PICOL_INLINE_ARGS;
+    words->objv = words->space;
+}
+void picolObjvReserve(picolObjv* words, int n) {
+    int cap = words->cap;
+    if (n <= cap) {
+        return;
+    }
+    while (cap < n) {
+        cap *= 2;
+    }
+    if (words->objv == words->space) {
+        words->objv = PICOL_MALLOC(sizeof(picolObj*) * cap);
+        memcpy(words->objv, words->space, sizeof(words->space));
+    } else {
+        words->objv = PICOL_REALLOC(words->objv, sizeof(picolObj*) * cap);
+    }
+    words->cap = cap;
+}
+void picolObjvFree(picolObjv* words) {
+    /* Only frees the vector.  The caller releases the values. */
+    if (words->objv != words->space) {
+        PICOL_FREE(words->objv);
+    }
+    picolObjvInit(words);
+}
+/* ------------------------------------------------------------------- Arenas */
+void picolArenaInit(picolArena* arena) {
+    arena->top   = NULL;
+    arena->spare = NULL;
+}
+void* picolArenaAlloc(picolArena* arena, size_t size) {
+    /* Return size bytes of unaligned memory.  A new block is added when the
+       current one is full; blocks double in size. */
+    picolArenaBlock* b = arena->top;
+    void* p;
+    if (b == NULL || b->size - b->used < size) {
+        if (arena->spare != NULL && arena->spare->size >= size) {
+            b = arena->spare;
+            arena->spare = NULL;
+        } else {
+            size_t bsize = b == NULL ? PICOL_ARENA_BLOCK_SIZE : b->size * 2;
+            while (bsize < size) {
+                bsize *= 2;
+            }
+            b = PICOL_MALLOC(sizeof(picolArenaBlock) + bsize);
+            b->size = bsize;
+        }
+        b->prev = arena->top;
+        b->used = 0;
+        arena->top = b;
+    }
+    p = (char*)(b + 1) + b->used;
+    b->used += size;
+    return p;
+}
+char* picolArenaStrdup(picolArena* arena, const char* str) {
+    size_t size = strlen(str) + 1;
+    char* copy = picolArenaAlloc(arena, size);
+    memcpy(copy, str, size);
+    return copy;
+}
+void picolArenaRelease(picolArena* arena, void* mark) {
+    /* Release mark, which picolArenaAlloc() returned, and everything
+       allocated after it.  Does nothing if mark has already been released
+       that way. */
+    char* p = mark;
+    picolArenaBlock* b;
+    for (b = arena->top; b != NULL; b = b->prev) {
+        char* data = (char*)(b + 1);
+        if (p >= data && p < data + b->used) {
+            break;
+        }
+    }
+    if (b == NULL) {
+        return;
+    }
+    while (arena->top != b) {
+        picolArenaBlock* top = arena->top;
+        arena->top = top->prev;
+        if (arena->spare == NULL || arena->spare->size < top->size) {
+            PICOL_FREE(arena->spare);
+            arena->spare = top;
+        } else {
+            PICOL_FREE(top);
+        }
+    }
+    b->used = p - (char*)(b + 1);
+}
+void picolArenaReset(picolArena* arena) {
+    /* Release everything but keep the newest, largest block for reuse. */
+    picolArenaBlock* b = arena->top, *prev;
+    if (b == NULL) {
+        return;
+    }
+    for (prev = b->prev; prev != NULL; prev = b->prev) {
+        b->prev = prev->prev;
+        PICOL_FREE(prev);
+    }
+    b->used = 0;
+}
+void picolArenaFree(picolArena* arena) {
+    picolArenaBlock* b, *prev;
+    for (b = arena->top; b != NULL; b = prev) {
+        prev = b->prev;
+        PICOL_FREE(b);
+    }
+    PICOL_FREE(arena->spare);
+    picolArenaInit(arena);
+}
+/* -------------------------------------------------------------------- Pools */
+void picolPoolInit(picolPool* pool) {
+    int i;
+    for (i = 0; i < PICOL_POOL_CLASSES; i++) {
+        pool->free[i] = NULL;
+    }
+    pool->chunks = NULL;
+    pool->next      = NULL;
+    pool->left      = 0;
+    pool->chunksize = PICOL_POOL_CHUNK_SIZE;
+}
+void* picolPoolAlloc(picolPool* pool, size_t size) {
+    /* A NULL pool, a large size or PICOL_POOLS == 0 mean PICOL_MALLOC(). */
+#if PICOL_POOLS
+    if (pool != NULL && size > 0 && size <= PICOL_POOL_MAX) {
+        size_t cls = (size - 1) / PICOL_POOL_GRAIN;
+        void* p = pool->free[cls];
+        if (p != NULL) {
+            pool->free[cls] = *(void**)p;
+            return p;
+        }
+        size = (cls + 1) * PICOL_POOL_GRAIN;
+        if (pool->left < size) {
+            char* chunk = PICOL_MALLOC(pool->chunksize);
+            *(char**)chunk = pool->chunks;
+            pool->chunks = chunk;
+            pool->next = chunk + PICOL_POOL_GRAIN;
+            pool->left = pool->chunksize - PICOL_POOL_GRAIN;
+            if (pool->chunksize < PICOL_POOL_MAX_CHUNK_SIZE) {
+                pool->chunksize *= 2;
+            }
+        }
+        p = pool->next;
+        pool->next += size;
+        pool->left -= size;
+        return p;
+    }
+#else
+    PICOL_UNUSED(pool);
+#endif
+    return PICOL_MALLOC(size);
+}
+void picolPoolFree(picolPool* pool, void* p, size_t size) {
+    /* size must be what p was allocated with. */
+#if PICOL_POOLS
+    if (pool != NULL && size > 0 && size <= PICOL_POOL_MAX) {
+        size_t cls = (size - 1) / PICOL_POOL_GRAIN;
+        if (p != NULL) {
+            *(void**)p = pool->free[cls];
+            pool->free[cls] = p;
+        }
+        return;
+    }
+#else
+    PICOL_UNUSED(pool);
+    PICOL_UNUSED(size);
+#endif
+    PICOL_FREE(p);
+}
+char* picolPoolStrdup(picolPool* pool, const char* str) {
+    size_t size = strlen(str) + 1;
+    char* copy = picolPoolAlloc(pool, size);
+    memcpy(copy, str, size);
+    return copy;
+}
+void picolPoolFreeStr(picolPool* pool, char* str) {
+    if (str != NULL) {
+        picolPoolFree(pool, str, strlen(str) + 1);
+    }
+}
+void picolPoolDestroy(picolPool* pool) {
+    /* Release every block at once, whether it was freed or not. */
+    char* chunk, *next;
+    for (chunk = pool->chunks; chunk != NULL; chunk = next) {
+        next = *(char**)chunk;
+        PICOL_FREE(chunk);
+    }
+    picolPoolInit(pool);
+}
+/* ------------------------------------------------------------------- Values */
+picolObj* picolWrapObj(char* str) {
+    /* Make a value that owns str, which must come from PICOL_MALLOC().  Like
+       every new value, it has no references yet. */
+    picolObj* obj = PICOL_MALLOC(sizeof(picolObj));
+    obj->rc   = 0;
+    obj->type = PICOL_OBJ_STRING;
+    obj->str  = str;
+    obj->len  = 0;
+    obj->cap  = 0;
+    return obj;
+}
+picolObj* picolNewObj(const char* str) {
+    return picolWrapObj(strdup(str));
+}
+picolObj* picolNewIntObj(int n) {
+    char buf[32];
+    picolObj* obj;
+    PICOL_SNPRINTF(buf, sizeof(buf), "%d", n);
+    obj = picolNewObj(buf);
+    obj->type = PICOL_OBJ_INT;
+    obj->rep.i = n;
+    return obj;
+}
+void picolInvalidateObj(picolObj* obj) {
+    /* Drop the internal form, e.g., before the string changes. */
+    int i;
+    if (obj->type == PICOL_OBJ_LIST) {
+        for (i = 0; i < obj->rep.list.count; i++) {
+            picolDecrRef(obj->rep.list.elems[i]);
+        }
+        PICOL_FREE(obj->rep.list.elems);
+    } else if (obj->type == PICOL_OBJ_SCRIPT) {
+        picolReleaseScript(obj->rep.script);
+    } else if (obj->type == PICOL_OBJ_EXPR) {
+        picolReleaseExpr(obj->rep.expr);
+    }
+    obj->type = PICOL_OBJ_STRING;
+}
+void picolDecrRef(picolObj* obj) {
+    /* Free obj when the last reference goes.  A value nobody has taken a
+       reference to is freed right away. */
+    obj->rc--;
+    if (obj->rc <= 0) {
+        picolInvalidateObj(obj);
+        PICOL_FREE(obj->str);
+        PICOL_FREE(obj);
+    }
+}
+picolResult picolGetIntFromObj(picolInterp* interp, picolObj* obj, int* n) {
+    int base;
+    if (obj->type == PICOL_OBJ_INT) {
+        *n = obj->rep.i;
+        return PICOL_OK;
+    }
+    base = picolIsInt(obj->str);
+    if (base <= 0) {
+        return picolErrFmt(
+            interp,
+            "expected integer but got \"%s\"",
+            obj->str
+        );
+    }
+    *n = picolScanInt(obj->str, base);
+    picolInvalidateObj(obj);
+    obj->type = PICOL_OBJ_INT;
+    obj->rep.i = *n;
+    return PICOL_OK;
+}
+picolResult picolGetListFromObj(
+    picolInterp* interp,
+    picolObj* obj,
+    int* count,
+    picolObj*** elems
+) {
+    /* The elements stay valid as long as obj keeps its list form. */
+    PICOL_UNUSED(interp);
+    if (obj->type != PICOL_OBJ_LIST) {
+        picolObj** list = NULL;
+        int n = 0, size = 0;
+        const char* cp;
+        size_t bufsize = PICOL_ELEMENT_SIZE(obj->str);
+        char* buf = PICOL_MALLOC(bufsize);
+        PICOL_FOREACH(buf, bufsize, cp, obj->str) {
+            if (n == size) {
+                size = size == 0 ? 8 : size * 2;
+                list = PICOL_REALLOC(list, sizeof(picolObj*) * size);
+            }
+            list[n] = picolNewObj(buf);
+            PICOL_INCR_REF(list[n]);
+            n++;
+        }
+        PICOL_FREE(buf);
+        picolInvalidateObj(obj);
+        obj->type = PICOL_OBJ_LIST;
+        obj->rep.list.count = n;
+        obj->rep.list.elems = list;
+    }
+    *count = obj->rep.list.count;
+    *elems = obj->rep.list.elems;
+    return PICOL_OK;
+}
+picolObj* picolNewListObj(int count, picolObj** elems) {
+    /* Make a list of count elements that shares them with the caller.  The
+       list form is ready, so indexing the new value does not parse it. */
+    picolStr str;
+    picolObj* obj, **list = NULL;
+    int i;
+    picolStrInit(&str);
+    if (count > 0) {
+        list = PICOL_MALLOC(sizeof(picolObj*) * count);
+    }
+    for (i = 0; i < count; i++) {
+        picolStrAppendElement(&str, elems[i]->str);
+        list[i] = elems[i];
+        PICOL_INCR_REF(list[i]);
+    }
+    obj = picolStrObj(&str);
+    obj->type = PICOL_OBJ_LIST;
+    obj->rep.list.count = count;
+    obj->rep.list.elems = list;
+    return obj;
+}
+picolObj* picolFindArgObj(picolInterp* interp, const char* arg) {
+    /* Return the value of arg if it is an argument of the innermost command
+       that was called with values.  The check is by identity, so it never
+       returns a value with a different string. */
+    int i;
+    for (i = 0; i < interp->objc; i++) {
+        if (interp->objv[i]->str == arg) {
+            return interp->objv[i];
+        }
+    }
+    return NULL;
+}
+picolObj* picolArgObj(picolInterp* interp, const char* arg) {
+    /* Like picolFindArgObj(), but make a new value if arg has none.  Hold a
+       reference to the value while using it. */
+    picolObj* obj = picolFindArgObj(interp, arg);
+    return obj != NULL ? obj : picolNewObj(arg);
+}
+picolResult picolGetInt(picolInterp* interp, const char* str, int* n) {
+    picolObj* obj = picolFindArgObj(interp, str);
+    int base;
+    if (obj != NULL) {
+        return picolGetIntFromObj(interp, obj, n);
+    }
+    base = picolIsInt(str);
+    if (base <= 0) {
+        return picolErrFmt(interp, "expected integer but got \"%s\"", str);
+    }
+    *n = picolScanInt(str, base);
+    return PICOL_OK;
+}
+picolResult picolSetResultObj(picolInterp* interp, picolObj* obj) {
+    PICOL_INCR_REF(obj);
+    if (interp->resultobj != NULL) {
+        picolDecrRef(interp->resultobj);
+    }
+    if (obj != interp->resultobj) {
+        interp->resultcap = 0;
+    }
+    interp->resultobj = obj;
+    interp->result = obj->str;
+    return PICOL_OK;
+}
+picolResult picolSetResultBuf(picolInterp* interp, char* buf, size_t size) {
+    /* Make buf the result without copying it.  buf must come from
+       PICOL_MALLOC() and be size bytes long; the interpreter owns it now and
+       may reuse it for later results. */
+    picolSetResultObj(interp, picolWrapObj(buf));
+    interp->resultcap = size;
+    return PICOL_OK;
+}
+char* picolResultBuffer(picolInterp* interp, size_t size) {
+    /* Return a buffer of at least size bytes that is already the result, for
+       a command to write its result into.  The buffer of the previous result
+       is reused if nothing but the interpreter holds on to it. */
+    picolObj* obj = interp->resultobj;
+    if (obj != NULL && obj->rc == 1 && interp->resultcap > 0) {
+        if (size > interp->resultcap) {
+            size_t cap = interp->resultcap;
+            while (cap < size) {
+                cap *= 2;
+            }
+            obj->str = PICOL_REALLOC(obj->str, cap);
+            interp->result = obj->str;
+            interp->resultcap = cap;
+        }
+        picolInvalidateObj(obj);
+        obj->cap = 0;
+        return obj->str;
+    }
+    if (size < PICOL_RESULT_MIN_SIZE) {
+        size = PICOL_RESULT_MIN_SIZE;
+    }
+    picolSetResultBuf(interp, PICOL_MALLOC(size), size);
+    interp->result[0] = '\0';
+    return interp->result;
+}
+void picolVarSetObj(picolVar* v, picolObj* obj) {
+    if (obj != NULL) {
+        PICOL_INCR_REF(obj);
+    }
+    if (v->obj != NULL) {
+        picolDecrRef(v->obj);
+    }
+    v->obj = obj;
+    v->val = obj == NULL ? NULL : obj->str;
+}
+void picolFreeVar(picolPool* pool, picolVar* v) {
+    /* pool is NULL for an array element. */
+    if (v->obj != NULL) {
+        picolDecrRef(v->obj);
+    }
+    picolPoolFreeStr(pool, v->name);
+    picolPoolFree(pool, v, sizeof(*v));
+}
+void picolAddWordObj(
+    picolObjv* words,
+    picolObj* obj,
+    int newword,
+    int* expand
+) {
+    /* picolAddWord() for values.  Takes over the caller's reference to
+       obj. */
+    int count, i;
+    picolObj** elems;
+    if (*expand && (!newword || obj->str[0] != '\0')) {
+        /* Slice in the words separately. */
+        picolGetListFromObj(NULL, obj, &count, &elems);
+        picolObjvReserve(words, words->objc + count);
+        for (i = 0; i < count; i++) {
+            words->objv[words->objc] = elems[i];
+            PICOL_INCR_REF(elems[i]);
+            words->objc++;
+        }
+        picolDecrRef(obj);
+        *expand = 0;
+    } else if (newword && *expand) {
+        picolDecrRef(obj);
+    } else if (newword) {
+        picolObjvReserve(words, words->objc + 1);
+        words->objv[words->objc++] = obj;
+    } else {
+        /* Interpolation.  Only a word nobody else holds is changed in
+           place. */
+        picolObj* last = words->objv[words->objc - 1];
+        size_t oldlen = strlen(last->str), len = strlen(obj->str);
+        if (last->rc > 1) {
+            picolObj* copy = picolWrapObj(PICOL_MALLOC(oldlen + len + 1));
+            memcpy(copy->str, last->str, oldlen);
+            PICOL_INCR_REF(copy);
+            picolDecrRef(last);
+            last = words->objv[words->objc - 1] = copy;
+        } else {
+            picolInvalidateObj(last);
+            last->str = PICOL_REALLOC(last->str, oldlen + len + 1);
+            last->cap = 0;
+        }
+        memcpy(last->str + oldlen, obj->str, len);
+        last->str[oldlen + len] = '\0';
+        picolDecrRef(obj);
+    }
+}
+/* ------------------------------------------------------ Parsed script cache */
+unsigned int picolHashString(const char* key) {
+    /* FNV-1a.  Unlike picolHash() it uses every character of a long key. */
+    unsigned int hash = 2166136261u;
+    for (; *key; key++) {
+        hash ^= (unsigned char)*key;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+picolScript* picolCompileScript(const char* text) {
+    /* Compile text into bytecode so that it can be evaluated repeatedly with
+       picolEvalScript().  Return NULL if text doesn't parse; picolEval()
+       reports the error then. */
+    picolParser p;
+    picolScript* script = PICOL_MALLOC(sizeof(picolScript));
+    int size = 16, pieces = 0, first = 0;
+
+    script->next   = NULL;
+    script->rc     = 1;
+    script->hash   = 0;
+    script->text   = strdup(text);
+    script->count  = 0;
+    script->ops    = PICOL_MALLOC(sizeof(picolOp) * size);
+    script->owner  = NULL;
+
+    picolInitParser(&p, text);
+    while (1) {
+        picolOp* op;
+        size_t tlen;
+        int prevtype = p.type;
+        p.expand = 0;
+        if (picolGetToken(NULL, &p) != PICOL_OK) {
+            picolFreeScript(script);
+            return NULL;
+        }
+        if (p.type == PICOL_PT_EOF) {
+            break;
+        }
+        if (p.type == PICOL_PT_SEP ||
+                (p.type == PICOL_PT_EOL && pieces == 0)) {
+            continue;
+        }
+        if (script->count == size) {
+            size *= 2;
+            script->ops = PICOL_REALLOC(script->ops, sizeof(picolOp) * size);
+        }
+        op = &script->ops[script->count];
+        script->count++;
+        op->text   = NULL;
+        op->script = NULL;
+        op->flags  = 0;
+        op->obj    = NULL;
+        op->cmd    = NULL;
+        op->owner  = 0;
+        op->epoch  = 0;
+        op->slot   = -1;
+
+        if (p.type == PICOL_PT_EOL) {
+            /* Only a command name that is a single literal can be cached. */
+            picolOp* name = &script->ops[first];
+            op->code = PICOL_OP_CALL;
+            if (name->code == PICOL_OP_PUSH &&
+                    !(name->flags & PICOL_OPF_EXPAND) &&
+                    (first + 1 == script->count - 1 ||
+                     (script->ops[first + 1].flags & PICOL_OPF_WORD))) {
+                op->flags |= PICOL_OPF_STATIC;
+            }
+            pieces = 0;
+            first = script->count;
+            continue;
+        }
+        pieces++;
+        if (prevtype == PICOL_PT_SEP || prevtype == PICOL_PT_EOL) {
+            op->flags |= PICOL_OPF_WORD;
+        }
+        if (p.expand) {
+            op->flags |= PICOL_OPF_EXPAND;
+        }
+
+        tlen = p.end < p.start ? 0 : p.end - p.start + 1;
+        op->text = PICOL_MALLOC(tlen + 1);
+        if (p.type == PICOL_PT_STR || p.type == PICOL_PT_VAR) {
+            tlen = picolExpandLC(op->text, tlen, p.start);
+        } else {
+            memcpy(op->text, p.start, tlen);
+        }
+        op->text[tlen] = '\0';
+        if (p.type == PICOL_PT_VAR) {
+            op->code = PICOL_OP_LOAD;
+        } else if (p.type == PICOL_PT_CMD) {
+            op->code = PICOL_OP_EVAL;
+            op->script = picolCompileScript(op->text);
+        } else {
+            op->code = PICOL_OP_PUSH;
+            if (p.type == PICOL_PT_ESC && strchr(op->text, '\\')) {
+                picolEscape(op->text, tlen);
+            }
+            op->obj = picolNewObj(op->text);
+            PICOL_INCR_REF(op->obj);
+        }
+    }
+    return script;
+}
+void picolFreeScript(picolScript* script) {
+    int i;
+    for (i = 0; i < script->count; i++) {
+        if (script->ops[i].script != NULL) {
+            picolFreeScript(script->ops[i].script);
+        }
+        if (script->ops[i].obj != NULL) {
+            picolDecrRef(script->ops[i].obj);
+        }
+        PICOL_FREE(script->ops[i].text);
+    }
+    PICOL_FREE(script->ops);
+    PICOL_FREE(script->text);
+    PICOL_FREE(script);
+}
+void picolReleaseScript(picolScript* script) {
+    script->rc--;
+    if (script->rc == 0) {
+        picolFreeScript(script);
+    }
+}
+void picolScriptCacheFlush(picolInterp* interp) {
+    /* Scripts that are being evaluated survive until they finish. */
+    int i;
+    for (i = 0; i < PICOL_SCRIPT_CACHE_BUCKETS; i++) {
+        picolScript* s, *next;
+        for (s = interp->scripts[i]; s != NULL; s = next) {
+            next = s->next;
+            s->next = NULL;
+            picolReleaseScript(s);
+        }
+        interp->scripts[i] = NULL;
+    }
+    interp->scriptcount = 0;
+}
+picolScript* picolScriptCacheGet(picolInterp* interp, const char* text) {
+    /* Return the compiled text or NULL if it doesn't compile.  The caller
+       must take a reference to the script and release it when done.  A script
+       is only cached the second time it is seen so that one-off scripts like
+       a command with the values substituted in don't push out the ones that
+       are evaluated repeatedly.  A script that isn't cached is freed when the
+       caller releases it. */
+    unsigned int hash = picolHashString(text);
+    int bucket = hash % PICOL_SCRIPT_CACHE_BUCKETS;
+    picolScript* s;
+
+    for (s = interp->scripts[bucket]; s != NULL; s = s->next) {
+        if (s->hash == hash && PICOL_EQ(s->text, text)) {
+            return s;
+        }
+    }
+
+    s = picolCompileScript(text);
+    if (s == NULL) {
+        return NULL;
+    }
+    if (interp->scriptseen[bucket] != hash) {
+        interp->scriptseen[bucket] = hash;
+        s->rc = 0;
+        return s;
+    }
+    if (interp->scriptcount >= PICOL_SCRIPT_CACHE_SIZE) {
+        picolScriptCacheFlush(interp);
+    }
+    s->hash = hash;
+    s->next = interp->scripts[bucket];
+    interp->scripts[bucket] = s;
+    interp->scriptcount++;
+    return s;
+}
+picolExec* picolExecPush(
+    picolInterp* interp,
+    picolExec* parent,
+    picolScript* script,
+    int kind
+) {
+    picolExec* x = interp->execfree;
+    if (x != NULL) {
+        interp->execfree = x->parent;
+        interp->execfreecount--;
+    } else {
+        x = PICOL_MALLOC(sizeof(picolExec));
+    }
+    x->parent = parent;
+    x->script = script;
+    x->pc     = 0;
+    x->kind   = kind;
+    x->expand = 0;
+    x->frame  = NULL;
+    x->cont   = NULL;
+    picolObjvInit(&x->words);
+    picolArgvInit(&x->args);
+    script->rc++;
+    picolSetResult(interp, "");
+    return x;
+}
+void picolExecPop(picolInterp* interp, picolExec* x) {
+    int j;
+    for (j = 0; j < x->words.objc; j++) {
+        picolDecrRef(x->words.objv[j]);
+    }
+    picolObjvFree(&x->words);
+    picolArgvFree(&x->args);
+    picolReleaseScript(x->script);
+    if (interp->execfreecount < PICOL_EXEC_CACHE_SIZE) {
+        x->parent = interp->execfree;
+        interp->execfree = x;
+        interp->execfreecount++;
+    } else {
+        PICOL_FREE(x);
+    }
+}
+void picolExecWord(picolExec* x, picolObj* obj) {
+    /* Add obj, the value of the current op, to the command being built. */
+    picolOp* op = &x->script->ops[x->pc];
+    PICOL_INCR_REF(obj);
+    picolAddWordObj(&x->words, obj, op->flags & PICOL_OPF_WORD, &x->expand);
+    x->pc++;
+}
+void picolExecNext(picolExec* x) {
+    /* Move on to the next command.  The vectors are kept for it. */
+    int j;
+    for (j = 0; j < x->words.objc; j++) {
+        picolDecrRef(x->words.objv[j]);
+    }
+    x->words.objc = 0;
+    x->pc++;
+}
+picolResult picolExecCall(picolInterp* interp, picolExec** xp, picolCmd* c) {
+    /* Run c for the command (*xp)->call has begun.  The body of a compiled
+       proc and a script c leaves with picolTailEval() are pushed on top of *xp
+       to finish the call when they are done.  Otherwise, it finishes here. */
+    picolExec* x = *xp;
+    picolProc* proc = c->isproc ? c->privdata : NULL;
+    picolResult rc;
+    if (proc != NULL && proc->code != NULL) {
+        rc = picolProcEnter(interp, proc, x->call.argc, x->call.argv);
+        if (rc == PICOL_OK) {
+            *xp = picolExecPush(interp, x, proc->code, PICOL_EXEC_PROC);
+            return PICOL_OK;
+        }
+    } else {
+        rc = c->func(interp, x->call.argc, x->call.argv, c->privdata);
+    }
+    if (rc == PICOL_EVAL_TAIL) {
+        rc = picolExecTail(interp, xp);
+        if (rc == PICOL_EVAL_TAIL) {
+            return PICOL_OK;
+        }
+    }
+    rc = picolCallEnd(interp, &x->call, rc);
+    if (rc == PICOL_OK) {
+        picolExecNext(x);
+    }
+    return rc;
+}
+picolResult picolExecTail(picolInterp* interp, picolExec** xp) {
+    /* Push the script the command (*xp)->call has left with picolTailEval()
+       on top of *xp and return PICOL_EVAL_TAIL.  A script that doesn't
+       compile is evaluated from the text right away instead, and what the
+       command returns is returned. */
+    picolObj* tail = interp->tail;
+    picolScript* s = picolTailScript(interp, tail);
+    if (s == NULL) {
+        return picolRunTail(interp);
+    }
+    *xp = picolExecPush(interp, *xp, s, PICOL_EXEC_TAIL);
+    (*xp)->frame    = interp->tailframe;
+    (*xp)->cont     = interp->tailcont;
+    (*xp)->contdata = interp->taildata;
+    interp->tail = NULL;
+    interp->tailframe = NULL;
+    interp->tailcont = NULL;
+    picolDecrRef(tail);
+    return PICOL_EVAL_TAIL;
+}
+picolResult picolEvalScript(picolInterp* interp, picolScript* script) {
+    /* The bytecode interpreter.  It follows picolEval2() step by step, minus
+       the tokenizing, and passes values instead of copies of strings.  The
+       caller must hold a reference to script.
+
+       Command substitutions, the bodies of compiled procs and the scripts
+       commands leave with picolTailEval() run in this loop on a stack of
+       picolExec records rather than in nested calls.  A deep recursion of
+       procs therefore uses heap memory and not the C stack. */
+    picolExec* x;
+    picolResult rc = PICOL_OK;
+    int halt;
+    if (PICOL_TOO_DEEP(interp)) {
+        return picolErr(interp, "too many nested evaluations (infinite loop?)");
+    }
+    interp->depth++;
+    x = picolExecPush(interp, NULL, script, PICOL_EXEC_SCRIPT);
+    while (1) {
+        picolOp* op;
+        picolObj* obj;
+        if (rc != PICOL_OK || x->pc == x->script->count) {
+            /* x is done.  Return to its parent with rc. */
+            picolExec* parent = x->parent;
+            int kind = x->kind;
+            picolCont cont = x->cont;
+            void* data = x->contdata;
+            if (x->frame != NULL) {
+                interp->callframe = x->frame;
+            }
+            picolExecPop(interp, x);
+            if (kind == PICOL_EXEC_PROC) {
+                rc = picolProcLeave(interp, rc);
+            }
+            if (parent == NULL) {
+                break;
+            }
+            x = parent;
+            if (kind == PICOL_EXEC_SUBST) {
+                if (rc == PICOL_OK) {
+                    picolExecWord(x, interp->resultobj);
                 }
-                if (total_len >= (size_t)(PICOL_BUFFER_SIZE(buf) - 1)) {
-                    rc = picolErr(interp,
-                                  "script too long to parse "
-                                  "(missing closing brace?)");
-                    goto err;
+                continue;
+            }
+            if (cont != NULL) {
+                rc = cont(interp, data, rc);
+                if (rc == PICOL_EVAL_TAIL) {
+                    rc = picolExecTail(interp, &x);
+                    if (rc == PICOL_EVAL_TAIL) {
+                        rc = PICOL_OK;
+                        continue;
+                    }
                 }
-
-                rc = picolList(
-                    buf,
-                    PICOL_BUFFER_SIZE(buf),
-                    argc,
-                    (const char**)argv
-                );
-                if (rc != PICOL_OK) {
-                    goto err;
+            }
+            /* The script was run for the command at x->pc.  A proc that
+               ended with [tailcall] is replaced by the command it left,
+               which reuses x instead of nesting. */
+            if (kind == PICOL_EXEC_PROC && interp->tailcallv != NULL) {
+                picolCmd* c;
+                rc = picolTailcallBegin(interp, &x->call, &c);
+                if (rc == PICOL_OK) {
+                    rc = picolExecCall(interp, &x, c);
+                    continue;
+                }
+            }
+            rc = picolCallEnd(interp, &x->call, rc);
+            if (rc == PICOL_OK) {
+                picolExecNext(x);
+            }
+            continue;
+        }
+        op = &x->script->ops[x->pc];
+        if (op->flags & PICOL_OPF_EXPAND) {
+            x->expand = 1;
+        }
+        switch (op->code) {
+        case PICOL_OP_CALL: {
+            picolCmd* c = NULL;
+            int j;
+            if (x->words.objc == 0) {
+                x->pc++;
+                continue;
+            }
+            picolArgvReserve(&x->args, x->words.objc);
+            for (j = 0; j < x->words.objc; j++) {
+                x->args.argv[j] = x->words.objv[j]->str;
+            }
+            x->args.argc = x->words.objc;
+            if (op->flags & PICOL_OPF_STATIC) {
+                if (op->owner == interp->id && op->epoch == interp->cmdepoch) {
+                    c = op->cmd;
+                } else if ((c = picolGetCmd(interp, x->args.argv[0])) != NULL) {
+                    op->cmd = c;
+                    op->owner = interp->id;
+                    op->epoch = interp->cmdepoch;
+                }
+            }
+            rc = picolCallBegin(
+                interp,
+                &x->call,
+                &c,
+                x->args.argc,
+                x->args.argv,
+                x->words.objv,
+                &halt
+            );
+            if (halt) {
+                x->pc = x->script->count;
+                continue;
+            }
+            if (rc == PICOL_OK) {
+                rc = picolExecCall(interp, &x, c);
+                continue;
+            }
+            rc = picolCallEnd(interp, &x->call, rc);
+            continue;
+        }
+        case PICOL_OP_LOAD: {
+            picolCallFrame* cf = interp->callframe;
+            picolVar* v;
+            if (op->slot >= 0 && cf->proc == x->script->owner) {
+                v = cf->slots[op->slot];
+                if (v == NULL) {
+                    v = cf->slots[op->slot] = picolGetVar(interp, op->text);
                 }
-                interp->current = strdup(buf);
+            } else {
+                v = picolGetVar(interp, op->text);
+            }
+            if (v != NULL && !v->val) {
+                v = picolGetGlobalVar(interp, op->text);
+            }
+            if (v == NULL || v->obj == NULL) {
+                rc = picolErrFmt(
+                    interp,
+                    "can't read \"%s\": no such variable",
+                    op->text
+                );
+                continue;
+            }
+            obj = v->obj;
+            break;
+        }
+        case PICOL_OP_EVAL:
+            if (op->script != NULL) {
+                x = picolExecPush(interp, x, op->script, PICOL_EXEC_SUBST);
+                continue;
+            }
+            rc = picolEval(interp, op->text);
+            if (rc != PICOL_OK) {
+                continue;
+            }
+            obj = interp->resultobj;
+            break;
+        default: /* PICOL_OP_PUSH */
+            obj = op->obj;
+        }
+        picolExecWord(x, obj);
+    }
+    interp->depth--;
+    return rc;
+}
+picolScript* picolGetScriptFromObj(picolObj* obj) {
+    /* Return obj compiled or NULL if it doesn't compile.  The compiled script
+       is kept in obj, so a loop body, for example, is only compiled once. */
+    picolScript* script;
+    if (obj->type != PICOL_OBJ_SCRIPT) {
+        script = picolCompileScript(obj->str);
+        if (script == NULL) {
+            return NULL;
+        }
+        picolInvalidateObj(obj);
+        obj->type = PICOL_OBJ_SCRIPT;
+        obj->rep.script = script;
+    }
+    return obj->rep.script;
+}
+picolResult picolEvalObj(picolInterp* interp, picolObj* obj) {
+    /* Evaluate obj as a script, compiling it only once. */
+    picolScript* script;
+    int rc;
+    PICOL_INCR_REF(obj);
+    script = picolGetScriptFromObj(obj);
+    if (script == NULL) {
+        rc = picolEval(interp, obj->str);
+        picolDecrRef(obj);
+        return rc;
+    }
+    script->rc++;
+    rc = picolEvalScript(interp, script);
+    picolReleaseScript(script);
+    picolDecrRef(obj);
+    return rc;
+}
+picolResult picolEvalArg(picolInterp* interp, const char* script) {
+    /* Evaluate script, which is likely one of the current command's arguments
+       and has a value that can keep the compiled script. */
+    picolObj* obj = picolFindArgObj(interp, script);
+    if (obj == NULL) {
+        return picolEval(interp, script);
+    }
+    return picolEvalObj(interp, obj);
+}
+picolResult picolCondition(picolInterp* interp, const char* str) {
+    /* Set the result to 1 if the expression str holds and to 0 if not. */
+    int truth;
+    picolResult rc;
+    if (str == NULL) {
+        return picolErr(interp, "NULL condition");
+    }
+    rc = picolEvalCondition(interp, str, &truth);
+    return rc != PICOL_OK ? rc : picolSetBoolResult(interp, truth);
+}
+#if PICOL_FEATURE_IO
+picolBool picolIsDirectory(const char* path) {
+    struct stat path_stat;
+    if (stat(path, &path_stat) == 0) {
+        return S_ISDIR(path_stat.st_mode);
+    } else {
+        /* Return -2 if the path doesn't exist and -1 on other errors. */
+        return (errno == ENOENT ? -2 : -1);
+    }
+}
+#endif
+int picolIsInt(const char* str) {
+    const char* cp = str;
+    int base = 10, rem = strlen(str);
+
+    if (rem == 0) return 0;
+
+    /* Allow a leading minus. */
+    if (*cp == '-') {
+        cp++; rem--;
+    }
+    if (rem == 0) return 0;
+
+    /* Parse the optional base marker. */
+    if (*cp == '0' && rem >= 2) {
+        char b = *(cp + 1);
+        if (b == 'b' || b == 'B') {
+            base = 2;
+        } else if (b == 'o' || b == 'O') {
+            base = 8;
+        } else if (b == 'x' || b == 'X') {
+            base = 16;
+        }
+        if (base != 10) {
+            cp += 2;
+        }
+    }
+
+    /* Validate the number itself. */
+    for (; *cp; cp++) {
+        char c = *cp;
+        int n;
+        if (c >= 'A' && c <= 'Z') {
+            c = c - 'A' + 'a';
+        }
+        if (c >= '0' && c <= '9') {
+            n = c - '0';
+        } else if (c >= 'a' && c <= 'z') {
+            n = c - 'a' + 10;
+        } else {
+            return 0;
+        }
+        if (n >= base) {
+            return 0;
+        }
+    }
+
+    return base;
+}
+int picolScanInt(const char* str, int base) {
+    int sign = 1;
+    if (*str == '-') {
+        str++; sign = -1;
+    }
+    if (base == 10) {
+        while (*str == '0') { str++; }
+    } else {
+        str += 2;
+    }
+    return sign * strtol(str, NULL, base);
+}
+void* picolScanPtr(const char* str) {
+    void* p = NULL;
+    sscanf(str, "%p", &p);
+    return (p && strlen(str) >= 3 ? p : NULL);
+}
+void picolFrameInit(picolCallFrame* cf, picolCallFrame* parent) {
+    cf->vars      = NULL;
+    cf->argc      = 0;
+    cf->argv      = NULL;
+    cf->command   = NULL;
+    cf->parent    = parent;
+    cf->proc      = NULL;
+    cf->slots     = NULL;
+    cf->nslots    = 0;
+    cf->table     = NULL;
+    cf->tablesize = 0;
+    cf->nvars     = 0;
+    cf->tailcallc = 0;
+    cf->tailcallv = NULL;
+}
+const char* picolFrameCommand(picolCallFrame* cf) {
+    if (cf->command == NULL && cf->argv != NULL) {
+        cf->command = picolListNew(cf->argc, cf->argv);
+    }
+    return cf->command;
+}
+picolVar** picolFrameBucket(picolCallFrame* cf, const char* name) {
+    if (cf->table == NULL) {
+        return &cf->vars;
+    }
+    return &cf->table[picolHashString(name) & (cf->tablesize - 1)];
+}
+picolVar* picolFrameGet(picolCallFrame* cf, const char* name) {
+    picolVar* v;
+    for (v = *picolFrameBucket(cf, name); v != NULL; v = v->next) {
+        if (PICOL_EQ(v->name, name)) {
+            return v;
+        }
+    }
+    return NULL;
+}
+void picolFrameRehash(picolCallFrame* cf, int size) {
+    picolVar** old = cf->table;
+    picolVar* v, *next;
+    int i, oldsize = PICOL_FRAME_BUCKETS(cf);
+    picolVar* list = cf->vars;
+
+    cf->table = PICOL_CALLOC(size, sizeof(picolVar*));
+    cf->tablesize = size;
+    cf->vars = NULL;
+    for (i = 0; i < oldsize; i++) {
+        for (v = old == NULL ? list : old[i]; v != NULL; v = next) {
+            picolVar** bucket = picolFrameBucket(cf, v->name);
+            next = v->next;
+            v->next = *bucket;
+            *bucket = v;
+        }
+    }
+    PICOL_FREE(old);
+}
+void picolFrameAdd(picolCallFrame* cf, picolVar* v) {
+    picolVar** bucket;
+    cf->nvars++;
+    if (cf->table == NULL && cf->nvars > PICOL_VAR_TABLE_THRESHOLD) {
+        picolFrameRehash(cf, PICOL_VAR_TABLE_SIZE);
+    } else if (cf->table != NULL && cf->nvars > 2 * cf->tablesize) {
+        picolFrameRehash(cf, 2 * cf->tablesize);
+    }
+    bucket = picolFrameBucket(cf, v->name);
+    v->next = *bucket;
+    *bucket = v;
+}
+picolVar* picolFrameRemove(picolCallFrame* cf, const char* name) {
+    /* Unlink the variable name from the frame and return it. */
+    picolVar** vp, *v;
+    for (vp = picolFrameBucket(cf, name); *vp != NULL; vp = &(*vp)->next) {
+        if (PICOL_EQ((*vp)->name, name)) {
+            v = *vp;
+            *vp = v->next;
+            cf->nvars--;
+            return v;
+        }
+    }
+    return NULL;
+}
+void picolDropCallFrame(picolInterp* interp) {
+    picolCallFrame* cf = interp->callframe;
+    picolVar* v, *next;
+    int i;
+    for (i = 0; i < PICOL_FRAME_BUCKETS(cf); i++) {
+        for (v = PICOL_FRAME_BUCKET(cf, i); v != NULL; v = next) {
+            next = v->next;
+            picolFreeVar(&interp->pool, v);
+        }
+    }
+    if (cf->command != NULL) {
+        PICOL_FREE(cf->command);
+    }
+    picolPoolFree(&interp->pool, cf->slots, sizeof(picolVar*) * cf->nslots);
+    PICOL_FREE(cf->table);
+    picolWordsFree(interp, cf->tailcallc, cf->tailcallv);
+    interp->callframe = cf->parent;
+    picolPoolFree(&interp->pool, cf, sizeof(picolCallFrame));
+}
+picolResult picolValidPtrAdd(picolInterp* interp, int type, void* ptr) {
+    picolPtr* p = interp->validptrs;
+    while (p != NULL) {
+        /* Adding a valid pointer should be idempotent. */
+        if (p->type == type && p->ptr == ptr) {
+            return PICOL_OK;
+        }
+        p = p->next;
+    }
+
+    p = PICOL_MALLOC(sizeof(picolPtr));
+    if (p == NULL) return PICOL_ERR;
+    p->type = type;
+    p->ptr = ptr;
+    p->next = interp->validptrs;
+    interp->validptrs = p;
+
+    return PICOL_OK;
+}
+picolBool picolValidPtr(picolInterp* interp, int type, void* ptr) {
+    picolPtr* p = interp->validptrs;
+    while (p != NULL) {
+        if (p->type == type && p->ptr == ptr) {
+            return PICOL_TRUE;
+        }
+        p = p->next;
+    }
+    return PICOL_FALSE;
+}
+picolResult picolValidPtrRemove(picolInterp* interp, void* ptr) {
+    picolPtr *p = interp->validptrs, *prev = NULL;
+
+    while (p != NULL && p->ptr != ptr) {
+        prev = p;
+        p = p->next;
+    }
+    if (p == NULL) {
+        return PICOL_ERR;
+    } else {
+        if (prev == NULL) {
+            interp->validptrs = p->next;
+        } else {
+            prev->next = p->next;
+        }
+
+#if PICOL_FEATURE_ARRAYS
+        if (p->ptr && p->type == PICOL_PTR_ARRAY) {
+            picolArrDestroy(p->ptr);
+        }
+#endif
+        if (p->ptr && p->type == PICOL_PTR_INTERP) {
+            picolFreeInterp(p->ptr);
+        }
+        PICOL_FREE(p);
+        return PICOL_OK;
+    }
+}
+picolProc* picolCreateProc(
+    picolInterp* interp,
+    const char* args,
+    const char* body
+) {
+    /* Parse the argument list once so that picolCallProc() only has to bind
+       the values.  The body is left uncompiled. */
+    picolProc* proc;
+    const char* cp, *elem;
+    int n = 0, size = 0;
+    size_t bufsize = PICOL_ELEMENT_SIZE(args);
+    char* buf = PICOL_MALLOC(bufsize);
+    char* name = PICOL_MALLOC(bufsize), *def = PICOL_MALLOC(bufsize);
+
+    PICOL_FOREACH(buf, bufsize, cp, args) {
+        size++;
+    }
+
+    proc = PICOL_MALLOC(sizeof(picolProc));
+    proc->rc       = 1;
+    proc->args     = strdup(args);
+    proc->body     = strdup(body);
+    proc->code     = NULL;
+    proc->nparams  = 0;
+    proc->params   = PICOL_MALLOC(sizeof(picolParam) * (size > 0 ? size : 1));
+    proc->variadic = 0;
+    proc->nslots   = 0;
+    proc->slotnames = NULL;
+
+    PICOL_FOREACH(buf, bufsize, cp, args) {
+        elem = picolListHead(buf, name, bufsize);
+        if (elem == NULL || name[0] == '\0') {
+            picolErr(interp, "argument with no name");
+            goto err;
+        }
+        elem = picolListHead(elem, def, bufsize);
+        if (elem != NULL && picolListHead(elem, def, bufsize) != NULL) {
+            picolErrFmt(
+                interp,
+                "too many fields in argument specifier \"%s\"",
+                buf
+            );
+            goto err;
+        }
+        proc->params[n].name = strdup(name);
+        proc->params[n].def  = elem == NULL ? NULL : strdup(def);
+        n++;
+        proc->nparams = n;
+    }
+    proc->variadic = n > 0 &&
+                     PICOL_EQ(proc->params[n - 1].name, "args") &&
+                     proc->params[n - 1].def == NULL;
+    PICOL_FREE(buf);
+    PICOL_FREE(name);
+    PICOL_FREE(def);
+    return proc;
+err:
+    picolFreeProc(proc);
+    PICOL_FREE(buf);
+    PICOL_FREE(name);
+    PICOL_FREE(def);
+    return NULL;
+}
+void picolFreeProc(picolProc* proc) {
+    int i;
+    for (i = 0; i < proc->nparams; i++) {
+        PICOL_FREE(proc->params[i].name);
+        PICOL_FREE(proc->params[i].def);
+    }
+    for (i = 0; i < proc->nslots; i++) {
+        PICOL_FREE(proc->slotnames[i]);
+    }
+    PICOL_FREE(proc->slotnames);
+    PICOL_FREE(proc->params);
+    PICOL_FREE(proc->args);
+    PICOL_FREE(proc->body);
+    if (proc->code != NULL) {
+        picolReleaseScript(proc->code);
+    }
+    PICOL_FREE(proc);
+}
+void picolAssignSlots(picolProc* proc, picolScript* script) {
+    /* Give every plain local variable the body reads a slot number so that
+       the variable can be found in the call frame without a search. */
+    int i, j;
+    script->owner = proc;
+    for (i = 0; i < script->count; i++) {
+        picolOp* op = &script->ops[i];
+        if (op->script != NULL) {
+            picolAssignSlots(proc, op->script);
+        }
+        if (op->code != PICOL_OP_LOAD || PICOL_COLONED(op->text) ||
+                strchr(op->text, '(') != NULL) {
+            continue;
+        }
+        for (j = 0; j < proc->nslots; j++) {
+            if (PICOL_EQ(proc->slotnames[j], op->text)) {
+                break;
+            }
+        }
+        if (j == proc->nslots) {
+            proc->slotnames = PICOL_REALLOC(
+                proc->slotnames,
+                sizeof(char*) * (proc->nslots + 1)
+            );
+            proc->slotnames[proc->nslots++] = strdup(op->text);
+        }
+        op->slot = j;
+    }
+}
+picolResult picolProcEnter(
+    picolInterp* interp,
+    picolProc* x,
+    int argc,
+    const char** argv
+) {
+    /* Push a call frame for a call to the proc x and bind its arguments.  If
+       this succeeds, the caller must evaluate the body and pass the result to
+       picolProcLeave(). */
+    picolCallFrame* cf = picolPoolAlloc(&interp->pool, sizeof(picolCallFrame));
+    int i, nargs = argc - 1, nfixed = x->nparams - x->variadic;
+    int errcode = PICOL_OK;
+
+    if (cf == NULL) {
+        fprintf(stderr, "could not allocate callframe\n");
+        return PICOL_ERR;
+    }
+
+    picolFrameInit(cf, interp->callframe);
+    cf->proc = x;
+    if (x->code != NULL && x->nslots > 0) {
+        cf->slots = picolPoolAlloc(
+            &interp->pool,
+            sizeof(picolVar*) * x->nslots
+        );
+        memset(cf->slots, 0, sizeof(picolVar*) * x->nslots);
+        cf->nslots = x->nslots;
+    }
+    interp->callframe = cf;
+
+    if (interp->level > interp->maxlevel) {
+        picolDropCallFrame(interp);
+        return picolErr(interp, "too many nested evaluations (infinite loop?)");
+    }
+    interp->level++;
+
+    if (nargs > nfixed && !x->variadic) {
+        goto arityerr;
+    }
+    for (i = 0; i < nfixed; i++) {
+        if (i < nargs) {
+            picolSetVarObj(
+                interp,
+                x->params[i].name,
+                picolArgObj(interp, argv[i + 1]),
+                0
+            );
+        } else if (x->params[i].def != NULL) {
+            picolSetVar(interp, x->params[i].name, x->params[i].def);
+        } else {
+            goto arityerr;
+        }
+    }
+    if (x->variadic) {
+        picolSetVarObj(
+            interp,
+            "args",
+            picolWrapObj(picolListNew(
+                nargs > nfixed ? nargs - nfixed : 0,
+                argv + 1 + nfixed
+            )),
+            0
+        );
+    }
+
+    cf->argc = argc;
+    cf->argv = argv;
+    return errcode;
+arityerr:
+    /* Remove the called proc's callframe on error. */
+    picolDropCallFrame(interp);
+    interp->level--;
+    return picolErrFmt(interp, "wrong # args for \"%s\"", argv[0]);
+}
+picolResult picolProcLeave(picolInterp* interp, picolResult rc) {
+    /* Drop the proc's frame.  If the proc left a [tailcall] and did not fail,
+       the caller finds it in interp->tailcallv and must run it with
+       picolTailcallBegin(). */
+    picolCallFrame* cf = interp->callframe;
+    if (rc == PICOL_RETURN) {
+        rc = PICOL_OK;
+    }
+    if (rc == PICOL_OK && cf->tailcallv != NULL) {
+        interp->tailcallc = cf->tailcallc;
+        interp->tailcallv = cf->tailcallv;
+        cf->tailcallv = NULL;
+    }
+    picolDropCallFrame(interp);
+    interp->level--;
+    return rc;
+}
+picolResult picolTailcallBegin(
+    picolInterp* interp,
+    picolCall* call,
+    picolCmd** cp
+) {
+    /* Make the words in interp->tailcallv the command of call in place of the
+       proc that has returned.  The caller must run *cp as it would for
+       picolCallBegin().  The words are kept until picolCallEnd(), so the
+       frame of a proc they call can refer to them. */
+    int count = interp->tailcallc;
+    picolObj** words = interp->tailcallv;
+    const char** argv = (const char**)(words + count);
+    picolCmd* c;
+
+    interp->tailcallv = NULL;
+    picolWordsFree(interp, call->tailcallc, call->tailcallv);
+    call->tailcallc = count;
+    call->tailcallv = words;
+    call->argc = count;
+    call->argv = argv;
+    PICOL_FREE(interp->current);
+    interp->current = NULL;
+    interp->curargc = count;
+    interp->curargv = argv;
+    interp->objc = count;
+    interp->objv = words;
+    if ((c = picolGetCmd(interp, argv[0])) == NULL) {
+        return picolErrFmt(interp, "invalid command name \"%s\"", argv[0]);
+    }
+    *cp = c;
+    call->cmd = c;
+    return PICOL_OK;
+}
+picolObj** picolWordsNew(picolInterp* interp, int count, const char** argv) {
+    /* Keep the words of a command for later: count values followed by their
+       strings in one block from the pool.  The values of the arguments of the
+       current command are shared. */
+    picolObj** words = picolPoolAlloc(&interp->pool, sizeof(void*) * 2 * count);
+    const char** strs = (const char**)(words + count);
+    int i;
+    for (i = 0; i < count; i++) {
+        words[i] = picolArgObj(interp, argv[i]);
+        PICOL_INCR_REF(words[i]);
+        strs[i] = words[i]->str;
+    }
+    return words;
+}
+void picolWordsFree(picolInterp* interp, int count, picolObj** words) {
+    int i;
+    if (words == NULL) {
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        picolDecrRef(words[i]);
+    }
+    picolPoolFree(&interp->pool, words, sizeof(void*) * 2 * count);
+}
+picolResult picolProcRun(
+    picolInterp* interp,
+    picolProc* x,
+    int argc,
+    const char** argv
+) {
+    picolResult rc = picolProcEnter(interp, x, argc, argv);
+    if (rc != PICOL_OK) {
+        return rc;
+    }
+    if (x->code != NULL) {
+        /* Hold on to the bytecode in case the proc redefines itself. */
+        picolScript* code = x->code;
+        code->rc++;
+        rc = picolEvalScript(interp, code);
+        picolReleaseScript(code);
+    } else {
+        rc = picolEval(interp, x->body);
+    }
+    return picolProcLeave(interp, rc);
+}
+picolResult picolCallProc(
+    picolInterp* interp,
+    int argc,
+    const char** argv,
+    void* pd
+) {
+    picolCall call;
+    picolCmd* c;
+    picolResult rc = picolProcRun(interp, pd, argc, argv);
+    if (interp->tailcallv == NULL) {
+        return rc;
+    }
+
+    /* Run the [tailcall] and the ones the procs it calls leave in a loop. */
+    call.cmd       = NULL;
+    call.uargv     = NULL;
+    call.tailcallv = NULL;
+    call.objc      = interp->objc;
+    call.objv      = interp->objv;
+    call.curargc   = interp->curargc;
+    call.curargv   = interp->curargv;
+    call.current   = interp->current;
+    interp->current = NULL;
+    while (interp->tailcallv != NULL) {
+        rc = picolTailcallBegin(interp, &call, &c);
+        if (rc != PICOL_OK) {
+            break;
+        }
+        if (c->isproc) {
+            rc = picolProcRun(interp, c->privdata, call.argc, call.argv);
+        } else if (PICOL_TOO_DEEP(interp)) {
+            rc = picolErr(
+                interp,
+                "too many nested evaluations (infinite loop?)"
+            );
+        } else {
+            /* This nests, e.g., for a proc that tail-calls [apply] with a
+               lambda that tail-calls the proc. */
+            interp->depth++;
+            rc = c->func(interp, call.argc, call.argv, c->privdata);
+            interp->depth--;
+        }
+    }
+    call.cmd = NULL;
+    return picolCallEnd(interp, &call, rc);
+}
+picolResult picolUnsetVar(picolInterp* interp, const char* name) {
+    picolVar* v;
+    picolCallFrame* cf;
+    int found = 0;
+#if PICOL_FEATURE_ARRAYS
+    picolArray* ap;
+    ap = picolArrFindByName(interp, name, 0, NULL, 0);
+    if (ap != NULL) {
+        /* The variable is an array. */
+        picolArrDestroy(ap);
+        picolPtr* ptr = interp->validptrs;
+        while (ptr) {
+            if (ptr->ptr == ap) {
+                ptr->ptr = NULL;
+                break;
+            } else {
+                ptr = ptr->next;
+            }
+        }
+    }
+#endif
+    cf = interp->callframe;
+    if (PICOL_COLONED(name)) {
+        while (cf->parent) cf = cf->parent;
+        name += 2;
+    }
+
+    v = picolFrameRemove(cf, name);
+    if (v != NULL) {
+        int i;
+        found = 1;
+        for (i = 0; i < cf->nslots; i++) {
+            if (cf->slots[i] == v) {
+                cf->slots[i] = NULL;
+            }
+        }
+        picolFreeVar(&interp->pool, v);
+    }
+
+    return found ? PICOL_OK : PICOL_ERR;
+}
+picolBool picolWildEq(const char* pat, const char* str, int n) {
+    /* Check if the first n characters of str match the pattern pat where
+       a '?' in pat matches any character. */
+    int escaped = 0;
+    for (; *pat != '\0' && *str != '\0' && n != 0; pat++, str++, n--) {
+        if (*pat == '\\') {
+            escaped = 1;
+            pat++;
+        }
+        if (!(*pat == *str || (!escaped && *pat == '?'))) {
+            return PICOL_FALSE;
+        }
+        escaped = 0;
+    }
+    return (picolBool)(n == 0 || *pat == *str || (!escaped && *pat == '?'));
+}
+int picolMatch(const char* pat, const char* str) {
+    /* An incomplete implementation of [string match].  It only handles these
+       common special cases: <string>, *<string>, <string>* and *<string>*
+       where the string may contain '?' to match any character.  Other patterns
+       return -1 to indicate an error.  Escape '*' or '?' with '\' to match the
+       literal character.
+    */
+    int pat_type = 0; /* 0 - no asterisk, 1 - left, 2 - right, 3 - both. */
+    int escaped = 0, escaped_count = 0, pat_len, i;
 
-#if PICOL_FEATURE_PUTS
-                if (interp->debug) {
-                    fprintf(stderr, "< %d: %s\n", interp->level,
-                            interp->current);
-                    fflush(stderr);
-                }
-#endif
-                rc = c->func(interp, argc, (const char**)argv, c->privdata);
-#if PICOL_FEATURE_PUTS
-                if (interp->debug) {
-                    if (picolList(
-                            buf,
-                            PICOL_BUFFER_SIZE(buf),
-                            argc,
-                            (const char**)argv
-                        ) != PICOL_OK) {
-                        goto err;
-                    }
-                    fprintf(
-                        stderr, "> %d: {%s} -> {%s}\n",
-                        interp->level,
-                        buf,
-                        interp->result
-                    );
-                    fflush(stderr);
-                }
-#endif
-                if (rc != PICOL_OK) {
-                    goto err;
-                }
-            }
-            /* Prepare for the next command. */
-            for (j = 0; j < argc; j++) {
-                PICOL_FREE(argv[j]);
+    /*  Validate the pattern and detect its type. */
+    for (i = 0; pat[i] != '\0'; i++) {
+        if (pat_type > 1) {
+             /* Invalid pattern: unescaped '*' in the middle. */
+            return -1;
+        }
+        if (pat[i] == '*') {
+            if (i == 0) {
+                pat_type = 1;
+            } else if (!escaped) {
+                pat_type = pat_type + 2;
             }
-            PICOL_FREE(argv);
-            argv = NULL;
-            argc = 0;
-            continue;
         }
-        /* We have a new token.  Append it to the previous or use it as a
-           new arg. */
-        if (prevtype == PICOL_PT_SEP || prevtype == PICOL_PT_EOL) {
-            if (!p.expand) {
-                argv       = PICOL_REALLOC(argv, sizeof(char*)*(argc+1));
-                argv[argc] = t;
-                argc++;
-                p.expand = 0;
-            } else if (strlen(t)) {
-                PICOL_BUFFER_CREATE(buf2, PICOL_MAX_STR);
-                const char* cp;
-                PICOL_FOREACH(buf2, PICOL_BUFFER_SIZE(buf2), cp, t) {
-                    argv       = PICOL_REALLOC(argv, sizeof(char*)*(argc+1));
-                    argv[argc] = strdup(buf2);
-                    argc++;
-                }
-                PICOL_FREE(t);
-                t = NULL;
-                p.expand = 0;
-                PICOL_BUFFER_DESTROY(buf2);
-            } else {
-                PICOL_FREE(t);
-            }
-        } else if (p.expand) {
-            /* Slice in the words separately. */
-            PICOL_BUFFER_CREATE(buf2, PICOL_MAX_STR);
-            const char* cp;
-            PICOL_FOREACH(buf2, PICOL_BUFFER_SIZE(buf2), cp, t) {
-                argv       = PICOL_REALLOC(argv, sizeof(char*)*(argc+1));
-                argv[argc] = strdup(buf2);
-                argc++;
-            }
-            PICOL_FREE(t);
-            t = NULL;
-            p.expand = 0;
-            PICOL_BUFFER_DESTROY(buf2);
+        if (!escaped && pat[i] == '\\') {
+            escaped = 1;
+            escaped_count++;
         } else {
-            /* Interpolation. */
-            size_t oldlen = strlen(argv[argc-1]), tlen2 = strlen(t);
-            argv[argc-1]  = PICOL_REALLOC(argv[argc-1], oldlen + tlen2 + 1);
-            memcpy(argv[argc-1] + oldlen, t, tlen2);
-            argv[argc-1][oldlen + tlen2] = '\0';
-            PICOL_FREE(t);
-            t = NULL;
+            escaped = 0;
         }
-        prevtype = p.type;
     }
-err:
-    for (j = 0; j < argc; j++) {
-        PICOL_FREE(argv[j]);
+    pat_len = i - escaped_count;
+
+    if (pat_type == 0) { /*   <string>   */
+        return picolWildEq(pat, str, -1);
+    } else if (pat_type == 1) { /*   *<string>   */
+        int str_len;
+        if (pat_len == 1) { /* The pattern is just "*". */
+            return 1;
+        }
+        str_len = strlen(str);
+        if (str_len < pat_len - 1) {
+            return 0;
+        }
+        return picolWildEq(pat + 1, str + str_len - (pat_len - 1), -1);
+    } else if (pat_type == 2) { /*   <string>*   */
+        return picolWildEq(pat, str, pat_len - 1);
+    } else { /* pat_type == 3,   *<string>*   */
+        int offset = 0, res = 0, str_len = strlen(str);
+        if (pat_len == 2) { /* The pattern is just "**". */
+            return 1;
+        }
+        if (str_len < pat_len - 2) {
+            return 0;
+        }
+        for (offset = 0; offset < str_len - (pat_len - 2) + 1; offset++) {
+            res |= picolWildEq(pat + 1, str + offset, pat_len - 2);
+            if (res) break;
+        }
+        return res;
     }
-    PICOL_FREE(argv);
-    PICOL_BUFFER_DESTROY(buf);
-    return rc;
 }
-picolResult picolCondition(picolInterp* interp, const char* str) {
-    if (str != NULL) {
-        PICOL_BUFFER_CREATE(substBuf, PICOL_MAX_STR);
-        PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
-        char *argv[3], *substP;
-        const char* cp;
-        int a = 0, rc;
+/* Returns 0 if the strings are equal, the index of the first differing
+   character + 1 if they are not, and -1 if there was an error. */
+int picolStrCompare(
+    const char* str1,
+    const char* str2,
+    size_t num,
+    int nocase
+) {
+    size_t i;
 
-        rc = picolSubst(interp, str);
-        if (rc != PICOL_OK) {
-            goto ret;
+    if (str1 == NULL || str2 == NULL) {
+        return -1;
+    }
+
+    for (i = 0; *str1 && *str2 && i < num; str1++, str2++, i++) {
+        char a = *str1;
+        char b = *str2;
+
+        if (nocase) {
+            a = tolower(a);
+            b = tolower(b);
         }
-        strncpy(substBuf, interp->result, PICOL_BUFFER_SIZE(substBuf));
 
-        /* Check whether the format suits [expr]. */
-        strcpy(buf, "llength");
-        if (!picolLappend(buf, PICOL_BUFFER_SIZE(buf), substBuf)) {
-            rc = picolErr(interp, PICOL_ERROR_TOO_LONG);
-            goto ret;
+        if (a != b) {
+            return i + 1;
         }
-        rc = picolEval(interp, buf);
-        if (rc != PICOL_OK) {
-            goto ret;
+    }
+
+    if (i < num && ((!*str1 && *str2) || (*str1 && !*str2))) {
+        return i;
+    }
+
+    return 0;
+}
+picolResult picolReplace(
+    char* str,
+    size_t str_size,
+    char* from,
+    char* to,
+    int nocase
+) {
+    int strLen = strlen(str);
+    int fromLen = strlen(from);
+
+    int fromIndex = 0;
+    picolStr result;
+    int bufLen = 0; /* The length of the partial match that ends here. */
+    int count = 0;
+
+    int strIndex;
+
+    picolStrInit(&result);
+    for (strIndex = 0; strIndex < strLen; strIndex++) {
+        char strC = str[strIndex];
+        char fromC = from[fromIndex];
+        int match = nocase ? toupper(strC) == toupper(fromC) : strC == fromC;
+
+        if (match) {
+            bufLen++;
+
+            fromIndex++;
+        } else {
+            /* Append the partial match and the current str character to
+               result. */
+            picolStrAppendN(&result, str + strIndex - bufLen, bufLen + 1);
+
+            fromIndex = 0;
+            bufLen = 0;
         }
+        if (fromIndex == fromLen) {
+            picolStrAppend(&result, to);
 
-        /* Three elements? */
-        if (PICOL_EQ(interp->result, "3")) {
-            PICOL_FOREACH(buf, PICOL_BUFFER_SIZE(buf), cp, substBuf) {
-                argv[a++] = strdup(buf);
-            }
+            fromIndex = 0;
+            bufLen = 0;
+            count++;
+        }
+    }
+    picolStrAppendN(&result, str + strLen - bufLen, bufLen);
 
-            /* Is there an operator in the middle? */
-            if (picolGetCmd(interp, argv[1])) {
-                /* Translate to Polish :-) */
-                /* E.g., {1 > 2} -> {> 1 2} */
-                strncpy(buf, argv[1], PICOL_BUFFER_SIZE(buf));
-                if (!picolLappend(buf, PICOL_BUFFER_SIZE(buf), argv[0])) {
-                    goto ret;
-                    rc = picolErr(interp, PICOL_ERROR_TOO_LONG);
-                }
-                if (!picolLappend(buf, PICOL_BUFFER_SIZE(buf), argv[2])) {
-                    goto ret;
-                    rc = picolErr(interp, PICOL_ERROR_TOO_LONG);
+    if (str_size > 0) {
+        strncpy(str, result.buf, str_size - 1);
+        str[str_size - 1] = '\0';
+    }
+    picolStrFree(&result);
+    return count;
+}
+void picolQuoteForShell(picolStr* dest, int argc, const char** argv) {
+    /* Append argv[1..] to dest, each argument preceded by a space and quoted
+       for the shell. */
+    int j;
+    size_t k;
+#define PICOL_ADDCHAR(s, c) \
+    do { \
+        char _c = (c); \
+        picolStrAppendN((s), &_c, 1); \
+    } while (0)
+#if PICOL_TCL_PLATFORM_PLATFORM == PICOL_TCL_PLATFORM_WINDOWS
+    /* See http://blogs.msdn.com/b/twistylittlepassagesallalike/archive/2011/
+           04/23/everyone-quotes-arguments-the-wrong-way.aspx.
+       This code is probably still wrong. */
+    int backslashes = 0;
+    int m;
+    size_t length;
+    picolStr unquoted;
+    picolStrInit(&unquoted);
+    for (j = 1; j < argc; j++) {
+        PICOL_ADDCHAR(&unquoted, ' ');
+        length = strlen(argv[j]);
+        if (strchr(argv[j], ' ') == NULL && \
+                strchr(argv[j], '\t') == NULL && \
+                strchr(argv[j], '\n') == NULL && \
+                strchr(argv[j], '\v') == NULL && \
+                strchr(argv[j], '"') == NULL) {
+            picolStrAppend(&unquoted, argv[j]);
+        } else {
+            PICOL_ADDCHAR(&unquoted, '"');
+            for (k = 0; k < length; k++) {
+                backslashes = 0;
+                while (argv[j][k] == '\\') {
+                    backslashes++;
+                    k++;
                 }
-
-                for (a = 0; a < 3; a++) {
-                    PICOL_FREE(argv[a]);
+                if (k == length) {
+                    for (m = 0; m < backslashes * 2; m++) {
+                        PICOL_ADDCHAR(&unquoted, '\\');
+                    }
+                } else if (argv[j][k] == '"') {
+                    for (m = 0; m < backslashes * 2 + 1; m++) {
+                        PICOL_ADDCHAR(&unquoted, '\\');
+                    }
+                    PICOL_ADDCHAR(&unquoted, '"');
+                } else {
+                    for (m = 0; m < backslashes; m++) {
+                        PICOL_ADDCHAR(&unquoted, '\\');
+                    }
+                    PICOL_ADDCHAR(&unquoted, argv[j][k]);
                 }
-
-                rc = picolEval(interp, buf);
-                goto ret;
             }
+            PICOL_ADDCHAR(&unquoted, '"');
         }
-
-        /* The expression is not a triple. */
-        substP = substBuf;
-        if (*substP == '!') {
-            /* Allow !$x */
-            strcpy(buf, "== 0 ");
-            substP++;
+    }
+    /* Skip the first character, which is a space. */
+    for (k = 1; k < unquoted.len; k++) {
+        PICOL_ADDCHAR(dest, '^');
+        PICOL_ADDCHAR(dest, unquoted.buf[k]);
+    }
+    picolStrFree(&unquoted);
+#else
+    /* Assume a POSIXy platform. */
+    for (j = 1; j < argc; j++) {
+        PICOL_ADDCHAR(dest, ' ');
+        PICOL_ADDCHAR(dest, '\'');
+        for (k = 0; argv[j][k] != '\0'; k++) {
+            if (argv[j][k] == '\'') {
+                picolStrAppend(dest, "'\\''");
+            } else {
+                PICOL_ADDCHAR(dest, argv[j][k]);
+            }
+        }
+        PICOL_ADDCHAR(dest, '\'');
+    }
+#endif
+#undef PICOL_ADDCHAR
+}
+/* -------------------------------------------------------------- Expressions */
+int picolExprAddNode(picolInterp* interp, picolExpr* e, int op, int a, int b,
+                     int c) {
+    /* Append a node with the operands a, b and c (-1 for none) and return its
+       index, or -1 if the tree gets too deep.  A leaf can't fail. */
+    picolExprNode* node;
+    int operands[3], depth = 0, k;
+    operands[0] = a;
+    operands[1] = b;
+    operands[2] = c;
+    for (k = 0; k < 3; k++) {
+        if (operands[k] >= 0 && e->nodes[operands[k]].depth >= depth) {
+            depth = e->nodes[operands[k]].depth + 1;
+        }
+    }
+    if (depth > PICOL_EXPR_MAX_DEPTH) {
+        picolErr(interp, "expression nested too deeply");
+        return -1;
+    }
+    if (e->count == e->size) {
+        e->size *= 2;
+        e->nodes = PICOL_REALLOC(e->nodes, sizeof(picolExprNode) * e->size);
+    }
+    node = &e->nodes[e->count];
+    node->op     = op;
+    node->a      = a;
+    node->b      = b;
+    node->c      = c;
+    node->next   = -1;
+    node->depth  = depth;
+    node->i      = 0;
+    node->text   = NULL;
+    node->obj    = NULL;
+    node->script = NULL;
+    return e->count++;
+}
+int picolExprSyntaxError(picolInterp* interp, picolExpr* e) {
+    picolErrFmt(interp, "syntax error in expression \"%s\"", e->text);
+    return -1;
+}
+char* picolExprCopy(const char* start, const char* end) {
+    /* Return the text from start to end inclusive in a new string. */
+    size_t tlen = end < start ? 0 : end - start + 1;
+    char* text = PICOL_MALLOC(tlen + 1);
+    memcpy(text, start, tlen);
+    text[tlen] = '\0';
+    return text;
+}
+int picolExprOperator(const char* s, int* len, int* prec) {
+    /* Return the binary operator s starts with, or -1 if there is none.  Set
+       *len to its length and *prec to its precedence, which is higher for the
+       operators that bind tighter. */
+    static const struct {
+        const char* name;
+        int         op;
+        int         prec;
+    } ops[] = {
+        {"**", PICOL_EX_POW,    13}, {"*",  PICOL_EX_MUL,    12},
+        {"/",  PICOL_EX_DIV,    12}, {"%",  PICOL_EX_MOD,    12},
+        {"+",  PICOL_EX_ADD,    11}, {"-",  PICOL_EX_SUB,    11},
+        {"<<", PICOL_EX_SHL,    10}, {">>", PICOL_EX_SHR,    10},
+        {"<=", PICOL_EX_LE,      9}, {">=", PICOL_EX_GE,      9},
+        {"<",  PICOL_EX_LT,      9}, {">",  PICOL_EX_GT,      9},
+        {"==", PICOL_EX_EQ,      8}, {"!=", PICOL_EX_NE,      8},
+        {"eq", PICOL_EX_STREQ,   7}, {"ne", PICOL_EX_STRNE,   7},
+        {"in", PICOL_EX_IN,      6}, {"ni", PICOL_EX_NI,      6},
+        {"&&", PICOL_EX_AND,     2}, {"&",  PICOL_EX_BITAND,  5},
+        {"^",  PICOL_EX_BITXOR,  4}, {"||", PICOL_EX_OR,      1},
+        {"|",  PICOL_EX_BITOR,   3}
+    };
+    size_t k;
+    for (k = 0; k < sizeof(ops) / sizeof(ops[0]); k++) {
+        *len = strlen(ops[k].name);
+        if (strncmp(s, ops[k].name, *len) == 0 &&
+                !(isalpha(ops[k].name[0]) && isalnum(s[*len]))) {
+            *prec = ops[k].prec;
+            return ops[k].op;
+        }
+    }
+    return -1;
+}
+int picolExprParseCall(picolInterp* interp, picolExpr* e, const char** pos,
+                       char* name, int depth) {
+    /* Parse the arguments of the function name up to the closing paren. */
+    int n = picolExprAddNode(interp, e, PICOL_EX_FUNC, -1, -1, -1), arg;
+    int last = -1;
+    e->nodes[n].text = name;
+    e->nodes[n].obj = picolNewObj(name);
+    PICOL_INCR_REF(e->nodes[n].obj);
+    while (isspace(**pos)) (*pos)++;
+    if (**pos == ')') {
+        (*pos)++;
+        return n;
+    }
+    while (1) {
+        arg = picolExprParseTernary(interp, e, pos, depth + 1);
+        if (arg < 0) {
+            return -1;
+        }
+        if (last < 0) {
+            e->nodes[n].a = arg;
         } else {
-            strcpy(buf, "!= 0 ");
+            e->nodes[last].next = arg;
         }
-        if (!picolAppend(buf, PICOL_BUFFER_SIZE(buf), substP)) {
-            rc = picolErr(interp, PICOL_ERROR_TOO_LONG);
-            goto ret;
+        last = arg;
+        if (e->nodes[arg].depth >= e->nodes[n].depth) {
+            e->nodes[n].depth = e->nodes[arg].depth + 1;
+        }
+        while (isspace(**pos)) (*pos)++;
+        if (**pos == ')') {
+            (*pos)++;
+            return n;
         }
+        if (**pos != ',') {
+            return picolExprSyntaxError(interp, e);
+        }
+        (*pos)++;
+    }
+}
+int picolExprAddWord(picolInterp* interp, picolExpr* e, picolParser* p) {
+    /* Add a node for the token p has just parsed: a variable, a command or a
+       literal, which picolCompileScript() would have turned into an op. */
+    size_t tlen = p->end < p->start ? 0 : p->end - p->start + 1;
+    char* text = PICOL_MALLOC(tlen + 1);
+    int n;
 
-        rc = picolEval(interp, buf);
-ret:
-        PICOL_BUFFER_DESTROY(substBuf);
-        PICOL_BUFFER_DESTROY(buf);
-        return rc;
+    if (p->type == PICOL_PT_STR || p->type == PICOL_PT_VAR) {
+        tlen = picolExpandLC(text, tlen, p->start);
     } else {
-        return picolErr(interp, "NULL condition");
+        memcpy(text, p->start, tlen);
+    }
+    text[tlen] = '\0';
+    if (p->type == PICOL_PT_VAR) {
+        n = picolExprAddNode(interp, e, PICOL_EX_VAR, -1, -1, -1);
+        e->nodes[n].text = text;
+    } else if (p->type == PICOL_PT_CMD) {
+        n = picolExprAddNode(interp, e, PICOL_EX_CMD, -1, -1, -1);
+        e->nodes[n].text = text;
+        e->nodes[n].script = picolCompileScript(text);
+        if (e->nodes[n].script != NULL) {
+            /* The value picolExprTail() hands the script over in. */
+            picolObj* obj = picolNewObj(text);
+            obj->type = PICOL_OBJ_SCRIPT;
+            obj->rep.script = e->nodes[n].script;
+            obj->rep.script->rc++;
+            PICOL_INCR_REF(obj);
+            e->nodes[n].obj = obj;
+            e->subst = 1;
+        }
+    } else {
+        if (p->type == PICOL_PT_ESC && strchr(text, '\\')) {
+            picolEscape(text, tlen);
+        }
+        n = picolExprAddNode(interp, e, PICOL_EX_STR, -1, -1, -1);
+        e->nodes[n].obj = picolNewObj(text);
+        PICOL_INCR_REF(e->nodes[n].obj);
+        PICOL_FREE(text);
     }
+    return n;
 }
-#if PICOL_FEATURE_IO
-picolBool picolIsDirectory(const char* path) {
-    struct stat path_stat;
-    if (stat(path, &path_stat) == 0) {
-        return S_ISDIR(path_stat.st_mode);
-    } else {
-        /* Return -2 if the path doesn't exist and -1 on other errors. */
-        return (errno == ENOENT ? -2 : -1);
+int picolExprParseQuoted(picolInterp* interp, picolExpr* e,
+                         const char** pos) {
+    /* Parse a string in double quotes into the pieces to join.  A string of
+       one piece is that piece. */
+    picolParser p;
+    int first = -1, last = -1, piece, n;
+
+    picolInitParser(&p, *pos + 1);
+    p.insidequote = 1;
+    p.type = PICOL_PT_ESC;
+    while (p.insidequote) {
+        if (picolGetToken(NULL, &p) != PICOL_OK || p.type == PICOL_PT_EOL ||
+                p.type == PICOL_PT_EOF) {
+            return picolExprSyntaxError(interp, e);
+        }
+        if (p.type == PICOL_PT_ESC && p.end < p.start && first >= 0) {
+            continue; /* the empty piece before the closing quote */
+        }
+        piece = picolExprAddWord(interp, e, &p);
+        if (first < 0) {
+            first = piece;
+        } else {
+            e->nodes[last].next = piece;
+        }
+        last = piece;
+    }
+    *pos = p.pos;
+    if (first == last) {
+        return first;
     }
+    n = picolExprAddNode(interp, e, PICOL_EX_SUBST, -1, -1, -1);
+    e->nodes[n].a = first;
+    e->nodes[n].depth = 1;
+    return n;
 }
-#endif
-int picolIsInt(const char* str) {
-    const char* cp = str;
-    int base = 10, rem = strlen(str);
-
-    if (rem == 0) return 0;
-
-    /* Allow a leading minus. */
-    if (*cp == '-') {
-        cp++; rem--;
+int picolExprParseOperand(picolInterp* interp, picolExpr* e, const char** pos,
+                          int depth) {
+    picolParser p;
+    const char* start = *pos;
+    const char* cp;
+    char* text;
+    int n, base;
+
+    picolInitParser(&p, start);
+    if (*start == '(') {
+        (*pos)++;
+        n = picolExprParseTernary(interp, e, pos, depth + 1);
+        if (n < 0) {
+            return -1;
+        }
+        while (isspace(**pos)) (*pos)++;
+        if (**pos != ')') {
+            return picolExprSyntaxError(interp, e);
+        }
+        (*pos)++;
+        return n;
+    } else if (*start == '"') {
+        return picolExprParseQuoted(interp, e, pos);
+    } else if (*start == '$') {
+        picolParseVar(&p);
+        if (p.type != PICOL_PT_VAR) {
+            return picolExprSyntaxError(interp, e);
+        }
+    } else if (*start == '[') {
+        if (picolParseCmd(&p) != PICOL_OK) {
+            return picolExprSyntaxError(interp, e);
+        }
+    } else if (*start == '{') {
+        picolParseBrace(&p);
+        if (p.end[1] != '}') {
+            return picolExprSyntaxError(interp, e);
+        }
+    } else if (isdigit(*start)) {
+        for (cp = start; isalnum(*cp) || *cp == '_' || *cp == '.'; cp++);
+        text = picolExprCopy(start, cp - 1);
+        base = picolIsInt(text);
+        if (base <= 0) {
+            picolErrFmt(interp, "expected integer but got \"%s\"", text);
+            PICOL_FREE(text);
+            return -1;
+        }
+        n = picolExprAddNode(interp, e, PICOL_EX_NUM, -1, -1, -1);
+        e->nodes[n].i = picolScanInt(text, base);
+        PICOL_FREE(text);
+        *pos = cp;
+        return n;
+    } else if (isalpha(*start) || *start == '_') {
+        /* A function call like max($a, 1). */
+        for (cp = start; isalnum(*cp) || *cp == '_' || *cp == ':'; cp++);
+        text = picolExprCopy(start, cp - 1);
+        while (isspace(*cp)) cp++;
+        if (*cp != '(') {
+            picolErrFmt(interp, "invalid bareword \"%s\"", text);
+            PICOL_FREE(text);
+            return -1;
+        }
+        *pos = cp + 1;
+        return picolExprParseCall(interp, e, pos, text, depth);
+    } else {
+        return picolExprSyntaxError(interp, e);
     }
-    if (rem == 0) return 0;
-
-    /* Parse the optional base marker. */
-    if (*cp == '0' && rem >= 2) {
-        char b = *(cp + 1);
-        if (b == 'b' || b == 'B') {
-            base = 2;
-        } else if (b == 'o' || b == 'O') {
-            base = 8;
-        } else if (b == 'x' || b == 'X') {
-            base = 16;
+    *pos = p.pos;
+    return picolExprAddWord(interp, e, &p);
+}
+int picolExprParseUnary(picolInterp* interp, picolExpr* e, const char** pos,
+                        int depth) {
+    int op, a;
+    if (depth > PICOL_EXPR_MAX_DEPTH) {
+        picolErr(interp, "expression nested too deeply");
+        return -1;
+    }
+    while (isspace(**pos)) (*pos)++;
+    switch (**pos) {
+    case '-': op = PICOL_EX_NEG;    break;
+    case '+': op = PICOL_EX_POS;    break;
+    case '!': op = PICOL_EX_NOT;    break;
+    case '~': op = PICOL_EX_BITNOT; break;
+    default:
+        return picolExprParseOperand(interp, e, pos, depth);
+    }
+    (*pos)++;
+    a = picolExprParseUnary(interp, e, pos, depth + 1);
+    return a < 0 ? -1 : picolExprAddNode(interp, e, op, a, -1, -1);
+}
+int picolExprParseBinary(picolInterp* interp, picolExpr* e, const char** pos,
+                         int minprec, int depth) {
+    /* Parse operands joined by operators of at least minprec precedence by
+       precedence climbing. */
+    int lhs = picolExprParseUnary(interp, e, pos, depth), rhs, op, len, prec;
+    int chain = 0, n;
+    while (lhs >= 0) {
+        while (isspace(**pos)) (*pos)++;
+        op = picolExprOperator(*pos, &len, &prec);
+        if (op < 0 || prec < minprec) {
+            break;
         }
-        if (base != 10) {
-            cp += 2;
+        *pos += len;
+        /* All operators but ** are left-associative. */
+        rhs = picolExprParseBinary(interp, e, pos,
+                                   op == PICOL_EX_POW ? prec : prec + 1,
+                                   depth + 1);
+        if (rhs < 0) {
+            return -1;
         }
-    }
-
-    /* Validate the number itself. */
-    for (; *cp; cp++) {
-        char c = *cp;
-        int n;
-        if (c >= 'A' && c <= 'Z') {
-            c = c - 'A' + 'a';
+        if (!chain) {
+            lhs = picolExprAddNode(interp, e, op, lhs, rhs, -1);
+            chain = 1;
+            continue;
         }
-        if (c >= '0' && c <= '9') {
-            n = c - '0';
-        } else if (c >= 'a' && c <= 'z') {
-            n = c - 'a' + 10;
-        } else {
-            return 0;
+        /* Evaluating lhs doesn't take a level of recursion. */
+        n = picolExprAddNode(interp, e, op, -1, rhs, -1);
+        if (n < 0) {
+            return -1;
         }
-        if (n >= base) {
-            return 0;
+        e->nodes[n].a = lhs;
+        e->nodes[lhs].c = n;
+        if (e->nodes[lhs].depth > e->nodes[n].depth) {
+            e->nodes[n].depth = e->nodes[lhs].depth;
         }
+        lhs = n;
     }
-
-    return base;
+    return lhs;
 }
-int picolScanInt(const char* str, int base) {
-    int sign = 1;
-    if (*str == '-') {
-        str++; sign = -1;
+int picolExprParseTernary(picolInterp* interp, picolExpr* e,
+                          const char** pos, int depth) {
+    int cond = picolExprParseBinary(interp, e, pos, 1, depth), a, b;
+    if (cond < 0) {
+        return -1;
     }
-    if (base == 10) {
-        while (*str == '0') { str++; }
-    } else {
-        str += 2;
+    while (isspace(**pos)) (*pos)++;
+    if (**pos != '?') {
+        return cond;
     }
-    return sign * strtol(str, NULL, base);
-}
-void* picolScanPtr(const char* str) {
-    void* p = NULL;
-    sscanf(str, "%p", &p);
-    return (p && strlen(str) >= 3 ? p : NULL);
-}
-void picolDropCallFrame(picolInterp* interp) {
-    picolCallFrame* cf = interp->callframe;
-    picolVar* v, *next;
-    for (v = cf->vars; v != NULL; v = next) {
-        next = v->next;
-        PICOL_FREE(v->name);
-        PICOL_FREE(v->val);
-        PICOL_FREE(v);
+    (*pos)++;
+    a = picolExprParseTernary(interp, e, pos, depth + 1);
+    if (a < 0) {
+        return -1;
     }
-    if (cf->command != NULL) {
-        PICOL_FREE(cf->command);
+    while (isspace(**pos)) (*pos)++;
+    if (**pos != ':') {
+        return picolExprSyntaxError(interp, e);
     }
-    interp->callframe = cf->parent;
-    PICOL_FREE(cf);
+    (*pos)++;
+    b = picolExprParseTernary(interp, e, pos, depth + 1);
+    if (b < 0) {
+        return -1;
+    }
+    return picolExprAddNode(interp, e, PICOL_EX_TERNARY, cond, a, b);
+}
+picolExpr* picolParseExpr(picolInterp* interp, const char* text) {
+    /* Parse text into a tree for picolExprEval().  Return NULL and leave the
+       error in the result if text isn't a valid expression. */
+    picolExpr* e = PICOL_MALLOC(sizeof(picolExpr));
+    const char* pos = text;
+
+    e->next  = NULL;
+    e->rc    = 1;
+    e->hash  = 0;
+    e->text  = strdup(text);
+    e->count = 0;
+    e->size  = 8;
+    e->subst = 0;
+    e->nodes = PICOL_MALLOC(sizeof(picolExprNode) * e->size);
+    e->root  = picolExprParseTernary(interp, e, &pos, 0);
+    if (e->root >= 0) {
+        while (isspace(*pos)) pos++;
+        if (*pos != '\0') {
+            e->root = picolExprSyntaxError(interp, e);
+        }
+    }
+    if (e->root < 0) {
+        picolFreeExpr(e);
+        return NULL;
+    }
+    return e;
 }
-picolResult picolValidPtrAdd(picolInterp* interp, int type, void* ptr) {
-    picolPtr* p = interp->validptrs;
-    while (p != NULL) {
-        /* Adding a valid pointer should be idempotent. */
-        if (p->type == type && p->ptr == ptr) {
-            return PICOL_OK;
+void picolFreeExpr(picolExpr* e) {
+    int i;
+    for (i = 0; i < e->count; i++) {
+        if (e->nodes[i].obj != NULL) {
+            picolDecrRef(e->nodes[i].obj);
         }
-        p = p->next;
+        if (e->nodes[i].script != NULL) {
+            picolReleaseScript(e->nodes[i].script);
+        }
+        PICOL_FREE(e->nodes[i].text);
     }
-
-    p = PICOL_MALLOC(sizeof(picolPtr));
-    if (p == NULL) return PICOL_ERR;
-    p->type = type;
-    p->ptr = ptr;
-    p->next = interp->validptrs;
-    interp->validptrs = p;
-
-    return PICOL_OK;
+    PICOL_FREE(e->nodes);
+    PICOL_FREE(e->text);
+    PICOL_FREE(e);
 }
-picolBool picolValidPtr(picolInterp* interp, int type, void* ptr) {
-    picolPtr* p = interp->validptrs;
-    while (p != NULL) {
-        if (p->type == type && p->ptr == ptr) {
-            return PICOL_TRUE;
-        }
-        p = p->next;
+void picolReleaseExpr(picolExpr* e) {
+    e->rc--;
+    if (e->rc == 0) {
+        picolFreeExpr(e);
     }
-    return PICOL_FALSE;
 }
-picolResult picolValidPtrRemove(picolInterp* interp, void* ptr) {
-    picolPtr *p = interp->validptrs, *prev = NULL;
-
-    while (p != NULL && p->ptr != ptr) {
-        prev = p;
-        p = p->next;
+void picolExprCacheFlush(picolInterp* interp) {
+    /* Expressions that are being evaluated survive until they finish. */
+    int i;
+    for (i = 0; i < PICOL_SCRIPT_CACHE_BUCKETS; i++) {
+        picolExpr* e, *next;
+        for (e = interp->exprs[i]; e != NULL; e = next) {
+            next = e->next;
+            e->next = NULL;
+            picolReleaseExpr(e);
+        }
+        interp->exprs[i] = NULL;
+    }
+    interp->exprcount = 0;
+}
+picolExpr* picolExprCacheGet(picolInterp* interp, const char* text) {
+    /* Return text parsed, with a reference the caller must release, or NULL
+       after leaving an error in the result.  As with scripts, only the
+       expressions seen twice in a row are kept, so that the cache doesn't
+       fill up with ones that had values substituted into them. */
+    unsigned int hash = picolHashString(text);
+    int bucket = hash % PICOL_SCRIPT_CACHE_BUCKETS;
+    picolExpr* e;
+
+    for (e = interp->exprs[bucket]; e != NULL; e = e->next) {
+        if (e->hash == hash && PICOL_EQ(e->text, text)) {
+            e->rc++;
+            return e;
+        }
+    }
+    e = picolParseExpr(interp, text);
+    if (e == NULL) {
+        return NULL;
     }
-    if (p == NULL) {
-        return PICOL_ERR;
+    if (interp->exprseen[bucket] != hash) {
+        interp->exprseen[bucket] = hash;
+        return e;
+    }
+    if (interp->exprcount >= PICOL_SCRIPT_CACHE_SIZE) {
+        picolExprCacheFlush(interp);
+    }
+    e->hash = hash;
+    e->next = interp->exprs[bucket];
+    interp->exprs[bucket] = e;
+    interp->exprcount++;
+    e->rc++;
+    return e;
+}
+void picolExprValueFree(picolExprValue* v) {
+    if (v->obj != NULL) {
+        picolDecrRef(v->obj);
+    }
+}
+int picolExprIsInt(picolInterp* interp, picolExprValue* v, int* n) {
+    /* Return true and set *n if v is an integer.  Unlike picolExprGetInt(),
+       it doesn't release v. */
+    if (v->obj == NULL) {
+        *n = v->i;
+        return 1;
+    }
+    if (v->obj->type != PICOL_OBJ_INT && picolIsInt(v->obj->str) <= 0) {
+        return 0;
+    }
+    picolGetIntFromObj(interp, v->obj, n);
+    return 1;
+}
+picolResult picolExprGetInt(picolInterp* interp, picolExprValue* v, int* n) {
+    /* Get the integer value of v and release v. */
+    picolResult rc = PICOL_OK;
+    if (v->obj == NULL) {
+        *n = v->i;
     } else {
-        if (prev == NULL) {
-            interp->validptrs = p->next;
-        } else {
-            prev->next = p->next;
-        }
-
-#if PICOL_FEATURE_ARRAYS
-        if (p->ptr && p->type == PICOL_PTR_ARRAY) {
-            picolArrDestroy(p->ptr);
-        }
-#endif
-        if (p->ptr && p->type == PICOL_PTR_INTERP) {
-            picolFreeInterp(p->ptr);
-        }
-        PICOL_FREE(p);
-        return PICOL_OK;
+        rc = picolGetIntFromObj(interp, v->obj, n);
+        picolDecrRef(v->obj);
     }
+    return rc;
 }
-picolResult picolCallProc(
-    picolInterp* interp,
-    int argc,
-    const char** argv,
-    void* pd
-) {
-    picolProc* x = pd;
-    char *alist = x->args, *body = x->body, *p = strdup(alist), *tofree;
-    PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
-    picolCallFrame* cf = PICOL_MALLOC(sizeof(picolCallFrame));
-    int a = 0, done = 0, errcode = PICOL_OK;
-
-    if (cf == NULL) {
-        fprintf(stderr, "could not allocate callframe\n");
-        PICOL_BUFFER_DESTROY(buf);
-        return PICOL_ERR;
+const char* picolExprString(picolExprValue* v, char* buf, size_t size) {
+    if (v->obj != NULL) {
+        return v->obj->str;
     }
-
-    cf->vars = NULL;
-    cf->command = NULL;
-    cf->parent = interp->callframe;
-    interp->callframe = cf;
-
-    if (interp->level > interp->maxlevel) {
-        PICOL_FREE(p);
-        picolDropCallFrame(interp);
-        PICOL_BUFFER_DESTROY(buf);
-        return picolErr(interp, "too many nested evaluations (infinite loop?)");
+    PICOL_SNPRINTF(buf, size, "%d", v->i);
+    return buf;
+}
+picolResult picolExprEvalInt(picolInterp* interp, picolExpr* e, int n,
+                             int* i) {
+    picolExprValue v;
+    picolResult rc = picolExprEval(interp, e, n, &v);
+    return rc != PICOL_OK ? rc : picolExprGetInt(interp, &v, i);
+}
+int picolExprCompare(picolInterp* interp, int op, picolExprValue* l,
+                     picolExprValue* r) {
+    /* The operators that compare numbers compare strings unless both
+       operands are integers. */
+    char lbuf[32], rbuf[32];
+    const char* ls = picolExprString(l, lbuf, sizeof(lbuf));
+    int x, y, cmp;
+
+    if (op == PICOL_EX_IN || op == PICOL_EX_NI) {
+        picolObj** elems;
+        int count, found = 0, k;
+        if (r->obj == NULL) {
+            found = PICOL_EQ(ls, picolExprString(r, rbuf, sizeof(rbuf)));
+        } else {
+            picolGetListFromObj(interp, r->obj, &count, &elems);
+            for (k = 0; k < count && !found; k++) {
+                found = PICOL_EQ(elems[k]->str, ls);
+            }
+        }
+        return op == PICOL_EX_IN ? found : !found;
     }
-    interp->level++;
-    tofree = p;
-    while (1) {
-        char* start = p;
-        while (!isspace(*p) && *p != '\0') p++;
-        if (*p != '\0' && p == start) {
-            p++;
-            continue;
+    if (op != PICOL_EX_STREQ && op != PICOL_EX_STRNE &&
+            picolExprIsInt(interp, l, &x) && picolExprIsInt(interp, r, &y)) {
+        cmp = x < y ? -1 : x > y;
+    } else {
+        cmp = strcmp(ls, picolExprString(r, rbuf, sizeof(rbuf)));
+    }
+    switch (op) {
+    case PICOL_EX_LT: return cmp < 0;
+    case PICOL_EX_GT: return cmp > 0;
+    case PICOL_EX_LE: return cmp <= 0;
+    case PICOL_EX_GE: return cmp >= 0;
+    case PICOL_EX_EQ:
+    case PICOL_EX_STREQ: return cmp == 0;
+    default: return cmp != 0;
+    }
+}
+picolResult picolExprArith(picolInterp* interp, int op, int a, int b,
+                           int* c) {
+    /* Integers wrap around and division truncates toward zero, as with the
+       math commands. */
+    unsigned int ua = a, ub = b, uc = 1;
+    switch (op) {
+    case PICOL_EX_POW:
+        if (b < 0) {
+            if (a == 0) {
+                return picolErr(interp,
+                                "exponentiation of zero by negative power");
+            }
+            *c = a == 1 ? 1 : a == -1 ? (b % 2 ? -1 : 1) : 0;
+            return PICOL_OK;
         }
-        if (p == start) {
-            break;
+        for (; b > 0; b >>= 1) {
+            if (b & 1) {
+                uc *= ua;
+            }
+            ua *= ua;
+        }
+        *c = (int)uc;
+        return PICOL_OK;
+    case PICOL_EX_DIV:
+    case PICOL_EX_MOD:
+        if (b == 0) {
+            return picolErr(interp, "divide by zero");
         }
-        if (*p == '\0') {
-            done=1;
+        if (b == -1) { /* INT_MIN / -1 overflows */
+            *c = op == PICOL_EX_DIV ? (int)(0u - ua) : 0;
         } else {
-            *p = '\0';
+            *c = op == PICOL_EX_DIV ? a / b : a % b;
         }
-        if (PICOL_EQ(start, "args") && done) {
-            int rc = picolList(
+        return PICOL_OK;
+    case PICOL_EX_SHL:
+    case PICOL_EX_SHR:
+        if (b < 0) {
+            return picolErr(interp, "negative shift argument");
+        }
+        if (op == PICOL_EX_SHR) {
+            *c = a >> (b > (int)sizeof(int)*8 - 1 ? (int)sizeof(int)*8 - 1 : b);
+        } else if (b > (int)sizeof(int)*8 - 1) {
+            char buf[80]; /* room for the message with two ints */
+            PICOL_SNPRINTF(
                 buf,
-                PICOL_BUFFER_SIZE(buf),
-                argc - a - 1,
-                argv + a + 1
+                sizeof(buf),
+                "can't shift integer left by more than %d bit(s) "
+                "(%d given)",
+                (int)(sizeof(int)*8 - 1),
+                b
             );
-            if (rc != PICOL_OK) {
-                /* TODO: Handle this error separately. */
-                goto arityerr;
-            }
-            picolSetVar(interp, start, buf);
-            a = argc-1;
-            break;
-        }
-        if (++a > argc-1) {
-            goto arityerr;
+            return picolErr(interp, buf);
+        } else {
+            *c = (int)(ua << b);
         }
-        picolSetVar(interp, start, argv[a]);
-        p++;
-        if (done) {
+        return PICOL_OK;
+    case PICOL_EX_MUL:    *c = (int)(ua * ub); break;
+    case PICOL_EX_ADD:    *c = (int)(ua + ub); break;
+    case PICOL_EX_SUB:    *c = (int)(ua - ub); break;
+    case PICOL_EX_BITAND: *c = a & b;          break;
+    case PICOL_EX_BITXOR: *c = a ^ b;          break;
+    default:              *c = a | b;          break; /* PICOL_EX_BITOR */
+    }
+    return PICOL_OK;
+}
+picolResult picolExprCall(picolInterp* interp, picolExpr* e, int n,
+                          picolExprValue* v) {
+    /* A function calls the command of the same name with the values of its
+       arguments, e.g., max($a, 1) calls [max $a 1]. */
+    picolExprNode* node = &e->nodes[n];
+    picolCmd* c = picolGetCmd(interp, node->text);
+    picolObj** objv;
+    const char** argv;
+    picolResult rc = PICOL_OK;
+    int argc = 1, halt, j, k;
+
+    if (c == NULL) {
+        return picolErrFmt(interp, "unknown math function \"%s\"", node->text);
+    }
+    for (k = node->a; k >= 0; k = e->nodes[k].next) {
+        argc++;
+    }
+    objv = PICOL_MALLOC(sizeof(picolObj*) * argc);
+    argv = PICOL_MALLOC(sizeof(char*) * argc);
+    objv[0] = node->obj;
+    PICOL_INCR_REF(objv[0]);
+    argv[0] = objv[0]->str;
+    for (j = 1, k = node->a; k >= 0; j++, k = e->nodes[k].next) {
+        picolExprValue arg;
+        rc = picolExprEval(interp, e, k, &arg);
+        if (rc != PICOL_OK) {
             break;
         }
-    }
-    PICOL_FREE(tofree);
-    if (a != argc-1) {
-        goto arityerr;
-    }
-    if (picolList(buf, PICOL_BUFFER_SIZE(buf), argc, argv) == PICOL_OK) {
-        cf->command = strdup(buf);
-        errcode     = picolEval(interp, body);
-        if (errcode == PICOL_RETURN) {
-            errcode = PICOL_OK;
+        if (arg.obj == NULL) {
+            arg.obj = picolNewIntObj(arg.i);
+            PICOL_INCR_REF(arg.obj);
         }
+        objv[j] = arg.obj;
+        argv[j] = arg.obj->str;
     }
-    /* Remove the called proc's callframe on success. */
-    picolDropCallFrame(interp);
-    interp->level--;
-    PICOL_BUFFER_DESTROY(buf);
-    return errcode;
-arityerr:
-    /* Remove the called proc's callframe on error. */
-    picolDropCallFrame(interp);
-    interp->level--;
-    PICOL_BUFFER_DESTROY(buf);
-    return picolErrFmt(interp, "wrong # args for \"%s\"", argv[0]);
-}
-picolResult picolUnsetVar(picolInterp* interp, const char* name) {
-    picolVar* v, *lastv = NULL;
-    picolCallFrame* cf;
-    int found = 0;
-#if PICOL_FEATURE_ARRAYS
-    picolArray* ap;
-    ap = picolArrFindByName(interp, name, 0, NULL, 0);
-    if (ap != NULL) {
-        /* The variable is an array. */
-        picolArrDestroy(ap);
-        picolPtr* ptr = interp->validptrs;
-        while (ptr) {
-            if (ptr->ptr == ap) {
-                ptr->ptr = NULL;
-                break;
-            } else {
-                ptr = ptr->next;
-            }
+    if (rc == PICOL_OK && !picolExprReplay(interp, v)) {
+        /* The command evaluates its own expressions. */
+        picolExprRun* run = interp->exprrun;
+        interp->exprrun = NULL;
+        rc = picolEvalCommand(interp, c, argc, argv, objv, &halt);
+        interp->exprrun = run;
+        if (rc == PICOL_OK) {
+            v->obj = interp->resultobj;
+            PICOL_INCR_REF(v->obj);
+            picolExprLog(interp->exprrun, v);
         }
     }
-#endif
-    cf = interp->callframe;
-    if (PICOL_COLONED(name)) {
-        while (cf->parent) cf = cf->parent;
-        name += 2;
-    }
-
-    for (v = cf->vars; v != NULL; lastv = v, v = v->next) {
-        if (PICOL_EQ(v->name, name)) {
-            found = 1;
-            if (lastv == NULL) {
-                cf->vars = v->next;
-            } else {
-                lastv->next = v->next;
-            }
-            PICOL_FREE(v->name);
-            PICOL_FREE(v->val);
-            PICOL_FREE(v);
-            break;
-        }
+    while (--j >= 0) {
+        picolDecrRef(objv[j]);
     }
-
-    return found ? PICOL_OK : PICOL_ERR;
+    PICOL_FREE(objv);
+    PICOL_FREE(argv);
+    return rc;
 }
-picolBool picolWildEq(const char* pat, const char* str, int n) {
-    /* Check if the first n characters of str match the pattern pat where
-       a '?' in pat matches any character. */
-    int escaped = 0;
-    for (; *pat != '\0' && *str != '\0' && n != 0; pat++, str++, n--) {
-        if (*pat == '\\') {
-            escaped = 1;
-            pat++;
+picolResult picolExprBinary(picolInterp* interp, picolExpr* e, int n,
+                            picolExprValue* l, picolExprValue* v) {
+    /* Apply the binary operator at node n to l, the value of the left
+       operand, which this releases, and the right operand. */
+    picolExprNode* node = &e->nodes[n];
+    picolExprValue r;
+    picolResult rc;
+    int a = 0, b;
+
+    v->obj = NULL;
+    v->i = 0;
+    switch (node->op) {
+    case PICOL_EX_AND:
+    case PICOL_EX_OR:
+        rc = picolExprGetInt(interp, l, &a);
+        if (rc == PICOL_OK && (node->op == PICOL_EX_AND ? a : !a)) {
+            rc = picolExprEvalInt(interp, e, node->b, &a);
+        }
+        v->i = a != 0;
+        return rc;
+    case PICOL_EX_LT: case PICOL_EX_GT: case PICOL_EX_LE: case PICOL_EX_GE:
+    case PICOL_EX_EQ: case PICOL_EX_NE: case PICOL_EX_STREQ:
+    case PICOL_EX_STRNE: case PICOL_EX_IN: case PICOL_EX_NI:
+        rc = picolExprEval(interp, e, node->b, &r);
+        if (rc == PICOL_OK) {
+            v->i = picolExprCompare(interp, node->op, l, &r);
+            picolExprValueFree(&r);
+        }
+        picolExprValueFree(l);
+        return rc;
+    default:
+        rc = picolExprGetInt(interp, l, &a);
+        if (rc == PICOL_OK) {
+            rc = picolExprEvalInt(interp, e, node->b, &b);
         }
-        if (!(*pat == *str || (!escaped && *pat == '?'))) {
-            return PICOL_FALSE;
+        if (rc == PICOL_OK) {
+            rc = picolExprArith(interp, node->op, a, b, &v->i);
         }
-        escaped = 0;
+        return rc;
     }
-    return (picolBool)(n == 0 || *pat == *str || (!escaped && *pat == '?'));
 }
-int picolMatch(const char* pat, const char* str) {
-    /* An incomplete implementation of [string match].  It only handles these
-       common special cases: <string>, *<string>, <string>* and *<string>*
-       where the string may contain '?' to match any character.  Other patterns
-       return -1 to indicate an error.  Escape '*' or '?' with '\' to match the
-       literal character.
-    */
-    int pat_type = 0; /* 0 - no asterisk, 1 - left, 2 - right, 3 - both. */
-    int escaped = 0, escaped_count = 0, pat_len, i;
+picolResult picolExprEval(picolInterp* interp, picolExpr* e, int n,
+                          picolExprValue* v) {
+    /* Evaluate the subtree at node n into *v, which the caller must release
+       with picolExprValueFree() if this returns PICOL_OK. */
+    picolExprNode* node = &e->nodes[n];
+    picolExprValue l;
+    picolResult rc;
+    picolVar* var;
+    int a;
 
-    /*  Validate the pattern and detect its type. */
-    for (i = 0; pat[i] != '\0'; i++) {
-        if (pat_type > 1) {
-             /* Invalid pattern: unescaped '*' in the middle. */
-            return -1;
+    v->obj = NULL;
+    v->i = 0;
+    switch (node->op) {
+    case PICOL_EX_NUM:
+        v->i = node->i;
+        return PICOL_OK;
+    case PICOL_EX_STR:
+        v->obj = node->obj;
+        break;
+    case PICOL_EX_VAR:
+        if (picolExprReplay(interp, v)) {
+            return PICOL_OK;
+        }
+        var = picolGetVar(interp, node->text);
+        if (var != NULL && !var->val) {
+            var = picolGetGlobalVar(interp, node->text);
+        }
+        if (var == NULL || var->obj == NULL) {
+            return picolErrFmt(
+                interp,
+                "can't read \"%s\": no such variable",
+                node->text
+            );
+        }
+        v->obj = var->obj;
+        PICOL_INCR_REF(v->obj);
+        picolExprLog(interp->exprrun, v);
+        return PICOL_OK;
+    case PICOL_EX_CMD:
+        if (picolExprReplay(interp, v)) {
+            return PICOL_OK;
         }
-        if (pat[i] == '*') {
-            if (i == 0) {
-                pat_type = 1;
-            } else if (!escaped) {
-                pat_type = pat_type + 2;
-            }
+        if (node->script != NULL && interp->exprrun != NULL) {
+            /* Stop here for picolExprTail() to evaluate the script. */
+            interp->exprrun->pending = node->obj;
+            return PICOL_EVAL_TAIL;
         }
-        if (!escaped && pat[i] == '\\') {
-            escaped = 1;
-            escaped_count++;
+        if (node->script != NULL) {
+            node->script->rc++;
+            rc = picolEvalScript(interp, node->script);
+            picolReleaseScript(node->script);
         } else {
-            escaped = 0;
+            picolExprRun* run = interp->exprrun;
+            interp->exprrun = NULL;
+            rc = picolEval(interp, node->text);
+            interp->exprrun = run;
+        }
+        if (rc != PICOL_OK) {
+            return rc;
+        }
+        v->obj = interp->resultobj;
+        PICOL_INCR_REF(v->obj);
+        picolExprLog(interp->exprrun, v);
+        return PICOL_OK;
+    case PICOL_EX_SUBST: {
+        picolStr str;
+        char buf[32];
+        picolStrInit(&str);
+        for (a = node->a; a >= 0; a = e->nodes[a].next) {
+            rc = picolExprEval(interp, e, a, &l);
+            if (rc != PICOL_OK) {
+                picolStrFree(&str);
+                return rc;
+            }
+            picolStrAppend(&str, picolExprString(&l, buf, sizeof(buf)));
+            picolExprValueFree(&l);
         }
+        v->obj = picolStrObj(&str);
+        break;
     }
-    pat_len = i - escaped_count;
-
-    if (pat_type == 0) { /*   <string>   */
-        return picolWildEq(pat, str, -1);
-    } else if (pat_type == 1) { /*   *<string>   */
-        int str_len;
-        if (pat_len == 1) { /* The pattern is just "*". */
-            return 1;
+    case PICOL_EX_FUNC:
+        return picolExprCall(interp, e, n, v);
+    case PICOL_EX_TERNARY:
+        rc = picolExprEvalInt(interp, e, node->a, &a);
+        if (rc != PICOL_OK) {
+            return rc;
         }
-        str_len = strlen(str);
-        if (str_len < pat_len - 1) {
-            return 0;
+        return picolExprEval(interp, e, a ? node->b : node->c, v);
+    case PICOL_EX_NEG:
+    case PICOL_EX_POS:
+    case PICOL_EX_NOT:
+    case PICOL_EX_BITNOT:
+        rc = picolExprEvalInt(interp, e, node->a, &a);
+        if (rc != PICOL_OK) {
+            return rc;
         }
-        return picolWildEq(pat + 1, str + str_len - (pat_len - 1), -1);
-    } else if (pat_type == 2) { /*   <string>*   */
-        return picolWildEq(pat, str, pat_len - 1);
-    } else { /* pat_type == 3,   *<string>*   */
-        int offset = 0, res = 0, str_len = strlen(str);
-        if (pat_len == 2) { /* The pattern is just "**". */
-            return 1;
+        if (node->op == PICOL_EX_NEG) {
+            v->i = (int)(0u - (unsigned int)a);
+        } else if (node->op == PICOL_EX_POS) {
+            v->i = a;
+        } else {
+            v->i = node->op == PICOL_EX_NOT ? !a : ~a;
         }
-        if (str_len < pat_len - 2) {
-            return 0;
+        return PICOL_OK;
+    default:
+        /* Go down a chain of left-associative operators like 1 + 2 + 3 to
+           where it starts and work back up without recursion. */
+        a = n;
+        while (PICOL_EX_CHAINED(e, e->nodes[a].a)) {
+            a = e->nodes[a].a;
+        }
+        rc = picolExprEval(interp, e, e->nodes[a].a, &l);
+        while (rc == PICOL_OK) {
+            rc = picolExprBinary(interp, e, a, &l, v);
+            if (a == n) {
+                break;
+            }
+            l = *v;
+            a = e->nodes[a].c;
         }
-        for (offset = 0; offset < str_len - (pat_len - 2) + 1; offset++) {
-            res |= picolWildEq(pat + 1, str + offset, pat_len - 2);
-            if (res) break;
+        return rc;
+    }
+    PICOL_INCR_REF(v->obj);
+    return PICOL_OK;
+}
+picolExpr* picolGetExprFromObj(picolInterp* interp, picolObj* obj) {
+    /* Return obj parsed or NULL after leaving an error in the result.  The
+       value keeps the parsed expression like picolGetScriptFromObj() keeps a
+       script, so a loop condition is only parsed once. */
+    picolExpr* e;
+    if (obj->type != PICOL_OBJ_EXPR) {
+        e = picolParseExpr(interp, obj->str);
+        if (e == NULL) {
+            return NULL;
         }
-        return res;
+        picolInvalidateObj(obj);
+        obj->type = PICOL_OBJ_EXPR;
+        obj->rep.expr = e;
     }
+    return obj->rep.expr;
 }
-/* Returns 0 if the strings are equal, the index of the first differing
-   character + 1 if they are not, and -1 if there was an error. */
-int picolStrCompare(
-    const char* str1,
-    const char* str2,
-    size_t num,
-    int nocase
-) {
-    size_t i;
-
-    if (str1 == NULL || str2 == NULL) {
-        return -1;
+picolExpr* picolArgExpr(picolInterp* interp, const char* arg) {
+    /* Return arg parsed, with a reference the caller must release, or NULL
+       after leaving an error in the result.  arg is likely an argument of
+       the current command with a value to keep the parsed form in; other
+       text goes through the cache. */
+    picolObj* obj = picolFindArgObj(interp, arg);
+    picolExpr* e;
+    if (obj == NULL) {
+        return picolExprCacheGet(interp, arg);
     }
-
-    for (i = 0; *str1 && *str2 && i < num; str1++, str2++, i++) {
-        char a = *str1;
-        char b = *str2;
-
-        if (nocase) {
-            a = tolower(a);
-            b = tolower(b);
-        }
-
-        if (a != b) {
-            return i + 1;
-        }
+    e = picolGetExprFromObj(interp, obj);
+    if (e != NULL) {
+        e->rc++;
     }
+    return e;
+}
+picolResult picolEvalExpr(picolInterp* interp, const char* text) {
+    /* Evaluate the expression text and make its value the result. */
+    picolExpr* e = picolArgExpr(interp, text);
+    picolExprValue v;
+    picolResult rc;
 
-    if (i < num && ((!*str1 && *str2) || (*str1 && !*str2))) {
-        return i;
+    if (e == NULL) {
+        return PICOL_ERR;
     }
-
-    return 0;
+    rc = picolExprEvalRoot(interp, e, &v);
+    picolReleaseExpr(e);
+    return picolExprSetResult(interp, NULL, rc, &v);
 }
-picolResult picolReplace(
-    char* str,
-    size_t str_size,
-    char* from,
-    char* to,
-    int nocase
+picolResult picolExprSetResult(
+    picolInterp* interp,
+    void* data,
+    picolResult rc,
+    picolExprValue* v
 ) {
-    int strLen = strlen(str);
-    int fromLen = strlen(from);
-    int toLen = strlen(to);
-
-    int fromIndex = 0;
-    char result[PICOL_MAX_STR] = "\0";
-    char buf[PICOL_MAX_STR] = "\0";
-    int resultLen = 0;
-    int bufLen = 0;
-    int count = 0;
-
-    int strIndex;
-    int j;
-
-    for (strIndex = 0; strIndex < strLen; strIndex++) {
-        char strC = str[strIndex];
-        char fromC = from[fromIndex];
-        int match = nocase ? toupper(strC) == toupper(fromC) : strC == fromC;
-
-        if (match) {
-            /* Append the current str character to buf. */
-            buf[bufLen] = strC;
-            bufLen++;
-
-            fromIndex++;
-        } else {
-            /* Append buf to result. */
-            for (j = 0; j < bufLen; j++) {
-                result[resultLen + j] = buf[j];
-            }
-            resultLen += bufLen;
-
-            /* Append the current str character to result. */
-            result[resultLen] = strC;
-            resultLen++;
-
-            fromIndex = 0;
-            bufLen = 0;
-        }
-        if (fromIndex == fromLen) {
-            /* Append to[] to result. */
-
-            for (j = 0; j < toLen; j++) {
-                result[resultLen + j] = to[j];
-                if (resultLen + j >= PICOL_MAX_STR - 1) {
-                    break;
-                }
-            }
-            resultLen += j;
-
-            fromIndex = 0;
-            bufLen = 0;
-            count++;
+    /* Make v the result.  This is the picolExprDone of [expr]. */
+    int n;
+    PICOL_UNUSED(data);
 
-            if (resultLen >= PICOL_MAX_STR - 1) {
-                break;
-            }
-        }
+    if (rc != PICOL_OK) {
+        return rc;
     }
-
-    if (resultLen < PICOL_MAX_STR - 1) {
-        for (j = 0; j < bufLen; j++) {
-            result[resultLen + j] = buf[j];
-        }
-        resultLen += bufLen;
-        result[resultLen] = '\0';
+    if (picolExprIsInt(interp, v, &n)) {
+        /* Numbers come out in decimal, e.g., 0x10 as 16. */
+        picolSetIntResult(interp, n);
     } else {
-        result[PICOL_MAX_STR - 1] = '\0';
+        picolSetResultObj(interp, v->obj);
     }
-
-    strncpy(str, result, str_size);
-    return count;
+    picolExprValueFree(v);
+    return PICOL_OK;
 }
-picolResult picolQuoteForShell(
-    char* dest,
-    size_t dest_size,
-    int argc,
-    const char** argv
+picolResult picolEvalCondition(
+    picolInterp* interp,
+    const char* str,
+    int* truth
 ) {
-    char command[PICOL_MAX_STR] = "\0";
-    int j;
-    unsigned int k;
-    unsigned int offset = 0;
-#define PICOL_ADDCHAR(c) \
+    /* Evaluate the condition of [if], [while] or [for] and set *truth to
+       whether it holds.  The result is left alone unless there is an
+       error. */
+    picolExpr* e = picolArgExpr(interp, str);
+    picolExprValue v;
+    picolResult rc;
+
+    if (e == NULL) {
+        return PICOL_ERR;
+    }
+    rc = picolExprEvalRoot(interp, e, &v);
+    picolReleaseExpr(e);
+    if (rc == PICOL_OK) {
+        rc = picolExprGetInt(interp, &v, truth);
+    }
+    return rc;
+}
+picolResult picolExprEvalRoot(
+    picolInterp* interp,
+    picolExpr* e,
+    picolExprValue* v
+) {
+    /* Evaluate all of e, nesting on the C stack for its command
+       substitutions. */
+    picolExprRun* run = interp->exprrun;
+    picolResult rc;
+    interp->exprrun = NULL;
+    rc = picolExprEval(interp, e, e->root, v);
+    interp->exprrun = run;
+    return rc;
+}
+int picolExprReplay(picolInterp* interp, picolExprValue* v) {
+    /* Take the next logged value of the expression being evaluated by
+       picolExprTail() if there is one. */
+    picolExprRun* run = interp->exprrun;
+    if (run == NULL || run->pos == run->count) {
+        return 0;
+    }
+    *v = run->log[run->pos++];
+    if (v->obj != NULL) {
+        PICOL_INCR_REF(v->obj);
+    }
+    return 1;
+}
+void picolExprLog(picolExprRun* run, picolExprValue* v) {
+    if (run == NULL) {
+        return;
+    }
+    if (run->count == run->size) {
+        run->size = run->size == 0 ? 4 : run->size * 2;
+        run->log = PICOL_REALLOC(run->log,
+                                 sizeof(picolExprValue) * run->size);
+    }
+    run->log[run->count] = *v;
+    if (v->obj != NULL) {
+        PICOL_INCR_REF(v->obj);
+    }
+    run->pos = ++run->count;
+}
+void picolExprRunFree(picolExprRun* run) {
+    int i;
+    for (i = 0; i < run->count; i++) {
+        picolExprValueFree(&run->log[i]);
+    }
+    PICOL_FREE(run->log);
+    picolReleaseExpr(run->e);
+    PICOL_FREE(run);
+}
+picolResult picolExprTail(
+    picolInterp* interp,
+    picolExpr* e,
+    picolExprDone done,
+    void* data
+) {
+    /* Evaluate e, taking over the caller's reference to it, and return what
+       done returns for the value.  When e has a command substitution, this
+       returns the script of the substitution through picolTailEvalCont()
+       instead, so that the command calling it doesn't nest on the C stack,
+       and done is called once the expression is evaluated. */
+    picolExprRun* run;
+    picolExprValue v;
+    picolResult rc;
+
+    if (!e->subst) {
+        rc = picolExprEvalRoot(interp, e, &v);
+        picolReleaseExpr(e);
+        return done(interp, data, rc, &v);
+    }
+    run = PICOL_MALLOC(sizeof(picolExprRun));
+    run->e     = e;
+    run->log   = NULL;
+    run->count = 0;
+    run->size  = 0;
+    run->done  = done;
+    run->data  = data;
+    return picolExprRunStep(interp, run);
+}
+picolResult picolExprRunStep(picolInterp* interp, picolExprRun* run) {
+    /* Evaluate run->e from the start, up to the first command substitution
+       that hasn't been evaluated yet. */
+    picolExprRun* outer = interp->exprrun;
+    picolExprDone done = run->done;
+    void* data = run->data;
+    picolExprValue v;
+    picolResult rc;
+
+    run->pos = 0;
+    interp->exprrun = run;
+    rc = picolExprEval(interp, run->e, run->e->root, &v);
+    interp->exprrun = outer;
+    if (rc == PICOL_EVAL_TAIL) {
+        return picolTailEvalCont(interp, run->pending, picolExprResume, run);
+    }
+    picolExprRunFree(run);
+    return done(interp, data, rc, &v);
+}
+picolResult picolExprResume(picolInterp* interp, void* data, picolResult rc) {
+    /* Log the value of the command substitution picolExprRunStep() stopped
+       at and go on evaluating. */
+    picolExprRun* run = data;
+    picolExprDone done = run->done;
+    void* done_data = run->data;
+    if (rc == PICOL_OK) {
+        picolExprValue v;
+        v.obj = interp->resultobj;
+        v.i = 0;
+        picolExprLog(run, &v);
+        return picolExprRunStep(interp, run);
+    }
+    picolExprRunFree(run);
+    return done(interp, done_data, rc, NULL);
+}
+/* --------------------------------------------------------------- Coroutines */
+#if PICOL_FEATURE_COROUTINES
+void picolCoroutineMain(unsigned int hi, unsigned int lo) {
+    /* The bottom of a coroutine's stack.  Returning switches to co->caller.
+       makecontext() only passes int arguments, so the pointer to the
+       coroutine comes in two halves. */
+    picolCoroutine* co = (picolCoroutine*)
+        ((((unsigned long)hi << 16) << 16) | (unsigned long)lo);
+    picolInterp* interp = co->interp;
+    int halt;
+    co->top = (char*)&halt;
+    co->rc = picolEvalCommand(
+        interp,
+        NULL,
+        co->wordc,
+        (const char**)(co->wordv + co->wordc),
+        co->wordv,
+        &halt
+    );
+    co->state = PICOL_CO_DONE;
+}
+int picolCoroutineStackFull(picolCoroutine* co) {
+    /* Check whether co, which is running, has too little stack left to nest
+       another evaluation.  The stack may grow either way. */
+    char here;
+    unsigned long a = (unsigned long)&here, b = (unsigned long)co->top;
+    return (a < b ? b - a : a - b) >
+           PICOL_COROUTINE_STACK_SIZE - PICOL_COROUTINE_STACK_RESERVE;
+}
+#define PICOL_CO_SWAP(type, field) \
     do { \
-        command[offset] = c; offset++; \
-        if (offset >= sizeof(command) - 1) {return PICOL_ERR;} \
+        type _t = interp->field; \
+        interp->field = co->field; \
+        co->field = _t; \
     } while (0)
-#if PICOL_TCL_PLATFORM_PLATFORM == PICOL_TCL_PLATFORM_WINDOWS
-    /* See http://blogs.msdn.com/b/twistylittlepassagesallalike/archive/2011/
-           04/23/everyone-quotes-arguments-the-wrong-way.aspx.
-       This code is probably still wrong. */
-    int backslashes = 0;
-    int m;
-    int length;
-    char command_unquoted[PICOL_MAX_STR] = "\0";
-    for (j = 1; j < argc; j++) {
-        PICOL_ADDCHAR(' ');
-        length = strlen(argv[j]);
-        if (strchr(argv[j], ' ') == NULL && \
-                strchr(argv[j], '\t') == NULL && \
-                strchr(argv[j], '\n') == NULL && \
-                strchr(argv[j], '\v') == NULL && \
-                strchr(argv[j], '"') == NULL) {
-            if (offset + length >= sizeof(command) - 1) {
-                return PICOL_ERR;
-            }
-            strncat(command, argv[j], sizeof(command) - strlen(argv[j]));
-            offset += length;
-        } else {
-            PICOL_ADDCHAR('"');
-            for (k = 0; k < length; k++) {
-                backslashes = 0;
-                while (argv[j][k] == '\\') {
-                    backslashes++;
-                    k++;
-                }
-                if (k == length) {
-                    for (m = 0; m < backslashes * 2; m++) {
-                        PICOL_ADDCHAR('\\');
-                    }
-                    PICOL_ADDCHAR(argv[j][k]);
-                } else if (argv[j][k] == '"') {
-                    for (m = 0; m < backslashes * 2 + 1; m++) {
-                        PICOL_ADDCHAR('\\');
-                    }
-                    PICOL_ADDCHAR('"');
-                } else {
-                    for (m = 0; m < backslashes; m++) {
-                        PICOL_ADDCHAR('\\');
-                    }
-                    PICOL_ADDCHAR(argv[j][k]);
-                }
+void picolCoroutineSwap(picolInterp* interp, picolCoroutine* co) {
+    /* Exchange the state of the side that is running with that of co. */
+    PICOL_CO_SWAP(picolCallFrame*, callframe);
+    PICOL_CO_SWAP(int, level);
+    PICOL_CO_SWAP(int, depth);
+    PICOL_CO_SWAP(int, curargc);
+    PICOL_CO_SWAP(const char**, curargv);
+    PICOL_CO_SWAP(char*, current);
+    PICOL_CO_SWAP(int, objc);
+    PICOL_CO_SWAP(picolObj**, objv);
+    PICOL_CO_SWAP(picolArena, scratch);
+}
+#undef PICOL_CO_SWAP
+picolResult picolCoroutineResume(picolInterp* interp, picolCoroutine* co) {
+    /* Run co until it yields or returns.  The value passed each way is the
+       interpreter's result. */
+    co->resumer = interp->coroutine;
+    co->state = PICOL_CO_RUNNING;
+    interp->coroutine = co;
+    picolCoroutineSwap(interp, co);
+    swapcontext(&co->caller, &co->ctx);
+    picolCoroutineSwap(interp, co);
+    interp->coroutine = co->resumer;
+    if (co->state == PICOL_CO_DONE) {
+        return co->rc;
+    }
+    co->state = PICOL_CO_SUSPENDED;
+    return PICOL_OK;
+}
+picolResult picolCoroutineRun(picolInterp* interp, picolCoroutine* co) {
+    /* Resume co and remove it when it is done or its command is gone. */
+    picolResult rc = picolCoroutineResume(interp, co);
+    picolCmd* c;
+    if (co->killed) {
+        picolCoroutineDelete(interp, co);
+    } else if (co->state == PICOL_CO_DONE) {
+        for (c = interp->commands; c != NULL; c = c->next) {
+            if (c->func == picol_Coroutine && c->privdata == co) {
+                picolRenameCmd(interp, c->name, "");
+                break;
             }
-            PICOL_ADDCHAR('"');
         }
     }
-    PICOL_ADDCHAR('\0');
-    memcpy(command_unquoted, command, offset);
-    length = offset;
-    offset = 0;
-    /* Skip the first character, which is a space. */
-    for (j = 1; j < length; j++) {
-        PICOL_ADDCHAR('^');
-        PICOL_ADDCHAR(command_unquoted[j]);
+    return rc;
+}
+void picolCoroutineDelete(picolInterp* interp, picolCoroutine* co) {
+    /* Called when the command of co is deleted.  A suspended coroutine is
+       resumed with [yield] failing, so it unwinds and frees what it holds.  If
+       it yields again anyway, it is abandoned and only its frames are freed.
+       A running coroutine is freed by its resumer. */
+    co->killed = 1;
+    if (co->state == PICOL_CO_RUNNING) {
+        return;
     }
-    PICOL_ADDCHAR('\0');
-#else
-    /* Assume a POSIXy platform. */
-    for (j = 1; j < argc; j++) {
-        PICOL_ADDCHAR(' ');
-        PICOL_ADDCHAR('\'');
-        for (k = 0; k < strlen(argv[j]); k++) {
-            if (argv[j][k] == '\'') {
-                PICOL_ADDCHAR('\'');
-                PICOL_ADDCHAR('\\');
-                PICOL_ADDCHAR('\'');
-                PICOL_ADDCHAR('\'');
-            } else {
-                PICOL_ADDCHAR(argv[j][k]);
-            }
+    if (co->state == PICOL_CO_SUSPENDED) {
+        picolCoroutineResume(interp, co);
+    }
+    if (co->state != PICOL_CO_DONE) {
+        picolCallFrame* cf = interp->callframe;
+        interp->callframe = co->callframe;
+        while (interp->callframe != co->base) {
+            picolDropCallFrame(interp);
         }
-        PICOL_ADDCHAR('\'');
+        interp->callframe = cf;
+        PICOL_FREE(co->current);
     }
-    PICOL_ADDCHAR('\0');
-#endif
-#undef PICOL_ADDCHAR
-    strncpy(dest, command, dest_size);
-    return PICOL_OK;
+    picolArenaFree(&co->scratch);
+    picolWordsFree(interp, co->wordc, co->wordv);
+    PICOL_FREE(co->stack);
+    PICOL_FREE(co);
+}
+PICOL_COMMAND(Coroutine) {
+    /* The command of the coroutine pd: resume it. */
+    picolCoroutine* co = pd;
+
+    PICOL_ARITY2(argc == 1 || argc == 2, "coroutine ?value?");
+    if (co->state == PICOL_CO_RUNNING) {
+        return picolErrFmt(
+            interp,
+            "coroutine \"%s\" is already running",
+            argv[0]
+        );
+    }
+    picolSetResult(interp, argc == 2 ? argv[1] : "");
+    return picolCoroutineRun(interp, co);
 }
+#endif /* PICOL_FEATURE_COROUTINES */
 /* ------------------------------------------- Commands in alphabetical order */
 PICOL_COMMAND(abs) {
     /* This is an example of how to wrap int functions. */
@@ -2248,43 +5617,70 @@ PICOL_COMMAND(after) {
           PICOL_TCL_PLATFORM_PLATFORM == PICOL_TCL_PLATFORM_WINDOWS */
 PICOL_COMMAND(append) {
     picolVar* v;
-    char buf[PICOL_MAX_STR] = "";
+    picolStr buf;
+    picolObj* value;
     int a, set_rc;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc > 1, "append varName ?value value ...?");
     v = picolGetVar(interp, argv[1]);
-    if (v != NULL) {
-        strncpy(buf, v->val, sizeof(buf));
+    if (v != NULL && v->val == NULL) {
+        v = picolGetGlobalVar(interp, argv[1]); /* linked with [global] */
+    }
+    if ((value = picolVarOwnObj(interp, v)) != NULL) {
+        for (a = 2; a < argc; a++) {
+            picolObjAppend(value, argv[a], 0);
+        }
+        v->val = value->str;
+        return picolSetResultObj(interp, value);
+    }
+    picolStrInit(&buf);
+    if (v != NULL && v->val != NULL) {
+        picolStrAppend(&buf, v->val);
     }
     for (a = 2; a < argc; a++) {
-        PICOL_APPEND(buf, argv[a]);
+        picolStrAppend(&buf, argv[a]);
     }
-    set_rc = picolSetVar(interp, argv[1], buf);
-    if (set_rc != PICOL_OK) {
-        return PICOL_OK;
+    value = picolStrObj(&buf);
+    PICOL_INCR_REF(value);
+    set_rc = picolSetVarObj(interp, argv[1], value, 0);
+    if (set_rc == PICOL_OK) {
+        picolSetResultObj(interp, value);
     }
-    return picolSetResult(interp, buf);
+    picolDecrRef(value);
+    return PICOL_OK;
 }
 PICOL_COMMAND(apply) {
-    picolProc procdata;
-    char buf[PICOL_MAX_STR], buf2[PICOL_MAX_STR];
-    const char* cp;
+    picolProc* procdata;
+    picolObj* lambda, **elems;
+    int count, rc;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc >= 2, "apply {argl body} ?arg ...?");
-    cp = picolListHead(argv[1], buf, sizeof(buf));
-    if (cp == NULL) {
+    lambda = picolArgObj(interp, argv[1]);
+    PICOL_INCR_REF(lambda);
+    picolGetListFromObj(interp, lambda, &count, &elems);
+    if (count == 0) {
+        picolDecrRef(lambda);
         return picolErrFmt(
             interp,
             "can't interpret \"%s\" as a lambda expression",
             argv[1]
         );
     }
-    picolListHead(cp, buf2, sizeof(buf2));
-    procdata.args = buf;
-    procdata.body = buf2;
-    return picolCallProc(interp, argc-1, argv+1, &procdata);
+    /* The body is evaluated through the parsed script cache. */
+    procdata = picolCreateProc(
+        interp,
+        elems[0]->str,
+        count > 1 ? elems[1]->str : ""
+    );
+    picolDecrRef(lambda);
+    if (procdata == NULL) {
+        return PICOL_ERR;
+    }
+    rc = picolCallProc(interp, argc-1, argv+1, procdata);
+    picolFreeProc(procdata);
+    return rc;
 }
 /* -------------------------------------------------------------- Array stuff */
 #if PICOL_FEATURE_ARRAYS
@@ -2332,9 +5728,7 @@ picolResult picolArrDestroy(picolArray* ap) {
     for (i = 0; i < PICOL_ARR_BUCKETS; i++) {
         for (v = ap->table[i]; v != NULL; v = next) {
             next = v->next;
-            PICOL_FREE(v->name);
-            PICOL_FREE(v->val);
-            PICOL_FREE(v);
+            picolFreeVar(NULL, v);
             ap->size--;
         }
         ap->table[i] = NULL;
@@ -2352,74 +5746,55 @@ picolArray* picolArrFindByName(
     char* key_dest,
     size_t key_dest_size
 ) {
-    char buf[PICOL_MAX_STR], *cp;
-    picolArray* ap;
+    /* A key_dest of strlen(name) + 1 characters holds any key. */
+    char *buf, *cp, *end = NULL;
+    picolArray* ap = NULL;
     picolVar*   v;
-    cp = strchr(name, '(');
-    if (cp == NULL) {
-        strncpy(buf, name, sizeof(buf));
-    } else {
-        strncpy(buf, name, cp - name);
-        buf[cp - name] = '\0';
+    buf = picolArenaStrdup(&interp->scratch, name);
+    cp = strchr(buf, '(');
+    if (cp != NULL) {
+        *cp = '\0';
+        end = strchr(cp + 1, ')');
     }
     v = picolGetVar(interp, buf);
     if (v == NULL) {
         if (create) {
             ap = picolArrCreate(interp, buf);
-        } else {
-            return NULL;
         }
     } else {
         ap = picolScanPtr(v->val);
     }
-    if (ap == NULL ||
+    if (ap != NULL &&
         !picolValidPtr(interp, PICOL_PTR_ARRAY, (void*)ap)) {
-        return NULL;
+        ap = NULL;
     }
-    if (key_dest != NULL) {
-        strncpy(buf, cp + 1, sizeof(buf));
-        cp = strchr(buf, ')');
-        if (cp == NULL) {
-            return NULL; /*picolErrFmt(interp, "bad array syntax %x", name);*/
+    if (ap != NULL && key_dest != NULL) {
+        if (end == NULL) {
+            ap = NULL; /*picolErrFmt(interp, "bad array syntax %x", name);*/
+        } else {
+            /* overwrite closing paren */
+            *end = '\0';
+            strncpy(key_dest, cp + 1, key_dest_size);
         }
-        /* overwrite closing paren */
-        *cp = '\0';
-        strncpy(key_dest, buf, key_dest_size);
     }
-    return ap;
-}
-picolResult picolArrGetAll(
-    picolArray* ap,
-    const char* pat,
-    char* buf,
-    size_t buf_size,
-    int mode
-) {
-    int j; size_t len = 0;
+    picolArenaRelease(&interp->scratch, buf);
+    return ap;
+}
+void picolArrGetAll(picolArray* ap, const char* pat, picolStr* s, int mode) {
+    int j;
     picolVar* v;
     for (j = 0; j < PICOL_ARR_BUCKETS; j++) {
         for (v = ap->table[j]; v != NULL; v = v->next) {
             if (picolMatch(pat, v->name) > 0) {
                 /* mode==1: array names */
-                size_t part_len = strlen(v->name);
-                if (len + part_len > buf_size) { return PICOL_ERR; }
-                len += part_len;
-
-                PICOL_LAPPEND_X(buf, v->name);
-
+                picolStrAppendElement(s, v->name);
                 if (mode==2) {
                     /* array get */
-                    size_t part_len = strlen(v->val);
-                    if (len + part_len > buf_size) { return PICOL_ERR; }
-                    len += part_len;
-
-                    PICOL_LAPPEND_X(buf, v->val);
+                    picolStrAppendElement(s, v->val);
                 }
             }
         }
     }
-
-    return PICOL_OK;
 }
 picolVar* picolArrGetKey(picolArray* ap, const char* key) {
     int hash = picolHash(key, PICOL_ARR_BUCKETS), found = 0;
@@ -2455,20 +5830,18 @@ picolResult picolArrUnset(picolArray* ap, const char* key) {
             prev->next = v->next;
         }
         ap->size--;
-        PICOL_FREE(v->name);
-        PICOL_FREE(v->val);
-        PICOL_FREE(v);
+        picolFreeVar(NULL, v);
     }
 
     return PICOL_OK;
 }
 picolResult picolArrUnsetByName(picolInterp* interp, const char* name) {
-    char buf[PICOL_MAX_STR];
-    picolArray* ap = picolArrFindByName(interp, name, 0, buf, sizeof(buf));
-    if (ap == NULL) {
-        return PICOL_ERR;
-    }
-    return picolArrUnset(ap, buf);
+    size_t size = strlen(name) + 1;
+    char* buf = picolArenaAlloc(&interp->scratch, size);
+    picolArray* ap = picolArrFindByName(interp, name, 0, buf, size);
+    picolResult rc = ap == NULL ? PICOL_ERR : picolArrUnset(ap, buf);
+    picolArenaRelease(&interp->scratch, buf);
+    return rc;
 }
 picolVar* picolArrSet(picolArray* ap, const char* key, const char* value) {
     int hash = picolHash(key, PICOL_ARR_BUCKETS);
@@ -2484,15 +5857,13 @@ picolVar* picolArrSet(picolArray* ap, const char* key, const char* value) {
         /* Create a new variable. */
         v       = PICOL_MALLOC(sizeof(*v));
         v->name = strdup(key);
-        v->val  = strdup(value);
+        v->val  = NULL;
+        v->obj  = NULL;
         v->next = ap->table[hash];
         ap->table[hash] = v;
         ap->size++;
-    } else {
-        /* Replace the value for an existing variable. */
-        PICOL_FREE(v->val);
-        v->val = strdup(value);
     }
+    picolVarSetObj(v, picolNewObj(value));
 
     return v;
 }
@@ -2501,12 +5872,12 @@ picolVar* picolArrSetByName(
     const char* name,
     const char* value
 ) {
-    char buf[PICOL_MAX_STR];
-    picolArray* ap = picolArrFindByName(interp, name, 1, buf, sizeof(buf));
-    if (ap == NULL) {
-        return NULL;
-    }
-    return picolArrSet(ap, buf, value);
+    size_t size = strlen(name) + 1;
+    char* buf = picolArenaAlloc(&interp->scratch, size);
+    picolArray* ap = picolArrFindByName(interp, name, 1, buf, size);
+    picolVar* v = ap == NULL ? NULL : picolArrSet(ap, buf, value);
+    picolArenaRelease(&interp->scratch, buf);
+    return v;
 }
 char* picolArrStat(picolArray* ap, char* buf, size_t buf_size) {
     int a, buckets=0, j, count[11], depth;
@@ -2558,8 +5929,10 @@ char* picolArrStat(picolArray* ap, char* buf, size_t buf_size) {
 PICOL_COMMAND(array) {
     picolVar*   v;
     picolArray* ap = NULL;
-    char buf[PICOL_MAX_STR] = "", buf2[PICOL_MAX_STR];
+    char buf[PICOL_MAX_STR] = "", *key, *val;
     const char* cp;
+    picolStr result;
+    size_t size;
     /* default: array size */
     int mode = 0;
     picolBool valid = PICOL_TRUE;
@@ -2602,47 +5975,47 @@ PICOL_COMMAND(array) {
             return picolErr(interp, "usage: array get|names|size a");
         }
 
-        if (picolArrGetAll(ap, pat, buf, sizeof(buf), mode) != PICOL_OK) {
-            return picolErr(interp, PICOL_ERROR_TOO_LONG);
-        }
-        picolSetResult(interp, buf);
+        picolStrInit(&result);
+        picolArrGetAll(ap, pat, &result, mode);
+        picolStrResult(interp, &result);
     } else if (PICOL_SUBCMD("set")) {
         PICOL_ARITY2(argc == 4, "array set arrayName list");
         if (v == NULL) {
             ap = picolArrCreate(interp, argv[2]);
         }
-        PICOL_FOREACH(buf, sizeof(buf), cp, argv[3]) {
-            cp = picolListHead(cp, buf2, sizeof(buf2));
+        size = PICOL_ELEMENT_SIZE(argv[3]);
+        key = PICOL_MALLOC(size);
+        val = PICOL_MALLOC(size);
+        PICOL_FOREACH(key, size, cp, argv[3]) {
+            cp = picolListHead(cp, val, size);
             if (!cp) {
+                PICOL_FREE(key);
+                PICOL_FREE(val);
                 return picolErr(interp,
                                 "list must have an even number of elements");
             }
             /* Wait until here to check if the array is valid in order to
                generate the same error message as Tcl 8.6. */
             if (!valid) {
-                int ret = PICOL_SNPRINTF(
-                    buf2,
-                    sizeof(buf2),
-                    "%s(%s)",
-                    argv[2],
-                    buf
-                );
-
-                if (ret < 0) {
-                    return picolErrFmt(
-                        interp,
-                        "can't set \"%s...\": variable isn't array",
-                        buf2
-                    );
-                }
-                return picolErrFmt(
+                picolStrInit(&result);
+                picolStrAppend(&result, argv[2]);
+                picolStrAppend(&result, "(");
+                picolStrAppend(&result, key);
+                picolStrAppend(&result, ")");
+                PICOL_FREE(key);
+                PICOL_FREE(val);
+                picolErrFmt(
                     interp,
                     "can't set \"%s\": variable isn't array",
-                    buf2
+                    result.buf
                 );
+                picolStrFree(&result);
+                return PICOL_ERR;
             }
-            picolArrSet(ap, buf, buf2);
+            picolArrSet(ap, key, val);
         }
+        PICOL_FREE(key);
+        PICOL_FREE(val);
     } else if (PICOL_SUBCMD("statistics")) {
         PICOL_ARITY2(argc == 3, "array statistics arrname");
         if (v == NULL || !valid) {
@@ -2679,54 +6052,115 @@ picolResult picolConcat(
     int argc,
     const char** argv
 ) {
-    int a; size_t len = 0;
     /* The caller is responsible for supplying a large enough buffer. */
-    buf[0] = '\0';
+    return picolCopyNew(buf, buf_size, picolConcatNew(argc, argv));
+}
+char* picolConcatNew(int argc, const char** argv) {
+    /* Return argv[1..] joined with spaces in a new string allocated with
+       PICOL_MALLOC(). */
+    picolStr s;
+    int a;
+    picolStrInit(&s);
     for (a = 1; a < argc; a++) {
-        size_t part_size = strlen(argv[a]);
-        if (len + part_size > buf_size) { return PICOL_ERR; }
-        len += part_size;
-
-        strcat(buf, argv[a]);
-
+        picolStrAppend(&s, argv[a]);
         if (*argv[a] && a < argc-1) {
-            if (len + 1 > buf_size) { return PICOL_ERR; }
-            len++;
-
-            strcat(buf, " ");
+            picolStrAppend(&s, " ");
         }
     }
-    return PICOL_OK;
+    return s.buf;
 }
 PICOL_COMMAND(concat) {
-    char buf[PICOL_MAX_STR];
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc > 0, "concat ?arg...?");
-    if (picolConcat(buf, sizeof(buf), argc, argv) != PICOL_OK) {
-        picolErr(interp, PICOL_ERROR_TOO_LONG);
-    }
-    return picolSetResult(interp, buf);
+    return picolSetResultObj(interp, picolWrapObj(picolConcatNew(argc, argv)));
+}
+#if PICOL_FEATURE_COROUTINES
+PICOL_COMMAND(coroutine) {
+    /* Create the coroutine and run it until it first yields. */
+    picolCoroutine* co;
+    picolCallFrame* base = interp->callframe;
+    PICOL_UNUSED(pd);
+
+    PICOL_ARITY2(argc >= 3, "coroutine name cmd ?arg ...?");
+    while (base->parent != NULL) {
+        base = base->parent;
+    }
+    co = PICOL_MALLOC(sizeof(picolCoroutine));
+    co->stack = PICOL_MALLOC(PICOL_COROUTINE_STACK_SIZE);
+    if (getcontext(&co->ctx) != 0) {
+        PICOL_FREE(co->stack);
+        PICOL_FREE(co);
+        return picolErr(interp, "couldn't create coroutine");
+    }
+    co->ctx.uc_stack.ss_sp   = co->stack;
+    co->ctx.uc_stack.ss_size = PICOL_COROUTINE_STACK_SIZE;
+    co->ctx.uc_link          = &co->caller;
+    makecontext(
+        &co->ctx,
+        (void (*)(void))picolCoroutineMain,
+        2,
+        (unsigned int)(((unsigned long)co >> 16) >> 16),
+        (unsigned int)((unsigned long)co & 0xffffffffUL)
+    );
+    co->interp    = interp;
+    co->state     = PICOL_CO_SUSPENDED;
+    co->killed    = 0;
+    co->rc        = PICOL_OK;
+    co->resumer   = NULL;
+    co->base      = base;
+    co->wordc     = argc - 2;
+    co->wordv     = picolWordsNew(interp, argc - 2, argv + 2);
+    /* The command runs at the global level. */
+    co->callframe = base;
+    co->level     = 0;
+    co->depth     = 0;
+    co->curargc   = 0;
+    co->curargv   = NULL;
+    co->current   = NULL;
+    co->objc      = 0;
+    co->objv      = NULL;
+    picolArenaInit(&co->scratch);
+
+    picolRenameCmd(interp, argv[1], "");
+    picolRegisterCmd(interp, argv[1], picol_Coroutine, co);
+    picolSetResult(interp, "");
+    return picolCoroutineRun(interp, co);
 }
+#endif
 PICOL_COMMAND(continue) {
     PICOL_UNUSED(pd);
 
     PICOL_ARITY(argc == 1);
     return PICOL_CONTINUE;
 }
+picolResult picolCatchDone(picolInterp* interp, void* data, picolResult rc) {
+    /* Finish [catch] for the script's rc.  data is the variable or NULL. */
+    picolObj* var = data;
+    if (var != NULL) {
+        picolResult set_rc = picolSetVar(interp, var->str, interp->result);
+        picolDecrRef(var);
+        if (set_rc != PICOL_OK) {
+            return PICOL_OK;
+        }
+    }
+    return picolSetIntResult(interp, rc);
+}
 PICOL_COMMAND(catch) {
-    int rc, set_rc;
+    picolObj* var = NULL;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc==2 || argc==3, "catch command ?varName?");
-    rc = picolEval(interp, argv[1]);
     if (argc == 3) {
-        set_rc = picolSetVar(interp, argv[2], interp->result);
-        if (set_rc != PICOL_OK) {
-            return PICOL_OK;
-        }
+        var = picolArgObj(interp, argv[2]);
+        PICOL_INCR_REF(var);
     }
-    return picolSetIntResult(interp, rc);
+    return picolTailEvalCont(
+        interp,
+        picolArgObj(interp, argv[1]),
+        picolCatchDone,
+        var
+    );
 }
 #if PICOL_FEATURE_IO
 PICOL_COMMAND(cd) {
@@ -2786,15 +6220,10 @@ PICOL_COMMAND(debug) {
 PICOL_COMMAND(eval) {
     PICOL_UNUSED(pd);
 
-    if (argc >= 2) {
-        int rc;
-        PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
-        if (picolConcat(buf, PICOL_BUFFER_SIZE(buf), argc, argv) != PICOL_OK) {
-            picolErr(interp, PICOL_ERROR_TOO_LONG);
-        }
-        rc = picolEval(interp, buf);
-        PICOL_BUFFER_DESTROY(buf);
-        return rc;
+    if (argc == 2) {
+        return picolTailEval(interp, picolArgObj(interp, argv[1]));
+    } else if (argc > 2) {
+        return picolTailEval(interp, picolWrapObj(picolConcatNew(argc, argv)));
     }
     return picolErrFmt(interp, PICOL_ERROR_ARGS_HELP, "eval arg ?arg ...?");
 }
@@ -2820,58 +6249,48 @@ PICOL_COMMAND(error) {
 #if PICOL_FEATURE_IO
 PICOL_COMMAND(exec) {
     /* This is far from the real thing, but it may be useful. */
-    char command[PICOL_MAX_STR] = "\0";
+    picolStr command, output;
     char buf[256] = "\0";
-    char output[PICOL_MAX_STR] = "\0";
     FILE* fd;
-    int length;
     int status;
-    int too_long = 0;
     PICOL_UNUSED(pd);
 
+    picolStrInit(&command);
     if (PICOL_EQ(argv[0], "rawexec")) {
         int i;
         for (i = 1; i < argc; i++) {
-            PICOL_APPEND(command, argv[i]);
+            picolStrAppend(&command, argv[i]);
             if (i < argc - 1) {
-                PICOL_APPEND(command, " ");
+                picolStrAppend(&command, " ");
             }
         }
     } else { /* exec */
-        if (PICOL_OK != picolQuoteForShell(
-                command,
-                sizeof(command),
-                argc,
-                argv
-            )) {
-            return picolErr(interp, PICOL_ERROR_TOO_LONG);
-        }
+        picolQuoteForShell(&command, argc, argv);
     }
 
-    fd = PICOL_POPEN(command, "r");
+    fd = PICOL_POPEN(command.buf, "r");
     if (fd == NULL) {
-        return picolErrFmt(interp, "couldn't execute command \"%s\"", command);
+        picolErrFmt(interp, "couldn't execute command \"%s\"", command.buf);
+        picolStrFree(&command);
+        return PICOL_ERR;
     }
+    picolStrFree(&command);
 
+    picolStrInit(&output);
     while (fgets(buf, 256, fd)) {
-        PICOL_APPEND_BREAK(output, buf, too_long);
+        picolStrAppend(&output, buf);
     }
     status = PICOL_PCLOSE(fd);
 
-    if (too_long) {
-        return picolErr(interp, PICOL_ERROR_TOO_LONG);
-    }
-
-    length = strlen(output);
-    if (length && output[length - 1] == '\r') {
-        length--;
+    if (output.len && output.buf[output.len - 1] == '\r') {
+        output.len--;
     }
-    if (length && output[length - 1] == '\n') {
-        length--;
+    if (output.len && output.buf[output.len - 1] == '\n') {
+        output.len--;
     }
-    output[length] = '\0';
+    output.buf[output.len] = '\0';
 
-    picolSetResult(interp, output);
+    picolStrResult(interp, &output);
     return status == 0 ? PICOL_OK : PICOL_ERR;
 }
 #endif
@@ -2889,54 +6308,26 @@ PICOL_COMMAND(exit) {
 }
 #endif
 PICOL_COMMAND(expr) {
-    /* Only a simple case is supported: two or more operands with the same
-    operator between them. */
-    int a, rc;
-    PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
+    /* Several arguments are joined with spaces like Tcl does. */
+    picolExpr* e;
+    char* text;
     PICOL_UNUSED(pd);
 
-    PICOL_ARITY2((argc%2)==0, "expr int1 op int2 ...");
-    if (argc==2) {
-        if (strchr(argv[1], ' ')) { /* braced expression - expand it */
-            strcpy(buf, "expr ");
-            if (!picolAppend(buf, PICOL_BUFFER_SIZE(buf), argv[1])) {
-                PICOL_BUFFER_DESTROY(buf);
-                return picolErr(interp, PICOL_ERROR_TOO_LONG);
-            }
-            rc = picolEval(interp, buf);
-            PICOL_BUFFER_DESTROY(buf);
-            return rc;
-        } else {
-            PICOL_BUFFER_DESTROY(buf);
-            return picolSetResult(interp, argv[1]); /* single scalar */
-        }
-    }
-    if (!picolAppend(buf, PICOL_BUFFER_SIZE(buf), argv[2])) {
-        /* operator first - Polish notation */
-        PICOL_BUFFER_DESTROY(buf);
-        return picolErr(interp, PICOL_ERROR_TOO_LONG);
-    }
-    if (!picolLappend(buf, PICOL_BUFFER_SIZE(buf), argv[1])) {
-        /* {a + b + c} -> {+ a b c} */
-        PICOL_BUFFER_DESTROY(buf);
-        return picolErr(interp, PICOL_ERROR_TOO_LONG);
+    PICOL_ARITY2(argc >= 2, "expr arg ?arg ...?");
+    if (argc == 2) {
+        e = picolArgExpr(interp, argv[1]);
+    } else {
+        text = picolConcatNew(argc, argv);
+        e = picolExprCacheGet(interp, text);
+        PICOL_FREE(text);
     }
-    for (a = 3; a < argc; a += 2) {
-        if (a < argc-1 && !PICOL_EQ(argv[a+1], argv[2])) {
-            PICOL_BUFFER_DESTROY(buf);
-            return picolErr(interp, "need equal operators");
-        }
-        if (!picolLappend(buf, PICOL_BUFFER_SIZE(buf), argv[a])) {
-            PICOL_BUFFER_DESTROY(buf);
-            return picolErr(interp, PICOL_ERROR_TOO_LONG);
-        }
+    if (e == NULL) {
+        return PICOL_ERR;
     }
-    rc = picolEval(interp, buf);
-    PICOL_BUFFER_DESTROY(buf);
-    return rc;
+    return picolExprTail(interp, e, picolExprSetResult, NULL);
 }
 PICOL_COMMAND(file) {
-    char buf[PICOL_MAX_STR] = "\0";
+    picolStr path;
     const char* cp;
     int a;
     PICOL_UNUSED(pd);
@@ -2948,11 +6339,12 @@ PICOL_COMMAND(file) {
         } else {
             char *mcp, *trailing;
 
-            strncpy(buf, argv[2], sizeof(buf));
-            trailing = (char*)picolStrFirstTrailing(buf, '/');
+            picolStrInit(&path);
+            picolStrAppend(&path, argv[2]);
+            trailing = (char*)picolStrFirstTrailing(path.buf, '/');
             if (trailing != NULL) *trailing = '\0';
 
-            mcp = strrchr(buf, '/');
+            mcp = strrchr(path.buf, '/');
 
             if (mcp == NULL) {
                 if (trailing == NULL) {
@@ -2963,13 +6355,14 @@ PICOL_COMMAND(file) {
             } else {
                 *mcp = '\0';
 
-                trailing = (char*)picolStrFirstTrailing(buf, '/');
+                trailing = (char*)picolStrFirstTrailing(path.buf, '/');
                 if (trailing != NULL) *trailing = '\0';
 
-                mcp = buf;
+                mcp = path.buf;
             }
 
             picolSetResult(interp, mcp);
+            picolStrFree(&path);
         }
 #if PICOL_FEATURE_IO
     } else if (PICOL_SUBCMD("delete")) {
@@ -3025,28 +6418,29 @@ PICOL_COMMAND(file) {
         }
 #endif /* PICOL_FEATURE_IO */
     } else if (PICOL_SUBCMD("join")) {
-        strncpy(buf, argv[2], sizeof(buf));
+        picolStrInit(&path);
+        picolStrAppend(&path, argv[2]);
         for (a=3; a<argc; a++) {
             if (PICOL_EQ(argv[a], "")) {
                 continue;
             }
             if (picolMatch("/*", argv[a]) || picolMatch("?:/*", argv[a])) {
-                strncpy(buf, argv[a], sizeof(buf));
-            } else {
-                if (!PICOL_EQ(buf, "") && !picolMatch("*/", buf)) {
-                    PICOL_APPEND(buf, "/");
-                }
-                PICOL_APPEND(buf, argv[a]);
+                picolStrFree(&path);
+                picolStrInit(&path);
+            } else if (path.len > 0 && path.buf[path.len - 1] != '/') {
+                picolStrAppend(&path, "/");
             }
+            picolStrAppend(&path, argv[a]);
         }
-        picolSetResult(interp, buf);
+        picolStrResult(interp, &path);
     } else if (PICOL_SUBCMD("split")) {
-        char fragment[PICOL_MAX_STR];
+        char* fragment = PICOL_MALLOC(strlen(argv[2]) + 1);
         const char* start = argv[2];
         char head = 1;
 
+        picolStrInit(&path);
         if (*start == '/') {
-            PICOL_APPEND(buf, "/");
+            picolStrAppend(&path, "/");
             while (*start == '/') start++;
 
             head = 0;
@@ -3057,10 +6451,10 @@ PICOL_COMMAND(file) {
             fragment[cp - start] = '\0';
 
             if (!head && fragment[0] == '~') {
-                PICOL_LAPPEND(buf, "./");
-                PICOL_APPEND(buf, fragment);
+                picolStrAppendElement(&path, "./");
+                picolStrAppend(&path, fragment);
             } else {
-                PICOL_LAPPEND(buf, fragment);
+                picolStrAppendElement(&path, fragment);
             }
 
             start = cp + 1;
@@ -3073,31 +6467,34 @@ PICOL_COMMAND(file) {
 
         if (strlen(start) > 0) {
             if (!head && start[0] == '~') {
-                PICOL_LAPPEND(buf, "./");
-                PICOL_APPEND(buf, start);
+                picolStrAppendElement(&path, "./");
+                picolStrAppend(&path, start);
             } else {
-                PICOL_LAPPEND(buf, start);
+                picolStrAppendElement(&path, start);
             }
         }
 
-        picolSetResult(interp, buf);
+        PICOL_FREE(fragment);
+        picolStrResult(interp, &path);
     } else if (PICOL_SUBCMD("tail")) {
         char* trailing;
 
-        strncpy(buf, argv[2], sizeof(buf));
-        trailing = (char*)picolStrFirstTrailing(buf, '/');
+        picolStrInit(&path);
+        picolStrAppend(&path, argv[2]);
+        trailing = (char*)picolStrFirstTrailing(path.buf, '/');
 
         if (trailing != NULL) *trailing = '\0';
 
-        cp = strrchr(buf, '/');
+        cp = strrchr(path.buf, '/');
 
         if (cp == NULL) {
-            cp = buf;
+            cp = path.buf;
         } else {
             cp++;
         }
 
         picolSetResult(interp, cp);
+        picolStrFree(&path);
     } else {
         return picolErr(interp,
 #if PICOL_FEATURE_IO
@@ -3162,33 +6559,151 @@ picolResult picol_FileUtil(
 }
 #endif /* PICOL_FEATURE_IO */
 PICOL_COMMAND(for) {
-    int rc;
+    picolLoop* loop;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 5, "for start test next command");
-    /* init */
-    if ((rc = picolEval(interp, argv[1])) != PICOL_OK) return rc;
+    loop = picolLoopNew();
+    loop->test = picolArgObj(interp, argv[2]);
+    loop->next = picolArgObj(interp, argv[3]);
+    loop->body = picolArgObj(interp, argv[4]);
+    PICOL_INCR_REF(loop->test);
+    PICOL_INCR_REF(loop->next);
+    PICOL_INCR_REF(loop->body);
+    /* Run start the way the step is run. */
+    loop->stepping = 1;
+    return picolTailEvalCont(
+        interp,
+        picolArgObj(interp, argv[1]),
+        picolLoopDone,
+        loop
+    );
+}
+picolLoop* picolLoopNew(void) {
+    picolLoop* loop = PICOL_MALLOC(sizeof(picolLoop));
+    loop->test       = NULL;
+    loop->next       = NULL;
+    loop->body       = NULL;
+    loop->vars       = NULL;
+    loop->varc       = 0;
+    loop->elems      = NULL;
+    loop->elemc      = 0;
+    loop->pos        = 0;
+    loop->accumulate = 0;
+    loop->stepping   = 0;
+    picolStrInit(&loop->result);
+    return loop;
+}
+void picolLoopFree(picolLoop* loop) {
+    int i;
+    if (loop->test != NULL) {
+        picolDecrRef(loop->test);
+    }
+    if (loop->next != NULL) {
+        picolDecrRef(loop->next);
+    }
+    if (loop->body != NULL) {
+        picolDecrRef(loop->body);
+    }
+    for (i = 0; i < loop->varc; i++) {
+        picolDecrRef(loop->vars[i]);
+    }
+    for (i = 0; i < loop->elemc; i++) {
+        picolDecrRef(loop->elems[i]);
+    }
+    PICOL_FREE(loop->vars);
+    PICOL_FREE(loop->elems);
+    picolStrFree(&loop->result);
+    PICOL_FREE(loop);
+}
+picolResult picolLoopFinish(picolInterp* interp, picolLoop* loop) {
+    /* End the loop with its result: the list of [lmap] or "". */
+    picolResult rc = loop->accumulate ?
+                     picolStrResult(interp, &loop->result) :
+                     picolSetResult(interp, "");
+    picolLoopFree(loop);
+    return rc;
+}
+picolResult picolLoopNext(picolInterp* interp, picolLoop* loop) {
+    /* Start the next iteration: test the condition of [for] or [while], or
+       set the variables of [foreach] or [lmap] to the next elements.  The
+       body runs after the command returns and picolLoopDone() takes it from
+       there, so a loop doesn't nest on the C stack. */
+    picolExpr* e;
+    int i;
 
-    while (1) {
-        rc = picolEval(interp, argv[4]); /* body */
-        if (rc == PICOL_BREAK) {
-            return PICOL_OK;
-        }
-        if (rc == PICOL_ERR) {
-            return rc;
+    if (loop->test != NULL) {
+        e = picolGetExprFromObj(interp, loop->test);
+        if (e == NULL) {
+            picolLoopFree(loop);
+            return PICOL_ERR;
         }
-        rc = picolEval(interp, argv[3]); /* step */
+        e->rc++;
+        return picolExprTail(interp, e, picolLoopTested, loop);
+    }
+    if (loop->pos >= loop->elemc) {
+        return picolLoopFinish(interp, loop);
+    }
+    for (i = 0; i < loop->varc; i++) {
+        /* The variables left over at the end of the list are set to "". */
+        picolObj* elem = loop->pos < loop->elemc ?
+                         loop->elems[loop->pos] : picolNewObj("");
+        picolResult rc = picolSetVarObj(interp, loop->vars[i]->str, elem, 0);
+        loop->pos++;
         if (rc != PICOL_OK) {
+            picolLoopFree(loop);
             return rc;
         }
-        rc = picolCondition(interp, argv[2]); /* condition */
+    }
+    return picolTailEvalCont(interp, loop->body, picolLoopDone, loop);
+}
+picolResult picolLoopTested(
+    picolInterp* interp,
+    void* data,
+    picolResult rc,
+    picolExprValue* v
+) {
+    /* Run the body if the condition holds. */
+    picolLoop* loop = data;
+    int truth;
+    if (rc == PICOL_OK) {
+        rc = picolExprGetInt(interp, v, &truth);
+    }
+    if (rc != PICOL_OK) {
+        picolLoopFree(loop);
+        return rc;
+    }
+    if (!truth) {
+        return picolLoopFinish(interp, loop);
+    }
+    return picolTailEvalCont(interp, loop->body, picolLoopDone, loop);
+}
+picolResult picolLoopDone(picolInterp* interp, void* data, picolResult rc) {
+    /* Go on after the body or the step of a loop has returned rc. */
+    picolLoop* loop = data;
+    if (loop->stepping) {
+        loop->stepping = 0;
         if (rc != PICOL_OK) {
+            picolLoopFree(loop);
             return rc;
         }
-        if (atoi(interp->result)==0) {
-            return picolSetResult(interp, "");
-        }
+        return picolLoopNext(interp, loop);
+    }
+    if (rc == PICOL_BREAK) {
+        return picolLoopFinish(interp, loop);
+    }
+    if (rc != PICOL_OK && rc != PICOL_CONTINUE) {
+        picolLoopFree(loop); /* an error, [return] or [tailcall] */
+        return rc;
     }
+    if (loop->accumulate && rc == PICOL_OK) {
+        picolStrAppendElement(&loop->result, interp->result);
+    }
+    if (loop->next != NULL) {
+        loop->stepping = 1;
+        return picolTailEvalCont(interp, loop->next, picolLoopDone, loop);
+    }
+    return picolLoopNext(interp, loop);
 }
 picolResult picolLmap(
     picolInterp* interp,
@@ -3197,67 +6712,54 @@ picolResult picolLmap(
     const char* body,
     int accumulate
 ) {
-    /* Only iterating over a single list is currently supported. */
-    const char* cp, *varp;
-    int rc, set_rc, done = 0;
-    PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
-    PICOL_BUFFER_CREATE(buf2, PICOL_MAX_STR);
-    PICOL_BUFFER_CREATE(result, PICOL_MAX_STR);
-
-    if (*list == '\0') {
-        rc = PICOL_OK;
-        goto ret; /* empty data list */
-    }
-    varp = picolListHead(vars, buf2, PICOL_BUFFER_SIZE(buf2));
-    cp   = picolListHead(list, buf, PICOL_BUFFER_SIZE(buf));
-    while (cp || varp) {
-        set_rc = picolSetVar(interp, buf2, buf);
-        if (set_rc != PICOL_OK) {
-            rc = set_rc;
-            goto ret;
-        }
-        varp = picolListHead(varp, buf2, PICOL_BUFFER_SIZE(buf2));
-        if (varp == NULL) { /* the end of the var list reached */
-            rc = picolEval(interp, body);
-            if (rc == PICOL_ERR) {
-                goto ret;
-            } else if (rc == PICOL_BREAK) {
-                break;
-            } else { /* rc == PICOL_OK || rc == PICOL_CONTINUE */
-                if (accumulate && rc != PICOL_CONTINUE) {
-                    if (!picolLappend(
-                            result,
-                            PICOL_BUFFER_SIZE(result),
-                            interp->result
-                        )) {
-                        rc = picolErr(interp, PICOL_ERROR_TOO_LONG);
-                        goto ret;
-                    }
-                }
-                /* cycle back to the start */
-                varp = picolListHead(vars, buf2, PICOL_BUFFER_SIZE(buf2));
+    /* Only iterating over a single list is currently supported.  The
+       command calling this must return what it does. */
+    picolObj* objs[2], **elems, **copy;
+    picolLoop* loop = picolLoopNew();
+    int count, i, j;
+
+    objs[0] = picolArgObj(interp, vars);
+    objs[1] = picolArgObj(interp, list);
+    for (i = 0; i < 2; i++) {
+        picolResult rc;
+        PICOL_INCR_REF(objs[i]);
+        rc = picolGetListFromObj(interp, objs[i], &count, &elems);
+        if (rc != PICOL_OK) {
+            picolDecrRef(objs[i]);
+            if (i == 1) {
+                picolDecrRef(objs[0]);
             }
-            done = 1;
-        } else {
-            done = 0;
-        }
-        if (cp != NULL) {
-            cp = picolListHead(cp, buf, PICOL_BUFFER_SIZE(buf));
+            picolLoopFree(loop);
+            return rc;
         }
-        if (cp == NULL && done) {
-            break;
+        /* Copy the elements in case the value changes its type. */
+        copy = PICOL_MALLOC(sizeof(picolObj*) * (count + 1));
+        for (j = 0; j < count; j++) {
+            copy[j] = elems[j];
+            PICOL_INCR_REF(copy[j]);
         }
-        if (cp == NULL) {
-            strcpy(buf, ""); /* an empty string when data list exhausted */
+        if (i == 0) {
+            loop->vars = copy;
+            loop->varc = count;
+        } else {
+            loop->elems = copy;
+            loop->elemc = count;
         }
     }
-
-    rc = picolSetResult(interp, result);
-ret:
-    PICOL_BUFFER_DESTROY(buf);
-    PICOL_BUFFER_DESTROY(buf2);
-    PICOL_BUFFER_DESTROY(result);
-    return rc;
+    picolDecrRef(objs[0]);
+    picolDecrRef(objs[1]);
+    if (loop->varc == 0) {
+        picolLoopFree(loop);
+        return picolErrFmt(
+            interp,
+            "%s varlist is empty",
+            accumulate ? "lmap" : "foreach"
+        );
+    }
+    loop->body = picolArgObj(interp, body);
+    PICOL_INCR_REF(loop->body);
+    loop->accumulate = accumulate;
+    return picolLoopNext(interp, loop);
 }
 PICOL_COMMAND(foreach) {
     PICOL_UNUSED(pd);
@@ -3270,7 +6772,8 @@ PICOL_COMMAND(format) {
     int value;
     unsigned int j = 0;
     int length = 0;
-    char buf[PICOL_MAX_STR];
+    size_t size;
+    char* buf;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 2 || argc == 3, "format formatString ?arg?");
@@ -3306,15 +6809,21 @@ PICOL_COMMAND(format) {
         PICOL_SCAN_INT(value, argv[2]);
         return picolSetFmtResult(interp, argv[1], value);
     case 's':
-        PICOL_SNPRINTF(buf, sizeof(buf), argv[1], argv[2]);
-        return picolSetResult(interp, buf);
+        /* Room for the string padded to the field width. */
+        size = strlen(argv[2]) + 1 +
+               strtoul(argv[1] + strcspn(argv[1], "123456789"), NULL, 10);
+        buf = PICOL_MALLOC(size);
+        PICOL_SNPRINTF(buf, size, argv[1], argv[2]);
+        return picolSetResultBuf(interp, buf, size);
     default:
         return picolErrFmt(interp, "bad format string \"%s\"", argv[1]);
     }
 }
 #if PICOL_FEATURE_IO
 PICOL_COMMAND(gets) {
-    char buf[PICOL_MAX_STR], *getsrc;
+    picolStr line;
+    char* getsrc;
+    int got = 0;
     FILE* fp = stdin;
     PICOL_UNUSED(pd);
 
@@ -3331,22 +6840,32 @@ PICOL_COMMAND(gets) {
         }
     }
     if (!feof(fp)) {
-        getsrc = fgets(buf, sizeof(buf), fp);
+        /* Read the line in chunks until the newline, however long it is. */
+        picolStrInit(&line);
+        do {
+            picolStrReserve(&line, PICOL_STR_INIT_SIZE);
+            getsrc = fgets(line.buf + line.len, line.cap - line.len, fp);
+            if (getsrc != NULL) {
+                got = 1;
+                line.len += strlen(getsrc);
+            }
+        } while (getsrc != NULL && line.buf[line.len - 1] != '\n');
         if (feof(fp)) {
-            buf[0] = '\0';
-        } else {
-            buf[strlen(buf) - 1] = '\0'; /* chomp the newline */
+            line.len = 0;
+        } else if (line.len > 0) {
+            line.len--; /* chomp the newline */
         }
+        line.buf[line.len] = '\0';
         if (argc == 2) {
-            picolSetResult(interp, buf);
-        } else if (getsrc) {
+            picolSetResult(interp, line.buf);
+        } else if (got) {
             int set_rc;
-            set_rc = picolSetVar(interp, argv[2], buf);
-            if (set_rc != PICOL_OK) {
-                return PICOL_OK;
+            set_rc = picolSetVar(interp, argv[2], line.buf);
+            if (set_rc == PICOL_OK) {
+                picolSetIntResult(interp, line.len);
             }
-            picolSetIntResult(interp, strlen(buf));
         }
+        picolStrFree(&line);
     }
     return PICOL_OK;
 }
@@ -3354,8 +6873,7 @@ PICOL_COMMAND(gets) {
 #if PICOL_FEATURE_GLOB
 PICOL_COMMAND(glob) {
     /* implicit -nocomplain. */
-    char buf[PICOL_MAX_STR] = "\0";
-    char file_path[PICOL_MAX_STR] = "\0";
+    picolStr result, file_path;
     char old_wd[PICOL_MAX_STR] = "\0";
     const char* new_wd = NULL;
     const char* pattern;
@@ -3389,16 +6907,18 @@ PICOL_COMMAND(glob) {
     }
 
     glob(pattern, 0, NULL, &pglob);
+    picolStrInit(&result);
     for (j = 0; j < pglob.gl_pathc; j++) {
-        file_path[0] = '\0';
+        picolStrInit(&file_path);
         if (argc == 4) {
-            PICOL_APPEND(file_path, new_wd);
+            picolStrAppend(&file_path, new_wd);
             if (append_slash) {
-                PICOL_APPEND(file_path, "/");
+                picolStrAppend(&file_path, "/");
             }
         }
-        PICOL_APPEND(file_path, pglob.gl_pathv[j]);
-        PICOL_LAPPEND(buf, file_path);
+        picolStrAppend(&file_path, pglob.gl_pathv[j]);
+        picolStrAppendElement(&result, file_path.buf);
+        picolStrFree(&file_path);
     }
     globfree(&pglob);
     /* The following two lines fix a result corruption in MinGW 20130722. */
@@ -3407,6 +6927,7 @@ PICOL_COMMAND(glob) {
 
     if (argc == 4) {
         if (chdir(old_wd)) {
+            picolStrFree(&result);
             return picolErrFmt(
                 interp,
                 "can't change directory to \"%s\"",
@@ -3415,8 +6936,7 @@ PICOL_COMMAND(glob) {
         }
     }
 
-    picolSetResult(interp, buf);
-    return PICOL_OK;
+    return picolStrResult(interp, &result);
 }
 #endif /* PICOL_FEATURE_GLOB */
 PICOL_COMMAND(global) {
@@ -3443,7 +6963,7 @@ PICOL_COMMAND(global) {
     return PICOL_OK;
 }
 PICOL_COMMAND(if) {
-    int rc, i;
+    int i;
     int last = argc - 1;
     PICOL_UNUSED(pd);
 
@@ -3480,28 +7000,104 @@ PICOL_COMMAND(if) {
         }
     }
 
-    /* Evaluate the conditional. */
-    if ((rc = picolCondition(interp, argv[1])) != PICOL_OK) {
-        return rc;
-    }
-    if (atoi(interp->result)) {
-        return picolEval(interp, argv[2]);
-    } else {
-        for (i = 3; i < argc; i += 3) {
-            if (PICOL_EQ(argv[i], "elseif")) {
-                if ((rc = picolCondition(interp, argv[i + 1])) != PICOL_OK) {
-                    return rc;
-                }
-                if (atoi(interp->result)) {
-                    return picolEval(interp, argv[i + 2]);
+    return picolIfClauses(interp, argc, argv, 1, NULL);
+}
+picolResult picolIfClauses(
+    picolInterp* interp,
+    int argc,
+    const char** argv,
+    int i,
+    picolIf* st
+) {
+    /* Evaluate the clauses of [if] from the condition argv[i] on.  A
+       condition with a command substitution is left to picolExprTail(), and
+       st keeps the arguments until it is done; st is made the first time it
+       is needed and freed here. */
+    picolResult rc = PICOL_OK;
+    picolExprValue v;
+    picolExpr* e;
+    int truth;
+
+    for (; i < argc; i += 3) {
+        if (i > 1 && PICOL_EQ(argv[i - 1], "else")) {
+            break;
+        }
+        e = picolArgExpr(interp, argv[i]);
+        if (e == NULL) {
+            rc = PICOL_ERR;
+            goto ret;
+        }
+        if (e->subst) {
+            if (st == NULL) {
+                int j;
+                st = PICOL_MALLOC(sizeof(picolIf));
+                st->argc = argc;
+                st->objv = PICOL_MALLOC(sizeof(picolObj*) * argc);
+                st->argv = PICOL_MALLOC(sizeof(char*) * argc);
+                for (j = 0; j < argc; j++) {
+                    st->objv[j] = picolArgObj(interp, argv[j]);
+                    PICOL_INCR_REF(st->objv[j]);
+                    st->argv[j] = st->objv[j]->str;
                 }
-             } else { /* argv[i] is "else" */
-                return picolEval(interp, argv[i + 1]);
             }
+            st->i = i;
+            return picolExprTail(interp, e, picolIfTested, st);
+        }
+        rc = picolExprEvalRoot(interp, e, &v);
+        picolReleaseExpr(e);
+        if (rc == PICOL_OK) {
+            rc = picolExprGetInt(interp, &v, &truth);
+        }
+        if (rc != PICOL_OK) {
+            goto ret;
+        }
+        if (truth) {
+            i++;
+            break;
         }
     }
-
-    return picolSetResult(interp, "");
+    if (i < argc) {
+        rc = picolTailEval(interp, picolArgObj(interp, argv[i]));
+    } else {
+        rc = picolSetResult(interp, "");
+    }
+ret:
+    if (st != NULL) {
+        picolIfFree(st);
+    }
+    return rc;
+}
+picolResult picolIfTested(
+    picolInterp* interp,
+    void* data,
+    picolResult rc,
+    picolExprValue* v
+) {
+    /* Go on with the clauses of [if] from the condition st->i. */
+    picolIf* st = data;
+    int truth;
+    if (rc == PICOL_OK) {
+        rc = picolExprGetInt(interp, v, &truth);
+    }
+    if (rc != PICOL_OK) {
+        picolIfFree(st);
+        return rc;
+    }
+    if (truth) {
+        rc = picolTailEval(interp, picolArgObj(interp, st->argv[st->i + 1]));
+        picolIfFree(st);
+        return rc;
+    }
+    return picolIfClauses(interp, st->argc, st->argv, st->i + 3, st);
+}
+void picolIfFree(picolIf* st) {
+    int j;
+    for (j = 0; j < st->argc; j++) {
+        picolDecrRef(st->objv[j]);
+    }
+    PICOL_FREE(st->objv);
+    PICOL_FREE(st->argv);
+    PICOL_FREE(st);
 }
 picolResult picol_InNi(
     picolInterp* interp,
@@ -3509,17 +7105,20 @@ picolResult picol_InNi(
     const char** argv,
     void* pd
 ) {
-    char buf[PICOL_MAX_STR];
-    const char* cp;
+    picolObj* list, **elems;
+    int count, i, found = 0;
     int in = PICOL_EQ(argv[0], "in");
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 3, "in|ni element list");
-    PICOL_FOREACH(buf, sizeof(buf), cp, argv[2])
-    if (PICOL_EQ(buf, argv[1])) {
-        return picolSetBoolResult(interp, in);
+    list = picolArgObj(interp, argv[2]);
+    PICOL_INCR_REF(list);
+    picolGetListFromObj(interp, list, &count, &elems);
+    for (i = 0; i < count && !found; i++) {
+        found = PICOL_EQ(elems[i]->str, argv[1]);
     }
-    return picolSetBoolResult(interp, !in);
+    picolDecrRef(list);
+    return picolSetBoolResult(interp, found ? in : !in);
 }
 PICOL_COMMAND(incr) {
     int value = 0, increment = 1;
@@ -3531,8 +7130,9 @@ PICOL_COMMAND(incr) {
     if (v && !v->val) {
         v = picolGetGlobalVar(interp, argv[1]);
     }
-    if (v != NULL) {
-        PICOL_SCAN_INT(value, v->val); /* creates if nonexistent */
+    if (v != NULL && v->obj != NULL &&
+            picolGetIntFromObj(interp, v->obj, &value) != PICOL_OK) {
+        return PICOL_ERR; /* creates if nonexistent */
     }
     if (argc == 3) {
         PICOL_SCAN_INT(increment, argv[2]);
@@ -3541,15 +7141,15 @@ PICOL_COMMAND(incr) {
     return picolSetIntResult(interp, value);
 }
 PICOL_COMMAND(info) {
-    char buf[PICOL_MAX_STR] = "";
+    picolStr buf;
     const char* pat = "*";
     picolCmd* c = interp->commands;
     int procs;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 2 || argc == 3,
-            "info args|body|commands|exists|globals|level|patchlevel|procs|"
-            "script|vars");
+            "info args|body|commands|coroutine|exists|globals|level|"
+            "patchlevel|procs|script|vars");
     procs = PICOL_SUBCMD("procs");
     if (argc == 3) {
         pat = argv[2];
@@ -3557,44 +7157,58 @@ PICOL_COMMAND(info) {
     if (PICOL_SUBCMD("vars") || PICOL_SUBCMD("globals")) {
         picolCallFrame* cf = interp->callframe;
         picolVar*       v;
+        int             i;
         if (PICOL_SUBCMD("globals")) {
             while (cf->parent) cf = cf->parent;
         }
-        for (v = cf->vars; v; v = v->next) {
-            if (picolMatch(pat, v->name) > 0) {
-                PICOL_LAPPEND(buf, v->name);
+        picolStrInit(&buf);
+        for (i = 0; i < PICOL_FRAME_BUCKETS(cf); i++) {
+            for (v = PICOL_FRAME_BUCKET(cf, i); v; v = v->next) {
+                if (picolMatch(pat, v->name) > 0) {
+                    picolStrAppendElement(&buf, v->name);
+                }
             }
         }
-        picolSetResult(interp, buf);
+        picolStrResult(interp, &buf);
     } else if (PICOL_SUBCMD("args") || PICOL_SUBCMD("body")) {
         if (argc==2) {
             return picolErrFmt(interp, "usage: info %s procname", argv[1]);
         }
-        for (; c; c = c->next) {
-            if (PICOL_EQ(c->name, argv[2])) {
-                picolProc* procdata = c->privdata;
-                if (procdata != NULL) {
-                    return picolSetResult(
-                        interp,
-                        PICOL_EQ(argv[1], "args")
-                            ? procdata->args
-                            : procdata->body
-                    );
-                } else {
-                    return picolErrFmt(
-                        interp,
-                        "\"%s\" isn't a procedure",
-                        c->name
-                    );
-                }
+        c = picolGetCmd(interp, argv[2]);
+        if (c != NULL) {
+            picolProc* procdata = c->privdata;
+            if (procdata != NULL) {
+                return picolSetResult(
+                    interp,
+                    PICOL_EQ(argv[1], "args")
+                        ? procdata->args
+                        : procdata->body
+                );
+            } else {
+                return picolErrFmt(
+                    interp,
+                    "\"%s\" isn't a procedure",
+                    c->name
+                );
             }
         }
     } else if (PICOL_SUBCMD("commands") || procs) {
+        picolStrInit(&buf);
         for (; c; c = c->next)
             if ((!procs||c->isproc) && (picolMatch(pat, c->name) > 0)) {
-                PICOL_LAPPEND(buf, c->name);
+                picolStrAppendElement(&buf, c->name);
+            }
+        picolStrResult(interp, &buf);
+    } else if (PICOL_SUBCMD("coroutine")) {
+        /* The name of the running coroutine's command or "". */
+#if PICOL_FEATURE_COROUTINES
+        for (; c; c = c->next) {
+            if (c->func == picol_Coroutine && c->privdata == interp->coroutine) {
+                picolSetResult(interp, c->name);
+                break;
             }
-        picolSetResult(interp, buf);
+        }
+#endif
     } else if (PICOL_SUBCMD("exists")) {
         if (argc != 3) {
             return picolErr(interp, "usage: info exists varName");
@@ -3608,7 +7222,7 @@ PICOL_COMMAND(info) {
             PICOL_SCAN_INT(level, argv[2]);
             if (level == 0) {
                 if (interp->callframe == NULL ||
-                    interp->callframe->command == NULL) {
+                    picolFrameCommand(interp->callframe) == NULL) {
                     return picolErrFmt(interp, "bad level \"%s\"", argv[2]);
                 }
                 picolSetResult(interp, interp->callframe->command);
@@ -3627,8 +7241,8 @@ PICOL_COMMAND(info) {
         return picolErrFmt(
             interp,
             "bad option \"%s\": must be args, body, commands, "
-            "exists, globals, level, patchlevel, procs, script, "
-            "or vars",
+            "coroutine, exists, globals, level, patchlevel, procs, "
+            "script, or vars",
             argv[1]
         );
     }
@@ -3640,7 +7254,10 @@ PICOL_COMMAND(interp) {
     PICOL_UNUSED(pd);
 
     if (argc < 2) {
-        return picolErr(interp, "usage: interp alias|create|eval ...");
+        return picolErr(
+            interp,
+            "usage: interp alias|create|eval|recursionlimit ..."
+        );
     } else if (PICOL_SUBCMD("alias")) {
         picolCmd* c = NULL;
         PICOL_ARITY2(
@@ -3698,10 +7315,38 @@ PICOL_COMMAND(interp) {
         rc = picolEval(trg, argv[3]);
         picolSetResult(interp, trg->result);
         return rc;
+    } else if (PICOL_SUBCMD("recursionlimit")) {
+        int limit;
+        PICOL_ARITY2(
+            argc == 3 || argc == 4,
+            "interp recursionlimit path ?newlimit?"
+        );
+        if (!PICOL_EQ(argv[2], "")) {
+            PICOL_SCAN_PTR(trg, argv[2]);
+            if (!picolValidPtr(interp, PICOL_PTR_INTERP, (void*)trg)) {
+                return picolErrFmt(
+                    interp,
+                    "could not find interpreter \"%s\"",
+                    argv[2]
+                );
+            }
+        }
+        if (argc == 4) {
+            PICOL_SCAN_INT(limit, argv[3]);
+            if (limit <= 0) {
+                return picolErr(
+                    interp,
+                    "recursion limit must be > 0"
+                );
+            }
+            trg->maxlevel = limit;
+        }
+        return picolSetIntResult(interp, trg->maxlevel);
     } else {
         return picolErrFmt(
             interp,
-            "bad option \"%s\": must be alias, create or eval",
+            "bad option \"%s\": must be alias, create, eval or "
+            "recursionlimit",
             argv[1]
         );
     }
@@ -3709,80 +7354,103 @@ PICOL_COMMAND(interp) {
 }
 #endif /* PICOL_FEATURE_INTERP */
 PICOL_COMMAND(join) {
-    char buf[PICOL_MAX_STR] = "", buf2[PICOL_MAX_STR]="";
+    picolStr result;
     const char* with = " ", *cp;
-    char *cp2 = NULL;
+    size_t size;
+    char* buf;
+    int first = 1;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 2 || argc == 3, "join list ?joinString?");
     if (argc == 3) {
         with = argv[2];
     }
-    for (
-        cp = picolListHead(argv[1], buf, sizeof(buf));
-        cp;
-        cp = picolListHead(cp, buf, sizeof(buf))
-    ) {
-        PICOL_APPEND(buf2, buf);
-        cp2 = buf2 + strlen(buf2);
-        if (*with) {
-            PICOL_APPEND(buf2, with);
+    size = PICOL_ELEMENT_SIZE(argv[1]);
+    buf = PICOL_MALLOC(size);
+    picolStrInit(&result);
+    PICOL_FOREACH(buf, size, cp, argv[1]) {
+        if (!first) {
+            picolStrAppend(&result, with);
         }
+        picolStrAppend(&result, buf);
+        first = 0;
     }
-    if (cp2) {
-        *cp2 = '\0'; /* remove the last separator */
-    }
-    return picolSetResult(interp, buf2);
+    PICOL_FREE(buf);
+    return picolStrResult(interp, &result);
 }
 PICOL_COMMAND(lappend) {
-    char buf[PICOL_MAX_STR] = "";
+    picolStr buf;
+    picolObj* value;
     int a, set_rc;
     picolVar* v;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc >= 2, "lappend varName ?value value ...?");
-    if ((v = picolGetVar(interp, argv[1]))) {
-        strncpy(buf, v->val, sizeof(buf));
+    v = picolGetVar(interp, argv[1]);
+    if (v != NULL && v->val == NULL) {
+        v = picolGetGlobalVar(interp, argv[1]); /* linked with [global] */
+    }
+    if ((value = picolVarOwnObj(interp, v)) != NULL) {
+        for (a = 2; a < argc; a++) {
+            picolObjAppend(value, argv[a], 1);
+        }
+        v->val = value->str;
+        return picolSetResultObj(interp, value);
+    }
+    picolStrInit(&buf);
+    if (v != NULL && v->val != NULL) {
+        picolStrAppend(&buf, v->val);
     }
     for (a = 2; a < argc; a++) {
-        PICOL_LAPPEND(buf, argv[a]);
+        picolStrAppendElement(&buf, argv[a]);
     }
-    set_rc = picolSetVar(interp, argv[1], buf);
-    if (set_rc != PICOL_OK) {
-        return PICOL_OK;
+    value = picolStrObj(&buf);
+    PICOL_INCR_REF(value);
+    set_rc = picolSetVarObj(interp, argv[1], value, 0);
+    if (set_rc == PICOL_OK) {
+        picolSetResultObj(interp, value);
     }
-    return picolSetResult(interp, buf);
+    picolDecrRef(value);
+    return PICOL_OK;
 }
 PICOL_COMMAND(lassign) {
-    char result[PICOL_MAX_STR] = "", element[PICOL_MAX_STR];
+    picolStr result;
+    char* element;
     const char* cp;
+    size_t size;
     int i = 2, set_rc;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc >= 2, "lassign list ?varName ...?");
-    PICOL_FOREACH(element, sizeof(element), cp, argv[1]) {
+    size = PICOL_ELEMENT_SIZE(argv[1]);
+    element = PICOL_MALLOC(size);
+    picolStrInit(&result);
+    PICOL_FOREACH(element, size, cp, argv[1]) {
         if (i < argc) {
             set_rc = picolSetVar(interp, argv[i], element);
             if (set_rc != PICOL_OK) {
+                PICOL_FREE(element);
+                picolStrFree(&result);
                 return set_rc;
             }
         } else {
-            PICOL_LAPPEND(result, element);
+            picolStrAppendElement(&result, element);
         }
         i++;
     }
+    PICOL_FREE(element);
     for (; i < argc; i++) {
         set_rc = picolSetVar(interp, argv[i], "");
         if (set_rc != PICOL_OK) {
+            picolStrFree(&result);
             return set_rc;
         }
     }
-    return picolSetResult(interp, result);
+    return picolStrResult(interp, &result);
 }
 PICOL_COMMAND(lindex) {
-    char buf[PICOL_MAX_STR] = "";
-    const char* cp;
-    int n = 0, idx;
+    picolObj* list, **elems;
+    int count, idx;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2((argc == 2) || (argc == 3), "lindex list [index]");
@@ -3798,74 +7466,74 @@ PICOL_COMMAND(lindex) {
             return picolSetResult(interp, "");
         }
     }
-    for (
-        cp = picolListHead(argv[1], buf, sizeof(buf));
-        cp;
-        cp = picolListHead(cp, buf, sizeof(buf)), n++
-    ) {
-        if (n == idx) {
-            return picolSetResult(interp, buf);
-        }
-    }
+    list = picolArgObj(interp, argv[1]);
+    PICOL_INCR_REF(list);
+    picolGetListFromObj(interp, list, &count, &elems);
     if (idx == -1) {
-        return picolSetResult(interp, buf);
+        picolSetResultObj(
+            interp,
+            count > 0 ? elems[count - 1] : picolNewObj("")
+        );
+    } else if (idx < count) {
+        picolSetResultObj(interp, elems[idx]);
     }
+    picolDecrRef(list);
     return PICOL_OK;
 }
 PICOL_COMMAND(linsert) {
-    char buf[PICOL_MAX_STR] = "", buf2[PICOL_MAX_STR]="";
-    const char* cp;
-    int pos = -1, j=0, a, atend=0;
-    int inserted = 0;
+    picolObj* list, **elems, **result;
+    int count, pos = -1, i, n = 0;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc >= 3, "linsert list index element ?element ...?");
     if (!PICOL_EQ(argv[2], "end")) {
         PICOL_SCAN_INT(pos, argv[2]);
-    } else {
-        atend = 1;
     }
-    PICOL_FOREACH(buf, sizeof(buf), cp, argv[1]) {
-        if (!inserted && !atend && pos==j) {
-            for (a=3; a < argc; a++) {
-                PICOL_LAPPEND(buf2, argv[a]);
-                inserted = 1;
-            }
-        }
-        PICOL_LAPPEND(buf2, buf);
-        j++;
+    list = picolArgObj(interp, argv[1]);
+    PICOL_INCR_REF(list);
+    picolGetListFromObj(interp, list, &count, &elems);
+    if (pos < 0 || pos > count) {
+        pos = count;
+    }
+    result = PICOL_MALLOC(sizeof(picolObj*) * (count + argc - 3));
+    for (i = 0; i < pos; i++) {
+        result[n++] = elems[i];
+    }
+    for (i = 3; i < argc; i++) {
+        result[n] = picolArgObj(interp, argv[i]);
+        PICOL_INCR_REF(result[n]);
+        n++;
     }
-    if (!inserted) {
-        atend = 1;
+    for (i = pos; i < count; i++) {
+        result[n++] = elems[i];
     }
-    if (atend) {
-        for (a=3; a<argc; a++) {
-            PICOL_LAPPEND(buf2, argv[a]);
-        }
+    picolSetResultObj(interp, picolNewListObj(n, result));
+    for (i = 3; i < argc; i++) {
+        picolDecrRef(result[pos + i - 3]);
     }
-    return picolSetResult(interp, buf2);
+    PICOL_FREE(result);
+    picolDecrRef(list);
+    return PICOL_OK;
 }
 PICOL_COMMAND(list) {
     /* usage: list ?value ...? */
-    char buf[PICOL_MAX_STR] = "";
-    int a;
     PICOL_UNUSED(pd);
 
-    for (a=1; a<argc; a++) {
-        PICOL_LAPPEND(buf, argv[a]);
-    }
-    return picolSetResult(interp, buf);
+    return picolSetResultObj(
+        interp,
+        picolWrapObj(picolListNew(argc-1, argv+1))
+    );
 }
 PICOL_COMMAND(llength) {
-    char buf[PICOL_MAX_STR];
-    const char* cp;
-    int n = 0;
+    picolObj* list, **elems;
+    int n;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 2, "llength list");
-    PICOL_FOREACH(buf, sizeof(buf), cp, argv[1]) {
-        n++;
-    }
+    list = picolArgObj(interp, argv[1]);
+    PICOL_INCR_REF(list);
+    picolGetListFromObj(interp, list, &n, &elems);
+    picolDecrRef(list);
     return picolSetIntResult(interp, n);
 }
 PICOL_COMMAND(lmap) {
@@ -3875,9 +7543,8 @@ PICOL_COMMAND(lmap) {
     return picolLmap(interp, argv[1], argv[2], argv[3], 1);
 }
 PICOL_COMMAND(lrange) {
-    char buf[PICOL_MAX_STR] = "", buf2[PICOL_MAX_STR] = "";
-    const char* cp;
-    int from, to, a = 0, toend = 0;
+    picolObj* list, **elems;
+    int count, from, to = 0, toend = 0;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 4, "lrange list first last");
@@ -3887,32 +7554,44 @@ PICOL_COMMAND(lrange) {
     } else {
         PICOL_SCAN_INT(to, argv[3]);
     }
-    PICOL_FOREACH(buf, sizeof(buf), cp, argv[1]) {
-        if (a>=from && (toend || a<=to)) {
-            PICOL_LAPPEND(buf2, buf);
-        }
-        a++;
+    list = picolArgObj(interp, argv[1]);
+    PICOL_INCR_REF(list);
+    picolGetListFromObj(interp, list, &count, &elems);
+    if (from < 0) {
+        from = 0;
+    }
+    if (toend || to >= count) {
+        to = count - 1;
     }
-    return picolSetResult(interp, buf2);
+    /* The slice shares its elements with the source list. */
+    picolSetResultObj(
+        interp,
+        from <= to ? picolNewListObj(to - from + 1, elems + from)
+                   : picolNewObj("")
+    );
+    picolDecrRef(list);
+    return PICOL_OK;
 }
 PICOL_COMMAND(lrepeat) {
-    char result[PICOL_MAX_STR] = "";
+    picolStr result;
     int count, i, j;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc >= 2, "lrepeat count ?element ...?");
     PICOL_SCAN_INT(count, argv[1]);
+    picolStrInit(&result);
     for (i = 0; i < count; i++) {
         for (j = 2; j < argc; j++) {
-            PICOL_LAPPEND(result, argv[j]);
+            picolStrAppendElement(&result, argv[j]);
         }
     }
-    return picolSetResult(interp, result);
+    return picolStrResult(interp, &result);
 }
 PICOL_COMMAND(lreplace) {
-    char buf[PICOL_MAX_STR] = "";
-    char buf2[PICOL_MAX_STR] = "";
+    picolStr result;
+    char* buf;
     const char* cp;
+    size_t size;
     int from, to = INT_MAX, a = 0, done = 0, j, toend = 0;
     PICOL_UNUSED(pd);
 
@@ -3924,108 +7603,206 @@ PICOL_COMMAND(lreplace) {
         PICOL_SCAN_INT(to, argv[3]);
     }
 
+    picolStrInit(&result);
     if (from < 0 && to < 0) {
         for (j = 4; j < argc; j++) {
-            PICOL_LAPPEND(buf2, argv[j]);
+            picolStrAppendElement(&result, argv[j]);
         }
         done = 1;
     }
-    PICOL_FOREACH(buf, sizeof(buf), cp, argv[1]) {
+    size = PICOL_ELEMENT_SIZE(argv[1]);
+    buf = PICOL_MALLOC(size);
+    PICOL_FOREACH(buf, size, cp, argv[1]) {
         if (a < from || (a > to && !toend)) {
-            PICOL_LAPPEND(buf2, buf);
+            picolStrAppendElement(&result, buf);
         } else if (!done) {
             for (j = 4; j < argc; j++) {
-                PICOL_LAPPEND(buf2, argv[j]);
+                picolStrAppendElement(&result, argv[j]);
             }
             done = 1;
         }
         a++;
     }
+    PICOL_FREE(buf);
     if (!done) {
         for (j = 4; j < argc; j++) {
-            PICOL_LAPPEND(buf2, argv[j]);
+            picolStrAppendElement(&result, argv[j]);
         }
     }
 
-    return picolSetResult(interp, buf2);
+    return picolStrResult(interp, &result);
 }
 PICOL_COMMAND(lreverse) {
-    char result[PICOL_MAX_STR] = "", element[PICOL_MAX_STR] = "";
-    const char* cp;
-    int element_len, result_len = 0, i, needs_braces;
+    picolObj* list, **elems;
+    picolStr result;
+    int count, i;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 2, "lreverse list");
-    if (argv[1][0] == '\0') {
-        return picolSetResult(interp, "");
+    list = picolArgObj(interp, argv[1]);
+    PICOL_INCR_REF(list);
+    picolGetListFromObj(interp, list, &count, &elems);
+    picolStrInit(&result);
+    for (i = count - 1; i >= 0; i--) {
+        picolStrAppendElement(&result, elems[i]->str);
     }
-    PICOL_FOREACH(element, sizeof(element), cp, argv[1]) {
-        element_len = strlen(element);
-        needs_braces = picolNeedsBraces(element);
-        memmove(result + element_len + needs_braces*2 + 1,
-                result,
-                result_len + 1);
-        for (i = needs_braces; i < element_len + needs_braces; i++) {
-            result[i] = element[i - needs_braces];
-        }
-        if (needs_braces) {
-            result[i] = '}';
-            result[0] = '{';
-            i++;
-        }
-        result[i] = ' ';
-        result_len += element_len + needs_braces*2 + 1;
+    picolDecrRef(list);
+    return picolStrResult(interp, &result);
+}
+picolResult picolSearchCompare(
+    picolInterp* interp,
+    picolObj* elem,
+    const char* pattern,
+    int n,
+    int integer,
+    int* diff
+) {
+    /* Compare an element to the pattern of lsearch, which is the integer n
+       with -integer.  The element keeps its integer form for the next
+       search. */
+    int i;
+    if (!integer) {
+        *diff = strcmp(elem->str, pattern);
+        return PICOL_OK;
     }
-    result[result_len - 1] = '\0';
-    return picolSetResult(interp, result);
+    if (picolGetIntFromObj(interp, elem, &i) != PICOL_OK) {
+        return PICOL_ERR;
+    }
+    *diff = i > n ? 1 : i < n ? -1 : 0;
+    return PICOL_OK;
 }
 PICOL_COMMAND(lsearch) {
-    char buf[PICOL_MAX_STR] = "";
-    const char *list, *pattern, *cp;
-    int j = 0;
-    int match_mode; // 0 for exact, 1 for glob.
+    picolObj* list, **elems, **result;
+    picolStr indices;
+    const char* pattern;
+    int* found;
+    int count, nfound = 0, a, i, lo, hi, mid, diff = 0, n = 0, matched;
+    int mode = 1; /* 0 for -exact, 1 for -glob, 2 for -sorted */
+    int all = 0, decreasing = 0, integer = 0, negate = 0, values = 0;
+    picolResult rc = PICOL_OK;
     PICOL_UNUSED(pd);
 
-    PICOL_ARITY2(
-        argc == 3 || argc == 4,
-        "lsearch ?-exact|-glob? list pattern"
-    );
-    if (argc == 4) {
-        list = argv[2];
-        pattern = argv[3];
-
-        if (PICOL_EQ(argv[1], "-exact")) {
-            match_mode = 0;
-        } else if (PICOL_EQ(argv[1], "-glob")) {
-            match_mode = 1;
+    PICOL_ARITY2(argc >= 3, "lsearch ?-option value ...? list pattern");
+    for (a = 1; a < argc - 2; a++) {
+        if (PICOL_EQ(argv[a], "-all")) {
+            all = 1;
+        } else if (PICOL_EQ(argv[a], "-ascii")) {
+            integer = 0;
+        } else if (PICOL_EQ(argv[a], "-decreasing")) {
+            decreasing = 1;
+        } else if (PICOL_EQ(argv[a], "-exact")) {
+            mode = 0;
+        } else if (PICOL_EQ(argv[a], "-glob")) {
+            mode = 1;
+        } else if (PICOL_EQ(argv[a], "-increasing")) {
+            decreasing = 0;
+        } else if (PICOL_EQ(argv[a], "-inline")) {
+            values = 1;
+        } else if (PICOL_EQ(argv[a], "-integer")) {
+            integer = 1;
+        } else if (PICOL_EQ(argv[a], "-not")) {
+            negate = 1;
+        } else if (PICOL_EQ(argv[a], "-sorted")) {
+            mode = 2;
         } else {
-            return picolErrFmt(
-                interp,
-                "bad option \"%s\": must be -exact or -glob",
-                argv[1]
-            );
+            return picolErrFmt(interp, "bad option \"%s\": must be -all, "
+                               "-ascii, -decreasing, -exact, -glob, "
+                               "-increasing, -inline, -integer, -not, or "
+                               "-sorted", argv[a]);
+        }
+    }
+    pattern = argv[argc - 1];
+    if (mode == 2 && negate) {
+        mode = 0;
+    }
+    if (integer && mode != 1) {
+        PICOL_SCAN_INT(n, pattern);
+    } else {
+        integer = 0;
+    }
+    list = picolArgObj(interp, argv[argc - 2]);
+    PICOL_INCR_REF(list);
+    picolGetListFromObj(interp, list, &count, &elems);
+    found = PICOL_MALLOC(sizeof(int) * (count + 1));
+    if (mode == 2) {
+        /* Find the first element not less than the pattern by binary search.
+           The matches, if any, start there. */
+        lo = 0;
+        hi = count;
+        while (lo < hi && rc == PICOL_OK) {
+            mid = lo + (hi - lo) / 2;
+            rc = picolSearchCompare(interp, elems[mid], pattern, n, integer,
+                                    &diff);
+            if (rc != PICOL_OK) {
+                break;
+            }
+            if ((decreasing ? -diff : diff) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        for (i = lo; i < count && rc == PICOL_OK; i++) {
+            rc = picolSearchCompare(interp, elems[i], pattern, n, integer,
+                                    &diff);
+            if (rc != PICOL_OK || diff != 0) {
+                break;
+            }
+            found[nfound++] = i;
+            if (!all) {
+                break;
+            }
         }
     } else {
-        list = argv[1];
-        pattern = argv[2];
-        match_mode = 1;
+        for (i = 0; i < count && rc == PICOL_OK; i++) {
+            if (mode == 1) {
+                matched = picolMatch(pattern, elems[i]->str) > 0;
+            } else {
+                rc = picolSearchCompare(interp, elems[i], pattern, n, integer,
+                                        &diff);
+                matched = diff == 0;
+            }
+            if (rc == PICOL_OK && matched != negate) {
+                found[nfound++] = i;
+                if (!all) {
+                    break;
+                }
+            }
+        }
     }
-
-    PICOL_FOREACH(buf, sizeof(buf), cp, list) {
-        if ((match_mode == 0 && PICOL_EQ(pattern, buf)) ||
-            (match_mode == 1 && picolMatch(pattern, buf) > 0)) {
-            return picolSetIntResult(interp, j);
+    if (rc == PICOL_OK) {
+        if (values && all) {
+            result = PICOL_MALLOC(sizeof(picolObj*) * (nfound + 1));
+            for (i = 0; i < nfound; i++) {
+                result[i] = elems[found[i]];
+            }
+            picolSetResultObj(interp, picolNewListObj(nfound, result));
+            PICOL_FREE(result);
+        } else if (values) {
+            picolSetResultObj(
+                interp,
+                nfound > 0 ? elems[found[0]] : picolNewObj("")
+            );
+        } else if (all) {
+            picolStrInit(&indices);
+            for (i = 0; i < nfound; i++) {
+                char buf[32];
+                PICOL_SNPRINTF(buf, sizeof(buf), "%d", found[i]);
+                picolStrAppendElement(&indices, buf);
+            }
+            picolStrResult(interp, &indices);
+        } else {
+            picolSetIntResult(interp, nfound > 0 ? found[0] : -1);
         }
-        j++;
     }
-
-    return picolSetResult(interp, "-1");
+    PICOL_FREE(found);
+    picolDecrRef(list);
+    return rc;
 }
 PICOL_COMMAND(lset) {
-    char buf[PICOL_MAX_STR] = "", buf2[PICOL_MAX_STR]="";
-    const char* cp;
+    picolObj* list, *value, **elems, **result;
     picolVar* var;
-    int pos, a=0, set_rc;
+    int count, pos, set_rc;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 4, "lset listVar index value");
@@ -4037,125 +7814,474 @@ PICOL_COMMAND(lset) {
         return picolErrFmt(interp, "no variable %s", argv[1]);
     }
     PICOL_SCAN_INT(pos, argv[2]);
-    PICOL_FOREACH(buf, sizeof(buf), cp, var->val) {
-        if (a==pos) {
-            PICOL_LAPPEND(buf2, argv[3]);
-        } else {
-            PICOL_LAPPEND(buf2, buf);
+    list = var->obj;
+    PICOL_INCR_REF(list);
+    picolGetListFromObj(interp, list, &count, &elems);
+    if (pos < 0 || pos > count) {
+        picolDecrRef(list);
+        return picolErr(interp, "list index out of range");
+    }
+    result = PICOL_MALLOC(sizeof(picolObj*) * (count + 1));
+    if (count > 0) {
+        memcpy(result, elems, sizeof(picolObj*) * count);
+    }
+    if (pos < count) {
+        result[pos] = picolArgObj(interp, argv[3]);
+    }
+    value = picolNewListObj(count, result);
+    PICOL_FREE(result);
+    picolDecrRef(list);
+    PICOL_INCR_REF(value);
+    set_rc = picolSetVarObj(interp, var->name, value, 0);
+    if (set_rc == PICOL_OK) {
+        picolSetResultObj(interp, value);
+    }
+    picolDecrRef(value);
+    return set_rc;
+}
+/* Sort functions for lsort. */
+int picolSortCompare(picolSort* sort, picolSortKey* a, picolSortKey* b) {
+    int diff;
+    switch (sort->mode) {
+    case PICOL_SORT_INTEGER:
+        diff = a->i > b->i ? 1 : a->i < b->i ? -1 : 0;
+        break;
+    case PICOL_SORT_REAL:
+        diff = a->d > b->d ? 1 : a->d < b->d ? -1 : 0;
+        break;
+    case PICOL_SORT_COMMAND:
+        diff = picolSortCommand(sort, a, b);
+        break;
+    default:
+        diff = strcmp(a->str, b->str);
+    }
+    return sort->decreasing ? -diff : diff;
+}
+int picolSortCommand(picolSort* sort, picolSortKey* a, picolSortKey* b) {
+    /* Compare a and b with the -command.  Its words were taken apart once, so
+       each comparison is a plain call of the command with two more words. */
+    const char* argv[PICOL_INLINE_ARGS];
+    picolObj* objv[PICOL_INLINE_ARGS];
+    int argc = sort->cmdc + 2, diff = 0, halt, j;
+    const char** av = argv;
+    picolObj** ov = objv;
+    if (sort->rc != PICOL_OK) {
+        return 0; /* wind down after an error */
+    }
+    if (argc > PICOL_INLINE_ARGS) {
+        av = PICOL_MALLOC(sizeof(char*) * argc);
+        ov = PICOL_MALLOC(sizeof(picolObj*) * argc);
+    }
+    for (j = 0; j < sort->cmdc; j++) {
+        ov[j] = sort->cmdv[j];
+    }
+    ov[j] = a->key;
+    ov[j + 1] = b->key;
+    for (j = 0; j < argc; j++) {
+        PICOL_INCR_REF(ov[j]);
+        av[j] = ov[j]->str;
+    }
+    sort->rc = picolEvalCommand(sort->interp, NULL, argc, av, ov, &halt);
+    for (j = 0; j < argc; j++) {
+        picolDecrRef(ov[j]);
+    }
+    if (av != argv) {
+        PICOL_FREE(av);
+        PICOL_FREE(ov);
+    }
+    if (sort->rc == PICOL_OK && picolGetIntFromObj(
+            sort->interp, sort->interp->resultobj, &diff) != PICOL_OK) {
+        sort->rc = picolErr(
+            sort->interp,
+            "-compare command returned non-integer result"
+        );
+    }
+    return diff;
+}
+picolResult picolSortKeys(picolSort* sort, picolSortKey** keys, int n) {
+    /* A bottom-up merge sort, which is stable and needs few comparisons.
+       Runs of width w are merged from one array into the other.  A key taken
+       from the left run that compares equal to the head of the right one is
+       marked as a duplicate of the key after it, which is either that head
+       or a key equal to it.  Every run of equal keys is merged this way, so
+       -unique needs no more comparisons. */
+    picolSortKey** from = keys, **to, **tmp;
+    int w, lo, mid, hi, i, j, k, diff;
+    if (n < 2) {
+        return PICOL_OK;
+    }
+    to = PICOL_MALLOC(sizeof(picolSortKey*) * n);
+    tmp = to;
+    for (w = 1; w < n; w *= 2) {
+        for (lo = 0; lo < n; lo += 2 * w) {
+            mid = lo + w < n ? lo + w : n;
+            hi = lo + 2 * w < n ? lo + 2 * w : n;
+            i = lo;
+            j = mid;
+            k = lo;
+            while (i < mid && j < hi) {
+                diff = picolSortCompare(sort, from[j], from[i]);
+                if (diff < 0) {
+                    to[k++] = from[j++];
+                } else {
+                    if (diff == 0) {
+                        from[i]->dup = 1;
+                    }
+                    to[k++] = from[i++];
+                }
+            }
+            while (i < mid) {
+                to[k++] = from[i++];
+            }
+            while (j < hi) {
+                to[k++] = from[j++];
+            }
         }
-        a++;
+        tmp = from;
+        from = to;
+        to = tmp;
     }
-    if (pos < 0 || pos > a) {
-        return picolErr(interp, "list index out of range");
+    if (from != keys) {
+        memcpy(keys, from, sizeof(picolSortKey*) * n);
+        PICOL_FREE(from);
+    } else {
+        PICOL_FREE(to);
     }
-    set_rc = picolSetVar(interp, var->name, buf2);
-    if (set_rc != PICOL_OK) {
-        return set_rc;
+    return sort->rc;
+}
+#if PICOL_FEATURE_THREADS
+int picolSortSplit(picolSortTask* task, int i) {
+    /* Return how many of the first i elements of the merge come from a.
+       Equal elements come from a first, which keeps the merge stable. */
+    picolSortKey** a = task->a, **b = task->b;
+    int lo = i > task->nb ? i - task->nb : 0, hi = i < task->na ? i : task->na;
+    int j;
+    while (lo < hi) {
+        j = lo + (hi - lo) / 2;
+        if (picolSortCompare(task->sort, a[j], b[i - j - 1]) <= 0) {
+            lo = j + 1;
+        } else {
+            hi = j;
+        }
     }
-    return picolSetResult(interp, buf2);
+    return lo;
 }
-/* Sort functions for picol_Lsort. */
-int picolQsortCompStr(const void* a, const void* b) {
-    return strcmp(*(const char**)a, *(const char**)b);
+void picolSortMerge(picolSortTask* task) {
+    int i = picolSortSplit(task, task->start), j = task->start - i;
+    int iend = picolSortSplit(task, task->end), jend = task->end - iend;
+    int k = task->start;
+    while (i < iend && j < jend) {
+        if (picolSortCompare(task->sort, task->b[j], task->a[i]) < 0) {
+            task->out[k++] = task->b[j++];
+        } else {
+            task->out[k++] = task->a[i++];
+        }
+    }
+    while (i < iend) {
+        task->out[k++] = task->a[i++];
+    }
+    while (j < jend) {
+        task->out[k++] = task->b[j++];
+    }
 }
-int picolQsortCompStrDecr(const void* a, const void* b) {
-    return -strcmp(*(const char**)a, *(const char**)b);
+void* picolSortThread(void* arg) {
+    picolSortTask* task = arg;
+    if (task->out == NULL) {
+        picolSortKeys(task->sort, task->a, task->na);
+    } else {
+        picolSortMerge(task);
+    }
+    return NULL;
 }
-int picolQsortCompInt(const void* a, const void* b) {
-    int base, diff, int_a, int_b;
-    const char* cp = *(const char**)a;
-
-    base = picolIsInt(cp);
-    if (base < 1) { return 0; }
-    int_a = picolScanInt(cp, base);
-
-    cp = *(const char**)b;
-
-    base = picolIsInt(cp);
-    if (base < 1) { return 0; }
-    int_b = picolScanInt(cp, base);
-
-    diff = int_a - int_b;
-    return (diff > 0 ? 1 : diff < 0 ? -1 : 0);
+void picolSortRun(picolSortTask* tasks, int count) {
+    /* Run every task but the first on a thread of its own and the first on
+       this one.  A task that gets no thread runs here as well. */
+    pthread_t ids[PICOL_SORT_MAX_THREADS];
+    char started[PICOL_SORT_MAX_THREADS];
+    int t;
+    for (t = 1; t < count; t++) {
+        started[t] = pthread_create(
+            &ids[t],
+            NULL,
+            picolSortThread,
+            &tasks[t]
+        ) == 0;
+    }
+    picolSortThread(&tasks[0]);
+    for (t = 1; t < count; t++) {
+        if (started[t]) {
+            pthread_join(ids[t], NULL);
+        } else {
+            picolSortThread(&tasks[t]);
+        }
+    }
 }
-picolResult picol_Lsort(
-    picolInterp* interp,
-    int argc,
-    const char** argv,
-    void* pd
+void picolSortParallel(
+    picolSort* sort,
+    picolSortKey** keys,
+    int n,
+    int threads
 ) {
-    char buf[PICOL_MAX_STR] = "";
-    const char** av = argv + 1;
-    PICOL_UNUSED(pd);
-
-    int ac = argc - 1, i;
-    if (argc < 2) {
-        return picolSetResult(interp, "");
+    /* Sort a chunk of keys on each thread, then merge the sorted runs in
+       pairs until one is left.  Every merge is split among the threads at
+       points found by binary search, so all of them stay busy to the end.
+       Only for comparisons that don't evaluate Tcl code. */
+    picolSortTask tasks[PICOL_SORT_MAX_THREADS];
+    int bounds[PICOL_SORT_MAX_THREADS + 1];
+    picolSortKey** from = keys, **to, **tmp;
+    int runs = threads, i, t, p, parts, lo, mid, hi;
+    for (i = 0; i <= runs; i++) {
+        bounds[i] = i * (n / runs) + (i < n % runs ? i : n % runs);
+    }
+    for (t = 0; t < runs; t++) {
+        tasks[t].sort = sort;
+        tasks[t].a = keys + bounds[t];
+        tasks[t].na = bounds[t + 1] - bounds[t];
+        tasks[t].out = NULL;
+    }
+    picolSortRun(tasks, runs);
+    to = PICOL_MALLOC(sizeof(picolSortKey*) * n);
+    while (runs > 1) {
+        parts = threads / ((runs + 1) / 2);
+        if (parts < 1) {
+            parts = 1;
+        }
+        t = 0;
+        for (i = 0; i < runs; i += 2) {
+            lo = bounds[i];
+            mid = bounds[i + 1];
+            hi = i + 2 <= runs ? bounds[i + 2] : mid;
+            for (p = 0; p < parts; p++) {
+                tasks[t].sort = sort;
+                tasks[t].a = from + lo;
+                tasks[t].na = mid - lo;
+                tasks[t].b = from + mid;
+                tasks[t].nb = hi - mid;
+                tasks[t].out = to + lo;
+                tasks[t].start = (hi - lo) / parts * p;
+                tasks[t].end = p == parts - 1 ? hi - lo
+                                              : (hi - lo) / parts * (p + 1);
+                t++;
+            }
+            bounds[i / 2] = lo;
+        }
+        runs = (runs + 1) / 2;
+        bounds[runs] = n;
+        picolSortRun(tasks, t);
+        tmp = from;
+        from = to;
+        to = tmp;
+    }
+    if (from != keys) {
+        memcpy(keys, from, sizeof(picolSortKey*) * n);
+        PICOL_FREE(from);
+    } else {
+        PICOL_FREE(to);
+    }
+    /* The split merges skip comparisons picolSortKeys() would make, so the
+       duplicates are found again.  These comparisons run no Tcl code. */
+    if (sort->unique) {
+        for (i = 0; i + 1 < n; i++) {
+            keys[i]->dup = picolSortCompare(sort, keys[i], keys[i + 1]) == 0;
+        }
     }
-    if (argc > 2 && PICOL_EQ(argv[1], "-decreasing")) {
-        qsort(++av, --ac, sizeof(char*), picolQsortCompStrDecr);
-    } else if (argc > 2 && PICOL_EQ(argv[1], "-integer")) {
-        av++; ac--;
+}
+#endif /* PICOL_FEATURE_THREADS */
+PICOL_COMMAND(lsort) {
+    picolSort sort;
+    picolSortKey* keys = NULL, **order = NULL;
+    picolObj* list, *cmd, **elems, **sub, **result;
+    const char* opt, *cmdarg = NULL, *indexarg = NULL;
+    char* end;
+    picolStr msg;
+    int count, subcount, a, i, n, k, index = -2, threads = 0;
+    picolResult rc = PICOL_OK;
+    PICOL_UNUSED(pd);
 
-        for (i = 0; i < ac; i++) {
-            int base = picolIsInt(av[i]);
-            if (base < 1) {
+    PICOL_ARITY2(argc >= 2, "lsort ?-option value ...? list");
+    sort.interp = interp;
+    sort.mode = PICOL_SORT_ASCII;
+    sort.decreasing = sort.nocase = 0;
+    sort.cmdc = 0;
+    sort.cmdv = NULL;
+    sort.unique = 0;
+    sort.rc = PICOL_OK;
+    for (a = 1; a < argc - 1; a++) {
+        opt = argv[a];
+        if (PICOL_EQ(opt, "-ascii")) {
+            sort.mode = PICOL_SORT_ASCII;
+        } else if (PICOL_EQ(opt, "-command")) {
+            if (a + 1 >= argc - 1) {
+                return picolErr(interp, "\"-command\" option must be "
+                                "followed by comparison command");
+            }
+            sort.mode = PICOL_SORT_COMMAND;
+            cmdarg = argv[++a];
+        } else if (PICOL_EQ(opt, "-decreasing")) {
+            sort.decreasing = 1;
+        } else if (PICOL_EQ(opt, "-increasing")) {
+            sort.decreasing = 0;
+        } else if (PICOL_EQ(opt, "-index")) {
+            if (a + 1 >= argc - 1) {
+                return picolErr(interp, "\"-index\" option must be "
+                                "followed by list index");
+            }
+            indexarg = argv[++a];
+            if (PICOL_EQ(indexarg, "end")) {
+                index = -1;
+            } else {
+                PICOL_SCAN_INT(index, indexarg);
+                if (index < 0) {
+                    return picolErrFmt(interp, "index \"%s\" out of range",
+                                       indexarg);
+                }
+            }
+        } else if (PICOL_EQ(opt, "-integer")) {
+            sort.mode = PICOL_SORT_INTEGER;
+        } else if (PICOL_EQ(opt, "-nocase")) {
+            sort.nocase = 1;
+        } else if (PICOL_EQ(opt, "-parallel")) {
+            if (a + 1 >= argc - 1) {
+                return picolErr(interp, "\"-parallel\" option must be "
+                                "followed by thread count");
+            }
+            PICOL_SCAN_INT(threads, argv[++a]);
+            if (threads < 1) {
                 return picolErrFmt(
                     interp,
-                    "expected integer but got \"%s\"",
-                    av[i]
+                    "expected positive integer but got \"%s\"",
+                    argv[a]
                 );
             }
-        }
-
-        qsort(av, ac, sizeof(char*), picolQsortCompInt);
-    } else if (argc>2 && PICOL_EQ(argv[1], "-unique")) {
-        qsort(++av, --ac, sizeof(char*), picolQsortCompStr);
-        for (i = 0; i < ac; i++) {
-            if (i == 0 || !PICOL_EQ(av[i], av[i - 1])) {
-                PICOL_LAPPEND(buf, av[i]);
+        } else if (PICOL_EQ(opt, "-real")) {
+            sort.mode = PICOL_SORT_REAL;
+        } else if (PICOL_EQ(opt, "-unique")) {
+            sort.unique = 1;
+        } else {
+            return picolErrFmt(interp, "bad option \"%s\": must be -ascii, "
+                               "-command, -decreasing, -increasing, -index, "
+                               "-integer, -nocase, -parallel, -real, or "
+                               "-unique", opt);
+        }
+    }
+    /* A -command comparator runs Tcl code, which only this thread may do. */
+    if (cmdarg != NULL && threads > 1) {
+        return picolErr(interp, "\"-parallel\" option cannot be used with "
+                        "-command");
+    }
+    list = picolArgObj(interp, argv[argc - 1]);
+    PICOL_INCR_REF(list);
+    if (cmdarg != NULL) {
+        /* Take the words of the command apart once for all the calls. */
+        cmd = picolArgObj(interp, cmdarg);
+        PICOL_INCR_REF(cmd);
+        picolGetListFromObj(interp, cmd, &sort.cmdc, &elems);
+        sort.cmdv = PICOL_MALLOC(sizeof(picolObj*) * (sort.cmdc + 1));
+        for (i = 0; i < sort.cmdc; i++) {
+            sort.cmdv[i] = elems[i];
+            PICOL_INCR_REF(elems[i]);
+        }
+        picolDecrRef(cmd);
+    }
+    picolGetListFromObj(interp, list, &count, &elems);
+    if (count > 0) {
+        keys = PICOL_MALLOC(sizeof(picolSortKey) * count);
+        order = PICOL_MALLOC(sizeof(picolSortKey*) * count);
+    }
+    for (n = 0; n < count; n++) {
+        picolSortKey* key = &keys[n];
+        key->elem = key->key = elems[n];
+        key->lower = NULL;
+        key->dup = 0;
+        PICOL_INCR_REF(key->elem);
+        order[n] = key;
+        if (index != -2) {
+            picolGetListFromObj(interp, key->elem, &subcount, &sub);
+            k = index == -1 ? subcount - 1 : index;
+            if (k < 0 || k >= subcount) {
+                PICOL_INCR_REF(key->key);
+                n++;
+                picolStrInit(&msg);
+                picolStrAppend(&msg, "element ");
+                picolStrAppend(&msg, indexarg);
+                picolStrAppend(&msg, " missing from sublist \"");
+                picolStrAppend(&msg, key->elem->str);
+                picolStrAppend(&msg, "\"");
+                rc = picolErr(interp, msg.buf);
+                picolStrFree(&msg);
+                break;
+            }
+            key->key = sub[k];
+        }
+        PICOL_INCR_REF(key->key);
+        if (sort.mode == PICOL_SORT_INTEGER) {
+            rc = picolGetIntFromObj(interp, key->key, &key->i);
+        } else if (sort.mode == PICOL_SORT_REAL) {
+            errno = 0;
+            key->d = strtod(key->key->str, &end);
+            if (end == key->key->str || *end != '\0' || errno == ERANGE) {
+                rc = picolErrFmt(
+                    interp,
+                    "expected floating-point number but got \"%s\"",
+                    key->key->str
+                );
+            }
+        } else if (sort.mode == PICOL_SORT_ASCII && sort.nocase) {
+            key->lower = strdup(key->key->str);
+            for (i = 0; key->lower[i] != '\0'; i++) {
+                key->lower[i] = tolower((unsigned char)key->lower[i]);
             }
         }
-        return picolSetResult(interp, buf);
-    } else {
-        qsort(av, ac, sizeof(char*), picolQsortCompStr);
+        key->str = key->lower != NULL ? key->lower : key->key->str;
+        if (rc != PICOL_OK) {
+            n++;
+            break;
+        }
     }
-
-    if (picolList(buf, sizeof(buf), ac, av) != PICOL_OK) {
-        return PICOL_ERR;
+#if PICOL_FEATURE_THREADS
+    if (threads == 0 && count >= PICOL_SORT_PARALLEL_MIN) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
     }
-    return picolSetResult(interp, buf);
-}
-PICOL_COMMAND(lsort) {
-    /* Dispatch to the helper function picol_Lsort. */
-    int rc;
-    PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
-    PICOL_UNUSED(pd);
-
-    if (!picolAppend(buf, PICOL_BUFFER_SIZE(buf), "_l ")) {
-        PICOL_BUFFER_DESTROY(buf);
-        return picolErr(interp, PICOL_ERROR_TOO_LONG);
+    if (threads > PICOL_SORT_MAX_THREADS) {
+        threads = PICOL_SORT_MAX_THREADS;
     }
-    PICOL_ARITY2(
-        argc == 2 || argc == 3,
-        "lsort ?-decreasing|-integer|-unique? list"
-    );
-    if (!picolAppend(buf, PICOL_BUFFER_SIZE(buf), argv[1])) {
-        PICOL_BUFFER_DESTROY(buf);
-        return picolErr(interp, PICOL_ERROR_TOO_LONG);
+    if (threads > count) {
+        threads = count;
     }
-    if (argc==3) {
-        if (!picolAppend(buf, PICOL_BUFFER_SIZE(buf), " ")) {
-            PICOL_BUFFER_DESTROY(buf);
-            return picolErr(interp, PICOL_ERROR_TOO_LONG);
-        }
-        if (!picolAppend(buf, PICOL_BUFFER_SIZE(buf), argv[2])) {
-            PICOL_BUFFER_DESTROY(buf);
-            return picolErr(interp, PICOL_ERROR_TOO_LONG);
+    if (rc == PICOL_OK && threads > 1 && sort.mode != PICOL_SORT_COMMAND) {
+        picolSortParallel(&sort, order, count, threads);
+    } else
+#endif
+    if (rc == PICOL_OK) {
+        rc = picolSortKeys(&sort, order, count);
+    }
+#if !PICOL_FEATURE_THREADS
+    PICOL_UNUSED(threads);
+#endif
+    if (rc == PICOL_OK) {
+        result = PICOL_MALLOC(sizeof(picolObj*) * (count + 1));
+        for (a = 0, k = 0; a < count; a++) {
+            /* -unique keeps the last of a run of equal elements. */
+            if (sort.unique && order[a]->dup) {
+                continue;
+            }
+            result[k++] = order[a]->elem;
         }
+        picolSetResultObj(interp, picolNewListObj(k, result));
+        PICOL_FREE(result);
     }
-    rc = picolEval(interp, buf);
-    PICOL_BUFFER_DESTROY(buf);
+    for (a = 0; a < n; a++) {
+        picolDecrRef(keys[a].elem);
+        picolDecrRef(keys[a].key);
+        PICOL_FREE(keys[a].lower);
+    }
+    for (a = 0; a < sort.cmdc; a++) {
+        picolDecrRef(sort.cmdv[a]);
+    }
+    PICOL_FREE(sort.cmdv);
+    PICOL_FREE(keys);
+    PICOL_FREE(order);
+    picolDecrRef(list);
     return rc;
 }
 picolResult picol_Math(
@@ -4234,7 +8360,7 @@ picolResult picol_Math(
     else if (PICOL_EQ(argv[0], "<<" )) {
         PICOL_ARITY(argc==3);
         if (b > (int)sizeof(int)*8 - 1) {
-            char buf[PICOL_MAX_STR];
+            char buf[80]; /* room for the message with two ints */
             PICOL_SNPRINTF(
                 buf,
                 sizeof(buf),
@@ -4368,10 +8494,14 @@ PICOL_COMMAND(proc) {
     PICOL_ARITY2(argc == 4, "proc name args body");
     picolRenameCmd(interp, argv[1], "");
 
-    procdata = PICOL_MALLOC(sizeof(picolProc));
-    procdata->rc = 1;
-    procdata->args = strdup(argv[2]);
-    procdata->body = strdup(argv[3]);
+    procdata = picolCreateProc(interp, argv[2], argv[3]);
+    if (procdata == NULL) {
+        return PICOL_ERR;
+    }
+    procdata->code = picolCompileScript(argv[3]);
+    if (procdata->code != NULL) {
+        picolAssignSlots(procdata, procdata->code);
+    }
 
     picolRegisterCmd(interp, argv[1], picolCallProc, procdata);
 
@@ -4452,10 +8582,9 @@ PICOL_COMMAND(rand) {
 }
 #if PICOL_FEATURE_IO
 PICOL_COMMAND(read) {
-    char buf[PICOL_MAX_STR*2];
-    int buf_size = sizeof(buf) - 1;
-    int size = buf_size; /* Size argument value. */
-    int actual_size = 0;
+    picolStr result;
+    int size = -1; /* Size argument value.  -1 reads everything. */
+    size_t chunk, n;
     FILE* fp = NULL;
     PICOL_UNUSED(pd);
 
@@ -4470,17 +8599,29 @@ PICOL_COMMAND(read) {
     }
     if (argc == 3) {
         PICOL_SCAN_INT(size, argv[2]);
-        if (size > PICOL_MAX_STR - 1) {
-            return picolErrFmt(interp, "size %s too large", argv[2]);
+        if (size < 0) {
+            return picolErrFmt(
+                interp,
+                "expected non-negative integer but got \"%s\"",
+                argv[2]
+            );
         }
     }
-    actual_size = fread(buf, 1, size, fp);
-    if (actual_size > PICOL_MAX_STR - 1) {
-        return picolErr(interp, "read contents too long");
-    } else {
-        buf[actual_size] = '\0';
-        return picolSetResult(interp, buf);
+    picolStrInit(&result);
+    while (size != 0) {
+        chunk = size > 0 && size < PICOL_MAX_STR ? (size_t)size : PICOL_MAX_STR;
+        picolStrReserve(&result, chunk);
+        n = fread(result.buf + result.len, 1, chunk, fp);
+        result.len += n;
+        if (n < chunk) {
+            break;
+        }
+        if (size > 0) {
+            size -= n;
+        }
     }
+    result.buf[result.len] = '\0';
+    return picolStrResult(interp, &result);
 }
 #endif /* PICOL_FEATURE_IO */
 PICOL_COMMAND(rename) {
@@ -4490,6 +8631,13 @@ PICOL_COMMAND(rename) {
     PICOL_ARITY2(argc == 3, "rename oldName newName");
     deleting = PICOL_EQ(argv[2], "");
 
+    if (!deleting && picolGetCmd(interp, argv[2]) != NULL) {
+        return picolErrFmt(
+            interp,
+            "can't rename to \"%s\": command already exists",
+            argv[2]
+        );
+    }
     if (picolRenameCmd(interp, argv[1], argv[2]) != PICOL_OK) {
         return picolErrFmt(
             interp,
@@ -4551,32 +8699,36 @@ PICOL_COMMAND(set) {
     if (argc == 2) {
         PICOL_GET_VAR(pv, argv[1]);
         if (pv && pv->val) {
-            return picolSetResult(interp, pv->val);
+            return picolSetResultObj(interp, pv->obj);
         } else {
             pv = picolGetGlobalVar(interp, argv[1]);
         }
         if (pv == NULL || pv->val == NULL) {
             return picolErrFmt(interp, "no value of \"%s\"\n", argv[1]);
         }
-        return picolSetResult(interp, pv->val);
+        return picolSetResultObj(interp, pv->obj);
     } else {
-        int set_rc = picolSetVar(interp, argv[1], argv[2]);
-        if (set_rc != PICOL_OK) {
-            return set_rc;
-        }
-        return picolSetResult(interp, argv[2]);
+        /* Share the value between the variable and the result. */
+        picolObj* value = picolArgObj(interp, argv[2]);
+        int set_rc;
+        PICOL_INCR_REF(value);
+        set_rc = picolSetVarObj(interp, argv[1], value, 0);
+        if (set_rc == PICOL_OK) {
+            picolSetResultObj(interp, value);
+        }
+        picolDecrRef(value);
+        return set_rc;
     }
 }
 picolResult picolSource(picolInterp* interp, const char* filename) {
-    PICOL_BUFFER_CREATE(buf, PICOL_SOURCE_BUF_SIZE);
-    PICOL_BUFFER_CREATE(prev, PICOL_MAX_STR);
+    char* buf = picolArenaAlloc(&interp->scratch, PICOL_SOURCE_BUF_SIZE);
+    picolObj* prev = NULL;
     int rc;
     picolVar* pv;
 
     FILE* fp = fopen(filename, "r");
     if (fp == NULL) {
-        PICOL_BUFFER_DESTROY(buf);
-        PICOL_BUFFER_DESTROY(prev);
+        picolArenaRelease(&interp->scratch, buf);
         return picolErrFmt(
             interp,
             "No such file or directory \"%s\"",
@@ -4585,21 +8737,26 @@ picolResult picolSource(picolInterp* interp, const char* filename) {
     }
 
     pv = picolGetGlobalVar(interp, PICOL_INFO_SCRIPT_VAR);
-    if (pv != NULL && pv->val != NULL) {
-        strncpy(prev, pv->val, PICOL_BUFFER_SIZE(prev));
+    if (pv != NULL && pv->obj != NULL) {
+        prev = pv->obj;
+        PICOL_INCR_REF(prev);
     }
 
     picolSetVar(interp, PICOL_INFO_SCRIPT_VAR, filename);
 
-    buf[fread(buf, 1, PICOL_BUFFER_SIZE(buf), fp)] = '\0';
+    buf[fread(buf, 1, PICOL_SOURCE_BUF_SIZE - 1, fp)] = '\0';
     fclose(fp);
 
     rc = picolEval(interp, buf);
 
-    picolSetVar(interp, PICOL_INFO_SCRIPT_VAR, prev);
+    if (prev != NULL) {
+        picolSetVarObj(interp, PICOL_INFO_SCRIPT_VAR, prev, 0);
+        picolDecrRef(prev);
+    } else {
+        picolSetVar(interp, PICOL_INFO_SCRIPT_VAR, "");
+    }
 
-    PICOL_BUFFER_DESTROY(buf);
-    PICOL_BUFFER_DESTROY(prev);
+    picolArenaRelease(&interp->scratch, buf);
     return rc;
 }
 #if PICOL_FEATURE_IO
@@ -4612,31 +8769,35 @@ PICOL_COMMAND(source) {
 #endif
 PICOL_COMMAND(split) {
     const char* split = " ", *cp, *start;
-    char buf[PICOL_MAX_STR] = "", buf2[PICOL_MAX_STR] = "";
+    picolStr result;
+    char* buf2;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 2 || argc == 3, "split string ?splitChars?");
     if (argc==3) {
         split = argv[2];
     }
+    buf2 = PICOL_MALLOC(strlen(argv[1]) + 1);
+    picolStrInit(&result);
     if (PICOL_EQ(split, "")) {
+        buf2[1] = '\0';
         for (cp = argv[1]; *cp; cp++) {
             buf2[0] = *cp;
-            PICOL_LAPPEND(buf, buf2);
+            picolStrAppendElement(&result, buf2);
         }
     } else {
         for (cp = argv[1], start=cp; *cp; cp++) {
             if (strchr(split, *cp)) {
-                strncpy(buf2, start, cp-start);
+                memcpy(buf2, start, cp-start);
                 buf2[cp-start] = '\0';
-                PICOL_LAPPEND(buf, buf2);
-                buf2[0] = '\0';
+                picolStrAppendElement(&result, buf2);
                 start = cp+1;
             }
         }
-        PICOL_LAPPEND(buf, start);
+        picolStrAppendElement(&result, start);
     }
-    return picolSetResult(interp, buf);
+    PICOL_FREE(buf2);
+    return picolStrResult(interp, &result);
 }
 const char* picolStrFirstTrailing(const char* str, char chr) {
     const char* cp;
@@ -4692,7 +8853,8 @@ picolResult picolToUpper(char* dest, size_t dest_size, const char* str) {
     return PICOL_OK;
 }
 PICOL_COMMAND(string) {
-    char buf[PICOL_MAX_STR] = "\0";
+    picolStr result;
+    char* buf;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc >= 3, "string option string ?arg..?");
@@ -4779,20 +8941,15 @@ PICOL_COMMAND(string) {
         from = from < 0  ? 0    : from;
         to   = to > maxi ? maxi : to;
         if (from <= to) {
-            strncpy(buf, &argv[2][from], to - from + 1);
-            buf[to + 1] = '\0';
-            picolSetResult(interp, buf);
+            picolStrInit(&result);
+            picolStrAppendN(&result, &argv[2][from], to - from + 1);
+            picolStrResult(interp, &result);
         }
     } else if (PICOL_SUBCMD("map")) {
         const char* charMap;
         const char* str;
-
-        char from[PICOL_MAX_STR] = "\0";
-        char to[PICOL_MAX_STR] = "\0";
-        char result[PICOL_MAX_STR] = "\0";
-
-        char tiny[2] = "\0\0";
-
+        char* from, *to;
+        size_t size;
         int nocase = 0;
 
         if (argc == 4) {
@@ -4806,15 +8963,22 @@ PICOL_COMMAND(string) {
             return picolErr(interp, "usage: string map ?-nocase? charMap str");
         }
 
+        size = PICOL_ELEMENT_SIZE(charMap);
+        from = PICOL_MALLOC(size);
+        to = PICOL_MALLOC(size);
+        picolStrInit(&result);
         for (; *str; str++) {
             int fromLen = 0;
             int matched = 0;
             const char* mp = charMap;
 
-            PICOL_FOREACH(from, sizeof(buf), mp, charMap) {
-                mp = picolListHead(mp, to, sizeof(to));
+            PICOL_FOREACH(from, size, mp, charMap) {
+                mp = picolListHead(mp, to, size);
 
                 if (mp == NULL) {
+                    PICOL_FREE(from);
+                    PICOL_FREE(to);
+                    picolStrFree(&result);
                     return picolErr(interp, "char map list unbalanced");
                 }
                 if (PICOL_EQ(from, "")) {
@@ -4823,7 +8987,7 @@ PICOL_COMMAND(string) {
 
                 fromLen = strlen(from);
                 if (picolStrCompare(str, from, fromLen, nocase) == 0) {
-                    PICOL_APPEND(result, to);
+                    picolStrAppend(&result, to);
                     str += fromLen - 1;
                     matched = 1;
                     break;
@@ -4831,12 +8995,13 @@ PICOL_COMMAND(string) {
             }
 
             if (!matched) {
-                tiny[0] = *str;
-                PICOL_APPEND(result, tiny);
+                picolStrAppendN(&result, str, 1);
             }
         }
+        PICOL_FREE(from);
+        PICOL_FREE(to);
 
-        return picolSetResult(interp, result);
+        return picolStrResult(interp, &result);
     } else if (PICOL_SUBCMD("match")) {
         int res = 0;
         if (argc == 4) {
@@ -4889,27 +9054,22 @@ PICOL_COMMAND(string) {
         int j, n;
         PICOL_ARITY2(argc == 4, "string repeat string count");
         PICOL_SCAN_INT(n, argv[3]);
+        picolStrInit(&result);
         for (j=0; j<n; j++) {
-            PICOL_APPEND(buf, argv[2]);
+            picolStrAppend(&result, argv[2]);
         }
-        picolSetResult(interp, buf);
+        picolStrResult(interp, &result);
 
     } else if (PICOL_SUBCMD("reverse")) {
         PICOL_ARITY2(argc == 3, "string reverse str");
-        if (picolStrRev(buf, sizeof(buf), argv[2]) != PICOL_OK) {
-            return picolErr(interp, PICOL_ERROR_TOO_LONG);
-        }
-        picolSetResult(interp, buf);
+        buf = picolResultBuffer(interp, strlen(argv[2]) + 1);
+        picolStrRev(buf, strlen(argv[2]) + 1, argv[2]);
     } else if (PICOL_SUBCMD("tolower") && argc == 3) {
-        if (picolToLower(buf, sizeof(buf), argv[2]) != PICOL_OK) {
-            return picolErr(interp, PICOL_ERROR_TOO_LONG);
-        }
-        picolSetResult(interp, buf);
+        buf = picolResultBuffer(interp, strlen(argv[2]) + 1);
+        picolToLower(buf, strlen(argv[2]) + 1, argv[2]);
     } else if (PICOL_SUBCMD("toupper") && argc == 3) {
-        if (picolToUpper(buf, sizeof(buf), argv[2]) != PICOL_OK) {
-            return picolErr(interp, PICOL_ERROR_TOO_LONG);
-        }
-        picolSetResult(interp, buf);
+        buf = picolResultBuffer(interp, strlen(argv[2]) + 1);
+        picolToUpper(buf, strlen(argv[2]) + 1, argv[2]);
     } else if (PICOL_SUBCMD("trim") ||
                PICOL_SUBCMD("trimleft") ||
                PICOL_SUBCMD("trimright")) {
@@ -4939,9 +9099,9 @@ PICOL_COMMAND(string) {
             }
         }
         len = end - start+1;
-        strncpy(buf, start, len);
-        buf[len] = '\0';
-        return picolSetResult(interp, buf);
+        picolStrInit(&result);
+        picolStrAppendN(&result, start, len);
+        return picolStrResult(interp, &result);
 
     } else {
         return picolErrFmt(
@@ -4961,35 +9121,37 @@ PICOL_COMMAND(subst) {
     return picolSubst(interp, argv[1]);
 }
 PICOL_COMMAND(switch) {
-    PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
-    const char* cp;
     int fallthrough = 0, a;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc > 2, "switch string pattern body ... ?default body?");
     if (argc==3) { /* the braced body variant */
-        PICOL_FOREACH(buf, PICOL_BUFFER_SIZE(buf), cp, argv[2]) {
+        picolObj* list, **elems;
+        int count;
+        list = picolArgObj(interp, argv[2]);
+        PICOL_INCR_REF(list);
+        picolGetListFromObj(interp, list, &count, &elems);
+        for (a = 0; a < count; a += 2) {
             if (fallthrough ||
-                PICOL_EQ(buf, argv[1]) ||
-                PICOL_EQ(buf, "default")) {
-                cp = picolListHead(cp, buf, PICOL_BUFFER_SIZE(buf));
-                if (cp == NULL) {
-                    PICOL_BUFFER_DESTROY(buf);
+                PICOL_EQ(elems[a]->str, argv[1]) ||
+                PICOL_EQ(elems[a]->str, "default")) {
+                if (a + 1 == count) {
+                    picolDecrRef(list);
                     return picolErr(interp,
                                     "switch: list must have an even number");
                 }
-                if (PICOL_EQ(buf, "-")) {
+                if (PICOL_EQ(elems[a + 1]->str, "-")) {
                     fallthrough = 1;
                 } else {
-                    int rc = picolEval(interp, buf);
-                    PICOL_BUFFER_DESTROY(buf);
+                    int rc = picolTailEval(interp, elems[a + 1]);
+                    picolDecrRef(list);
                     return rc;
                 }
             }
         }
+        picolDecrRef(list);
     } else { /* unbraced body */
         if (argc % 2 == 1) {
-            PICOL_BUFFER_DESTROY(buf);
             return picolErr(
                 interp,
                 "switch: list must have an even number"
@@ -5004,16 +9166,37 @@ PICOL_COMMAND(switch) {
                     fallthrough = 1;
                     a++;
                 } else {
-                    int rc = picolEval(interp, argv[a + 1]);
-                    PICOL_BUFFER_DESTROY(buf);
-                    return rc;
+                    return picolTailEval(
+                        interp,
+                        picolArgObj(interp, argv[a + 1])
+                    );
                 }
             }
         }
     }
-    PICOL_BUFFER_DESTROY(buf);
     return picolSetResult(interp, "");
 }
+PICOL_COMMAND(tailcall) {
+    /* Leave the command to the proc's caller, which runs it in place of the
+       proc. */
+    picolCallFrame* cf = interp->callframe;
+    PICOL_UNUSED(pd);
+
+    if (cf->parent == NULL) {
+        return picolErr(
+            interp,
+            "tailcall can only be called from a proc or lambda"
+        );
+    }
+    picolWordsFree(interp, cf->tailcallc, cf->tailcallv);
+    cf->tailcallv = NULL;
+    if (argc > 1) {
+        cf->tailcallc = argc - 1;
+        cf->tailcallv = picolWordsNew(interp, argc - 1, argv + 1);
+    }
+    picolSetResult(interp, "");
+    return PICOL_RETURN;
+}
 PICOL_COMMAND(time) {
     int j, n = 1, rc;
 #if PICOL_TCL_PLATFORM_PLATFORM == PICOL_TCL_PLATFORM_WINDOWS
@@ -5024,7 +9207,7 @@ PICOL_COMMAND(time) {
     clock_t start;
 #endif
     double dt;
-    PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
+    char* buf = picolArenaAlloc(&interp->scratch, PICOL_MAX_STR);
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc==2 || argc==3, "time command ?count?");
@@ -5035,7 +9218,7 @@ PICOL_COMMAND(time) {
             n = picolScanInt(argv[2], base);
         }
         else {
-            PICOL_BUFFER_DESTROY(buf);
+            picolArenaRelease(&interp->scratch, buf);
             return picolErrFmt(
                 interp,
                 "expected integer but got \"%s\"",
@@ -5053,7 +9236,7 @@ PICOL_COMMAND(time) {
 #endif
     for (j = 0; j < n; j++) {
         if ((rc = picolEval(interp, argv[1])) != PICOL_OK) {
-            PICOL_BUFFER_DESTROY(buf);
+            picolArenaRelease(&interp->scratch, buf);
             return rc;
         }
     }
@@ -5071,18 +9254,17 @@ PICOL_COMMAND(time) {
 #endif
     PICOL_SNPRINTF(
         buf,
-        PICOL_BUFFER_SIZE(buf),
+        PICOL_MAX_STR,
         "%.1f microseconds per iteration",
         dt/n
     );
     rc = picolSetResult(interp, buf);
-    PICOL_BUFFER_DESTROY(buf);
+    picolArenaRelease(&interp->scratch, buf);
     return rc;
 }
 PICOL_COMMAND(try) {
     int body_rc, handler_rc, err_rc;
-    PICOL_BUFFER_CREATE(body_result, PICOL_MAX_STR);
-    PICOL_BUFFER_CREATE(handler_result, PICOL_MAX_STR);
+    picolObj* body_result = NULL, *handler_result = NULL;
     PICOL_UNUSED(pd);
 
     if (!(argc == 2 || argc == 4 || argc == 6 || argc == 8))
@@ -5129,46 +9311,42 @@ PICOL_COMMAND(try) {
         goto err;
     }
     body_rc = picolEval(interp, argv[1]);
-    strncpy(body_result, interp->result, PICOL_BUFFER_SIZE(body_result));
+    body_result = interp->resultobj;
+    PICOL_INCR_REF(body_result);
     /* Run the error handler if we were given one and there was an error. */
     if ((argc == 6 || argc == 8) && body_rc == PICOL_ERR) {
         int set_rc = picolSetVar(interp, argv[4], interp->result);
         if (set_rc != PICOL_OK) {
-            PICOL_BUFFER_DESTROY(body_result);
-            PICOL_BUFFER_DESTROY(handler_result);
+            picolDecrRef(body_result);
             return set_rc;
         }
         handler_rc = picolEval(interp, argv[5]);
-        strncpy(
-            handler_result,
-            interp->result,
-            PICOL_BUFFER_SIZE(handler_result)
-        );
+        handler_result = interp->resultobj;
+        PICOL_INCR_REF(handler_result);
     }
     /* Run the "finally" script. If it fails, return its result. */
     if (argc == 4 || argc == 8) {
         int finally_rc = picolEval(interp, argv[argc == 4 ? 3 : 7]);
         if (finally_rc != PICOL_OK) {
-            PICOL_BUFFER_DESTROY(body_result);
-            PICOL_BUFFER_DESTROY(handler_result);
+            picolDecrRef(body_result);
+            if (handler_result != NULL) {
+                picolDecrRef(handler_result);
+            }
             return finally_rc;
         }
     }
     /* Return the error handler result if there was an error. */
     if ((argc == 6 || argc == 8) && body_rc == PICOL_ERR) {
-        picolSetResult(interp, handler_result);
-        PICOL_BUFFER_DESTROY(body_result);
-        PICOL_BUFFER_DESTROY(handler_result);
+        picolSetResultObj(interp, handler_result);
+        picolDecrRef(body_result);
+        picolDecrRef(handler_result);
         return handler_rc;
     }
     /* Return the result of evaluating the body. */
-    picolSetResult(interp, body_result);
-    PICOL_BUFFER_DESTROY(body_result);
-    PICOL_BUFFER_DESTROY(handler_result);
+    picolSetResultObj(interp, body_result);
+    picolDecrRef(body_result);
     return body_rc;
 err:
-    PICOL_BUFFER_DESTROY(body_result);
-    PICOL_BUFFER_DESTROY(handler_result);
     return err_rc;
 }
 PICOL_COMMAND(unset) {
@@ -5180,11 +9358,14 @@ PICOL_COMMAND(unset) {
     /* Remove an array element and return. */
     if (strchr(argv[1], '(')) {
         picolArray* ap;
-        char key[PICOL_MAX_STR];
-        ap = picolArrFindByName(interp, argv[1], 0, key, sizeof(key));
+        size_t size = strlen(argv[1]) + 1;
+        char* key = picolArenaAlloc(&interp->scratch, size);
+        ap = picolArrFindByName(interp, argv[1], 0, key, size);
+        result = ap == NULL ? PICOL_ERR : picolArrUnset(ap, key);
+        picolArenaRelease(&interp->scratch, key);
         if (ap != NULL) {
             /* The array exists. */
-            if (picolArrUnset(ap, key) == PICOL_OK) {
+            if (result == PICOL_OK) {
                 return picolSetResult(interp, "");
             } else {
                 return picolErrFmt(
@@ -5209,9 +9390,9 @@ PICOL_COMMAND(unset) {
     return picolSetResult(interp, "");
 }
 PICOL_COMMAND(uplevel) {
-    int rc, delta;
+    int delta;
     picolCallFrame* cf = interp->callframe;
-    PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
+    picolObj* script;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc >= 3, "uplevel level command ?arg...?");
@@ -5223,7 +9404,6 @@ PICOL_COMMAND(uplevel) {
             delta = picolScanInt(argv[1], base);
         }
         else {
-            PICOL_BUFFER_DESTROY(buf);
             return picolErrFmt(
                 interp,
                 "expected integer but got \"%s\"",
@@ -5231,65 +9411,69 @@ PICOL_COMMAND(uplevel) {
             );
         }
     }
+    if (argc == 3) {
+        script = picolArgObj(interp, argv[2]);
+    } else {
+        script = picolWrapObj(picolConcatNew(argc - 1, argv + 1));
+    }
     for (; delta>0 && interp->callframe->parent; delta--) {
         interp->callframe = interp->callframe->parent;
     }
-    if (picolConcat(
-        buf,
-        PICOL_BUFFER_SIZE(buf),
-        argc - 1,
-        argv + 1
-    ) != PICOL_OK) {
-        picolErr(interp, PICOL_ERROR_TOO_LONG);
-    }
-    rc = picolEval(interp, buf);
-    interp->callframe = cf; /* back to normal */
-    PICOL_BUFFER_DESTROY(buf);
-    return rc;
+    /* The caller evaluates the script and goes back to cf afterwards. */
+    interp->tailframe = cf;
+    return picolTailEval(interp, script);
 }
 PICOL_COMMAND(variable) {
     /* limited to :: namespace so far */
     int a, rc = PICOL_OK;
-    PICOL_BUFFER_CREATE(buf, PICOL_MAX_STR);
+    picolStr script;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc>1, "variable ?name value...? name ?value?");
     for (a = 1; a < argc && rc == PICOL_OK; a++) {
-        strcpy(buf, "global ");
-        strncat(buf, argv[a], PICOL_BUFFER_SIZE(buf) - strlen(argv[a]));
-        rc = picolEval(interp, buf);
+        picolStrInit(&script);
+        picolStrAppend(&script, "global ");
+        picolStrAppend(&script, argv[a]);
+        rc = picolEval(interp, script.buf);
+        picolStrFree(&script);
         if (rc == PICOL_OK && a < argc-1) {
             rc = picolSetGlobalVar(interp, argv[a], argv[a+1]);
             a++;
         }
     }
-    PICOL_BUFFER_DESTROY(buf);
     return rc;
 }
 PICOL_COMMAND(while) {
+    picolLoop* loop;
     PICOL_UNUSED(pd);
 
     PICOL_ARITY2(argc == 3, "while test command");
-    while (1) {
-        int rc = picolCondition(interp, argv[1]);
-        if (rc != PICOL_OK) {
-            return rc;
-        }
-        if (atoi(interp->result)) {
-            rc = picolEval(interp, argv[2]);
-            if (rc == PICOL_CONTINUE || rc == PICOL_OK)  {
-                continue;
-            } else if (rc == PICOL_BREAK) {
-                break;
-            } else {
-                return rc;
-            }
-        } else {
-            break;
-        }
+    loop = picolLoopNew();
+    loop->test = picolArgObj(interp, argv[1]);
+    loop->body = picolArgObj(interp, argv[2]);
+    PICOL_INCR_REF(loop->test);
+    PICOL_INCR_REF(loop->body);
+    return picolLoopNext(interp, loop);
+}
+#if PICOL_FEATURE_COROUTINES
+PICOL_COMMAND(yield) {
+    picolCoroutine* co = interp->coroutine;
+    PICOL_UNUSED(pd);
+
+    PICOL_ARITY2(argc == 1 || argc == 2, "yield ?value?");
+    if (co == NULL) {
+        return picolErr(interp, "yield can only be called in a coroutine");
     }
-    return picolSetResult(interp, "");
-} /* --------------------------------------------------------- Initialization */
+    picolSetResult(interp, argc == 2 ? argv[1] : "");
+    swapcontext(&co->ctx, &co->caller);
+    /* Resumed.  The result is the value passed to the coroutine. */
+    if (co->killed) {
+        return picolErr(interp, "coroutine deleted");
+    }
+    return PICOL_OK;
+}
+#endif
+/* --------------------------------------------------------- Initialization */
 void picolRegisterCoreCmds(picolInterp* interp) {
     int j;
     char* name[] = {
@@ -5358,6 +9542,7 @@ void picolRegisterCoreCmds(picolInterp* interp) {
     picolRegisterCmd(interp, "string",   picol_string, NULL);
     picolRegisterCmd(interp, "subst",    picol_subst, NULL);
     picolRegisterCmd(interp, "switch",   picol_switch, NULL);
+    picolRegisterCmd(interp, "tailcall", picol_tailcall, NULL);
     picolRegisterCmd(interp, "time",     picol_time, NULL);
     picolRegisterCmd(interp, "try",      picol_try, NULL);
     picolRegisterCmd(interp, "unset",    picol_unset, NULL);
@@ -5366,10 +9551,13 @@ void picolRegisterCoreCmds(picolInterp* interp) {
     picolRegisterCmd(interp, "while",    picol_while, NULL);
     picolRegisterCmd(interp, "!",        picol_not, NULL);
     picolRegisterCmd(interp, "~",        picol_bitwise_not, NULL);
-    picolRegisterCmd(interp, "_l",       picol_Lsort, NULL);
 #if PICOL_FEATURE_ARRAYS
     picolRegisterCmd(interp, "array",    picol_array, NULL);
 #endif
+#if PICOL_FEATURE_COROUTINES
+    picolRegisterCmd(interp, "coroutine", picol_coroutine, NULL);
+    picolRegisterCmd(interp, "yield",    picol_yield, NULL);
+#endif
 #if PICOL_FEATURE_GLOB
     picolRegisterCmd(interp, "glob",     picol_glob, NULL);
 #endif
@@ -5397,27 +9585,36 @@ void picolRegisterCoreCmds(picolInterp* interp) {
 #endif
 }
 void picolFreeInterp(picolInterp* interp) {
-    picolCmd* command = interp->commands;
-    picolPtr* ptr = interp->validptrs;
-    picolCallFrame* call = interp->callframe;
-
+    /* Everything is freed in a single pass.  Variables are not unset by
+       name: the arrays they refer to are destroyed through validptrs.  With
+       PICOL_POOLS the small blocks go back to the pool, which releases them
+       with its chunks at the end. */
+    picolCmd* command;
+    picolPtr* ptr;
+
+#if PICOL_FEATURE_COROUTINES
+    /* Suspended coroutines unwind while everything they may use is there. */
+    command = interp->commands;
+    while (command != NULL) {
+        if (command->func == picol_Coroutine) {
+            picolRenameCmd(interp, command->name, "");
+            command = interp->commands;
+        } else {
+            command = command->next;
+        }
+    }
+#endif
+    command = interp->commands;
+    ptr = interp->validptrs;
     while (command) {
         picolCmd* next = command->next;
-        picolFreeCmd(command);
+        picolFreeCmd(&interp->pool, command);
         command = next;
     }
+    PICOL_FREE(interp->cmdtable);
 
-    while (call) {
-        picolCallFrame* next = call->parent;
-        picolVar* var = call->vars;
-        while (var) {
-            picolVar* next = var->next;
-            picolUnsetVar(interp, var->name);
-            var = next;
-        }
-        PICOL_FREE(call->command);
-        PICOL_FREE(call);
-        call = next;
+    while (interp->callframe != NULL) {
+        picolDropCallFrame(interp);
     }
 
     while (ptr) {
@@ -5434,8 +9631,17 @@ void picolFreeInterp(picolInterp* interp) {
         ptr = next;
     }
 
+    picolScriptCacheFlush(interp);
+    picolExprCacheFlush(interp);
+    while (interp->execfree != NULL) {
+        picolExec* next = interp->execfree->parent;
+        PICOL_FREE(interp->execfree);
+        interp->execfree = next;
+    }
+    picolArenaFree(&interp->scratch);
+    picolPoolDestroy(&interp->pool);
     PICOL_FREE(interp->current);
-    PICOL_FREE(interp->result);
+    picolDecrRef(interp->resultobj);
     PICOL_FREE(interp);
 }
 picolInterp* picolCreateInterp(void) {
@@ -5467,11 +9673,8 @@ picolInterp* picolCreateInterp2(int register_core_cmds, int randomize) {
         1
     );
 
-    /* The maximum Picol string length.  Subtract one for the final '\0', which
-       scripts don't see. */
-    PICOL_SNPRINTF(buf, sizeof(buf), "%d", PICOL_MAX_STR - 1);
-    picolSetVar2(interp, "tcl_platform(maxLength)", buf, 1);
-
+    /* The default of [interp recursionlimit].  A recursion through the few
+       commands that nest in C stops at PICOL_MAX_DEPTH instead. */
     PICOL_SNPRINTF(buf, sizeof(buf), "%d", PICOL_MAX_LEVEL);
     picolSetVar2(interp, "tcl_platform(maxLevel)", buf, 1);
 
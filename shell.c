@@ -97,7 +97,6 @@ int main(int argc, char** argv) {
             if (rc != PICOL_OK) {
                 puts(interp->result);
             }
-            interp->current = NULL; /* Prevent a misleading error traceback. */
         }
 
         #if PICOL_SHELL_LINENOISE